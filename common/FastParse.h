@@ -0,0 +1,123 @@
+#ifndef FASTPARSE_H
+#define FASTPARSE_H
+
+#include <cstdint>
+
+// Minimal in-place tokenizer for ASCII mesh files. All functions work on a [p, end) range of a
+// memory mapped file and return the position behind the consumed token, or nullptr on a parse error.
+// No locale, no allocation, no per-token stream state.
+// One copy for the exercises that read OFF files, their CMakeLists.txt add this directory to the include path.
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' || c == '\f';
+}
+
+inline bool isDigit(char c) {
+    return static_cast<unsigned char>(c - '0') < 10;
+}
+
+// skips whitespace and '#' comments
+inline const char* skipWhitespace(const char* p, const char* end) {
+    while (p != end) {
+        if (isSpace(*p)) ++p;
+        else if (*p == '#') { while (p != end && *p != '\n') ++p; }
+        else break;
+    }
+    return p;
+}
+
+// skips everything up to and including the next line break
+inline const char* skipLine(const char* p, const char* end) {
+    while (p != end && *p != '\n') ++p;
+    return p == end ? end : p + 1;
+}
+
+// reads the next whitespace separated word into buffer (at most size - 1 characters)
+inline const char* parseWord(const char* p, const char* end, char* buffer, int size) {
+    p = skipWhitespace(p, end);
+    int i = 0;
+    while (p != end && !isSpace(*p)) {
+        if (i < size - 1) buffer[i++] = *p;
+        ++p;
+    }
+    buffer[i] = '\0';
+    return i > 0 ? p : nullptr;
+}
+
+inline const char* parseUInt(const char* p, const char* end, unsigned int& value) {
+    p = skipWhitespace(p, end);
+    if (p != end && *p == '+') ++p;
+    if (p == end || !isDigit(*p)) return nullptr;
+    uint64_t result = 0;
+    for (; p != end && isDigit(*p); ++p) {
+        result = result * 10 + static_cast<unsigned int>(*p - '0');
+        if (result > 0xFFFFFFFFu) return nullptr;
+    }
+    value = static_cast<unsigned int>(result);
+    return p;
+}
+
+// Decimal to float conversion. The first 19 significant digits are accumulated exactly in an integer,
+// the decimal exponent is applied with exact powers of ten in double precision before rounding to float.
+inline const char* parseFloat(const char* p, const char* end, float& value) {
+    static const double powersOfTen[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+    };
+    p = skipWhitespace(p, end);
+    bool negative = false;
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool anyDigit = false;
+    for (; p != end && isDigit(*p); ++p) {
+        anyDigit = true;
+        if (digits < 19) {
+            mantissa = mantissa * 10 + static_cast<unsigned int>(*p - '0');
+            if (mantissa != 0) ++digits;
+        } else {
+            ++exponent;
+        }
+    }
+    if (p != end && *p == '.') {
+        for (++p; p != end && isDigit(*p); ++p) {
+            anyDigit = true;
+            if (digits < 19) {
+                mantissa = mantissa * 10 + static_cast<unsigned int>(*p - '0');
+                if (mantissa != 0) ++digits;
+                --exponent;
+            }
+        }
+    }
+    if (!anyDigit) return nullptr;
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        const char* e = p + 1;
+        bool negativeExponent = false;
+        if (e != end && (*e == '-' || *e == '+')) {
+            negativeExponent = *e == '-';
+            ++e;
+        }
+        if (e != end && isDigit(*e)) {
+            int explicitExponent = 0;
+            for (; e != end && isDigit(*e); ++e) {
+                if (explicitExponent < 10000) explicitExponent = explicitExponent * 10 + (*e - '0');
+            }
+            exponent += negativeExponent ? -explicitExponent : explicitExponent;
+            p = e;
+        }
+    }
+    double result = static_cast<double>(mantissa);
+    if (mantissa != 0) {
+        while (exponent > 22) { result *= 1e22; exponent -= 22; }
+        while (exponent < -22) { result /= 1e22; exponent += 22; }
+        if (exponent >= 0) result *= powersOfTen[exponent];
+        else result /= powersOfTen[-exponent];
+    }
+    value = static_cast<float>(negative ? -result : result);
+    return p;
+}
+
+#endif //FASTPARSE_H
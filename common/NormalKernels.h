@@ -0,0 +1,536 @@
+#ifndef NORMALKERNELS_H
+#define NORMALKERNELS_H
+
+// Vectorized building blocks for area weighted vertex normals. Indices are three unsigned ints per triangle.
+// All kernels perform the same floating point operations in the same order as the scalar code
+// (cross(v1 - v0, v2 - v0), accumulation in triangle order, division by sqrt(x*x + y*y + z*z)),
+// so the results are bit-identical.
+// One copy for all exercises, their CMakeLists.txt add this directory to the include path.
+
+#include <cmath>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define NORMALKERNELS_SSE
+#if defined(__GNUC__) || defined(__clang__)
+#define NORMALKERNELS_AVX2
+#define NORMALKERNELS_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define NORMALKERNELS_AVX2
+#define NORMALKERNELS_TARGET_AVX2
+#endif
+#endif
+
+enum class NormalKernel {
+    SCALAR,
+    SSE,
+    AVX2,
+};
+
+inline const char* normalKernelName(NormalKernel kernel) {
+    switch (kernel) {
+        case NormalKernel::SSE: return "SSE";
+        case NormalKernel::AVX2: return "AVX2";
+        default: return "scalar";
+    }
+}
+
+inline bool normalKernelSupported(NormalKernel kernel) {
+    switch (kernel) {
+        case NormalKernel::SCALAR:
+            return true;
+        case NormalKernel::SSE:
+#ifdef NORMALKERNELS_SSE
+            return true;
+#else
+            return false;
+#endif
+        case NormalKernel::AVX2:
+#if defined(NORMALKERNELS_AVX2) && defined(_MSC_VER) && !defined(__clang__)
+            {
+                int info[4];
+                __cpuidex(info, 7, 0);
+                return (info[1] & (1 << 5)) != 0;
+            }
+#elif defined(NORMALKERNELS_AVX2)
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+// fastest kernel the CPU supports
+inline NormalKernel bestNormalKernel() {
+    if (normalKernelSupported(NormalKernel::AVX2)) return NormalKernel::AVX2;
+    if (normalKernelSupported(NormalKernel::SSE)) return NormalKernel::SSE;
+    return NormalKernel::SCALAR;
+}
+
+// Vertex data is processed in a padded layout with 4 floats (x, y, z, 0) per vertex, so every vertex is
+// a single 16 byte load or store. Batches of 4 (SSE) or 8 (AVX2) triangles are transposed to SoA,
+// their face normals computed side by side, transposed back and added to the three corners.
+
+// copies xyz vertices [begin, end) into the padded layout
+inline void padVertices(const float* xyz, size_t begin, size_t end, float* xyzw) {
+    for (size_t i = begin; i < end; ++i) {
+        xyzw[4 * i] = xyz[3 * i];
+        xyzw[4 * i + 1] = xyz[3 * i + 1];
+        xyzw[4 * i + 2] = xyz[3 * i + 2];
+        xyzw[4 * i + 3] = 0.f;
+    }
+}
+
+// ==============
+// === SCALAR ===
+// ==============
+
+// face normal of the triangle at tri
+inline void faceNormalScalar(const float* positions, const unsigned int* tri, float* n) {
+    const float* p0 = positions + 4 * tri[0];
+    const float* p1 = positions + 4 * tri[1];
+    const float* p2 = positions + 4 * tri[2];
+    const float e1x = p1[0] - p0[0], e1y = p1[1] - p0[1], e1z = p1[2] - p0[2];
+    const float e2x = p2[0] - p0[0], e2y = p2[1] - p0[1], e2z = p2[2] - p0[2];
+    n[0] = e1y * e2z - e1z * e2y;
+    n[1] = e1z * e2x - e1x * e2z;
+    n[2] = e1x * e2y - e1y * e2x;
+}
+
+inline void accumulateFaceNormalsScalar(const float* positions, const unsigned int* indices, size_t begin, size_t end, float* normals) {
+    for (size_t t = begin; t < end; ++t) {
+        float face[3];
+        faceNormalScalar(positions, indices + 3 * t, face);
+        for (int corner = 0; corner < 3; ++corner) {
+            float* n = normals + 4 * indices[3 * t + corner];
+            n[0] += face[0]; n[1] += face[1]; n[2] += face[2];
+        }
+    }
+}
+
+inline void computeFaceNormalsScalar(const float* positions, const unsigned int* indices, size_t begin, size_t end, float* faceNormals) {
+    for (size_t t = begin; t < end; ++t) {
+        faceNormalScalar(positions, indices + 3 * t, faceNormals + 4 * t);
+        faceNormals[4 * t + 3] = 0.f;
+    }
+}
+
+inline void gatherFaceNormalsScalar(const float* faceNormals, const unsigned int* offsets, const unsigned int* faces, size_t begin, size_t end, float* normals) {
+    for (size_t v = begin; v < end; ++v) {
+        float sum[3] = { 0.f, 0.f, 0.f };
+        for (unsigned int j = offsets[v]; j < offsets[v + 1]; ++j) {
+            const float* face = faceNormals + 4 * faces[j];
+            sum[0] += face[0]; sum[1] += face[1]; sum[2] += face[2];
+        }
+        float* n = normals + 4 * v;
+        n[0] = sum[0]; n[1] = sum[1]; n[2] = sum[2]; n[3] = 0.f;
+    }
+}
+
+// same as Vec3::normalize: vectors shorter than eps are copied unchanged
+inline void normalizeScalar(const float* normals, size_t begin, size_t end, float eps, float* xyz) {
+    for (size_t i = begin; i < end; ++i) {
+        const float* n = normals + 4 * i;
+        float* out = xyz + 3 * i;
+        const float l = std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+        if (std::fabs(l) < eps) {
+            out[0] = n[0]; out[1] = n[1]; out[2] = n[2];
+        } else {
+            out[0] = n[0] / l; out[1] = n[1] / l; out[2] = n[2] / l;
+        }
+    }
+}
+
+// ===========
+// === SSE ===
+// ===========
+
+#ifdef NORMALKERNELS_SSE
+// face normals of the 4 triangles at tri, one (x, y, z, 0) vector per triangle
+inline void faceNormalsSSE(const float* positions, const unsigned int* tri, __m128* n) {
+    __m128 x[3], y[3], z[3];
+    for (int corner = 0; corner < 3; ++corner) {
+        __m128 r0 = _mm_loadu_ps(positions + 4 * tri[corner]);
+        __m128 r1 = _mm_loadu_ps(positions + 4 * tri[3 + corner]);
+        __m128 r2 = _mm_loadu_ps(positions + 4 * tri[6 + corner]);
+        __m128 r3 = _mm_loadu_ps(positions + 4 * tri[9 + corner]);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        x[corner] = r0; y[corner] = r1; z[corner] = r2;
+    }
+    const __m128 e1x = _mm_sub_ps(x[1], x[0]), e1y = _mm_sub_ps(y[1], y[0]), e1z = _mm_sub_ps(z[1], z[0]);
+    const __m128 e2x = _mm_sub_ps(x[2], x[0]), e2y = _mm_sub_ps(y[2], y[0]), e2z = _mm_sub_ps(z[2], z[0]);
+    __m128 n0 = _mm_sub_ps(_mm_mul_ps(e1y, e2z), _mm_mul_ps(e1z, e2y));
+    __m128 n1 = _mm_sub_ps(_mm_mul_ps(e1z, e2x), _mm_mul_ps(e1x, e2z));
+    __m128 n2 = _mm_sub_ps(_mm_mul_ps(e1x, e2y), _mm_mul_ps(e1y, e2x));
+    __m128 n3 = _mm_setzero_ps();
+    _MM_TRANSPOSE4_PS(n0, n1, n2, n3);
+    n[0] = n0; n[1] = n1; n[2] = n2; n[3] = n3;
+}
+
+inline void accumulateFaceNormalsSSE(const float* positions, const unsigned int* indices, size_t begin, size_t end, float* normals) {
+    size_t t = begin;
+    for (; t + 4 <= end; t += 4) {
+        const unsigned int* tri = indices + 3 * t;
+        __m128 n[4];
+        faceNormalsSSE(positions, tri, n);
+        // accumulate in triangle order like the scalar code
+        for (int k = 0; k < 4; ++k) {
+            for (int corner = 0; corner < 3; ++corner) {
+                float* target = normals + 4 * tri[3 * k + corner];
+                _mm_storeu_ps(target, _mm_add_ps(_mm_loadu_ps(target), n[k]));
+            }
+        }
+    }
+    accumulateFaceNormalsScalar(positions, indices, t, end, normals);
+}
+
+inline void computeFaceNormalsSSE(const float* positions, const unsigned int* indices, size_t begin, size_t end, float* faceNormals) {
+    size_t t = begin;
+    for (; t + 4 <= end; t += 4) {
+        __m128 n[4];
+        faceNormalsSSE(positions, indices + 3 * t, n);
+        for (int k = 0; k < 4; ++k) _mm_storeu_ps(faceNormals + 4 * (t + k), n[k]);
+    }
+    computeFaceNormalsScalar(positions, indices, t, end, faceNormals);
+}
+
+inline void gatherFaceNormalsSSE(const float* faceNormals, const unsigned int* offsets, const unsigned int* faces, size_t begin, size_t end, float* normals) {
+    for (size_t v = begin; v < end; ++v) {
+        __m128 sum = _mm_setzero_ps();
+        for (unsigned int j = offsets[v]; j < offsets[v + 1]; ++j) sum = _mm_add_ps(sum, _mm_loadu_ps(faceNormals + 4 * faces[j]));
+        _mm_storeu_ps(normals + 4 * v, sum);
+    }
+}
+
+inline void normalizeSSE(const float* normals, size_t begin, size_t end, float eps, float* xyz) {
+    const __m128 epsilon = _mm_set1_ps(eps);
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        __m128 x = _mm_loadu_ps(normals + 4 * i);
+        __m128 y = _mm_loadu_ps(normals + 4 * i + 4);
+        __m128 z = _mm_loadu_ps(normals + 4 * i + 8);
+        __m128 w = _mm_loadu_ps(normals + 4 * i + 12);
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        const __m128 l = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z)));
+        // not (l < eps), so NaN lengths are divided like in the scalar code
+        const __m128 mask = _mm_cmpnlt_ps(l, epsilon);
+        x = _mm_or_ps(_mm_and_ps(mask, _mm_div_ps(x, l)), _mm_andnot_ps(mask, x));
+        y = _mm_or_ps(_mm_and_ps(mask, _mm_div_ps(y, l)), _mm_andnot_ps(mask, y));
+        z = _mm_or_ps(_mm_and_ps(mask, _mm_div_ps(z, l)), _mm_andnot_ps(mask, z));
+        _MM_TRANSPOSE4_PS(x, y, z, w);
+        // overlapping stores, each one overwrites the padding of the previous vertex
+        float* out = xyz + 3 * i;
+        _mm_storeu_ps(out, x);
+        _mm_storeu_ps(out + 3, y);
+        _mm_storeu_ps(out + 6, z);
+        alignas(16) float last[4];
+        _mm_store_ps(last, w);
+        out[9] = last[0]; out[10] = last[1]; out[11] = last[2];
+    }
+    normalizeScalar(normals, i, end, eps, xyz);
+}
+#endif
+
+// ============
+// === AVX2 ===
+// ============
+
+#ifdef NORMALKERNELS_AVX2
+// 4x4 transpose within each 128 bit half
+NORMALKERNELS_TARGET_AVX2
+inline void transpose4x4x2(__m256& r0, __m256& r1, __m256& r2, __m256& r3) {
+    const __m256 t0 = _mm256_unpacklo_ps(r0, r1), t1 = _mm256_unpacklo_ps(r2, r3);
+    const __m256 t2 = _mm256_unpackhi_ps(r0, r1), t3 = _mm256_unpackhi_ps(r2, r3);
+    r0 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+    r1 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+    r2 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    r3 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+// 4 floats from a in the lower, 4 floats from b in the upper half
+NORMALKERNELS_TARGET_AVX2
+inline __m256 loadVertexPair(const float* a, const float* b) {
+    return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(a)), _mm_loadu_ps(b), 1);
+}
+
+// face normals of the 8 triangles at tri, one (x, y, z, 0) vector per triangle
+NORMALKERNELS_TARGET_AVX2
+inline void faceNormalsAVX2(const float* positions, const unsigned int* tri, __m128* n) {
+    // lane k holds triangle k in the lower and triangle k + 4 in the upper half
+    __m256 x[3], y[3], z[3];
+    for (int corner = 0; corner < 3; ++corner) {
+        __m256 r0 = loadVertexPair(positions + 4 * tri[corner], positions + 4 * tri[12 + corner]);
+        __m256 r1 = loadVertexPair(positions + 4 * tri[3 + corner], positions + 4 * tri[15 + corner]);
+        __m256 r2 = loadVertexPair(positions + 4 * tri[6 + corner], positions + 4 * tri[18 + corner]);
+        __m256 r3 = loadVertexPair(positions + 4 * tri[9 + corner], positions + 4 * tri[21 + corner]);
+        transpose4x4x2(r0, r1, r2, r3);
+        x[corner] = r0; y[corner] = r1; z[corner] = r2;
+    }
+    const __m256 e1x = _mm256_sub_ps(x[1], x[0]), e1y = _mm256_sub_ps(y[1], y[0]), e1z = _mm256_sub_ps(z[1], z[0]);
+    const __m256 e2x = _mm256_sub_ps(x[2], x[0]), e2y = _mm256_sub_ps(y[2], y[0]), e2z = _mm256_sub_ps(z[2], z[0]);
+    __m256 n0 = _mm256_sub_ps(_mm256_mul_ps(e1y, e2z), _mm256_mul_ps(e1z, e2y));
+    __m256 n1 = _mm256_sub_ps(_mm256_mul_ps(e1z, e2x), _mm256_mul_ps(e1x, e2z));
+    __m256 n2 = _mm256_sub_ps(_mm256_mul_ps(e1x, e2y), _mm256_mul_ps(e1y, e2x));
+    __m256 n3 = _mm256_setzero_ps();
+    transpose4x4x2(n0, n1, n2, n3);
+    n[0] = _mm256_castps256_ps128(n0); n[1] = _mm256_castps256_ps128(n1);
+    n[2] = _mm256_castps256_ps128(n2); n[3] = _mm256_castps256_ps128(n3);
+    n[4] = _mm256_extractf128_ps(n0, 1); n[5] = _mm256_extractf128_ps(n1, 1);
+    n[6] = _mm256_extractf128_ps(n2, 1); n[7] = _mm256_extractf128_ps(n3, 1);
+}
+
+NORMALKERNELS_TARGET_AVX2
+inline void accumulateFaceNormalsAVX2(const float* positions, const unsigned int* indices, size_t begin, size_t end, float* normals) {
+    size_t t = begin;
+    for (; t + 8 <= end; t += 8) {
+        const unsigned int* tri = indices + 3 * t;
+        __m128 n[8];
+        faceNormalsAVX2(positions, tri, n);
+        for (int k = 0; k < 8; ++k) {
+            for (int corner = 0; corner < 3; ++corner) {
+                float* target = normals + 4 * tri[3 * k + corner];
+                _mm_storeu_ps(target, _mm_add_ps(_mm_loadu_ps(target), n[k]));
+            }
+        }
+    }
+    accumulateFaceNormalsScalar(positions, indices, t, end, normals);
+}
+
+NORMALKERNELS_TARGET_AVX2
+inline void computeFaceNormalsAVX2(const float* positions, const unsigned int* indices, size_t begin, size_t end, float* faceNormals) {
+    size_t t = begin;
+    for (; t + 8 <= end; t += 8) {
+        __m128 n[8];
+        faceNormalsAVX2(positions, indices + 3 * t, n);
+        for (int k = 0; k < 8; ++k) _mm_storeu_ps(faceNormals + 4 * (t + k), n[k]);
+    }
+    computeFaceNormalsScalar(positions, indices, t, end, faceNormals);
+}
+
+NORMALKERNELS_TARGET_AVX2
+inline void normalizeAVX2(const float* normals, size_t begin, size_t end, float eps, float* xyz) {
+    const __m256 epsilon = _mm256_set1_ps(eps);
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        const float* n = normals + 4 * i;
+        // vertices 0-3 in the lower, 4-7 in the upper halves
+        __m256 x = loadVertexPair(n, n + 16);
+        __m256 y = loadVertexPair(n + 4, n + 20);
+        __m256 z = loadVertexPair(n + 8, n + 24);
+        __m256 w = loadVertexPair(n + 12, n + 28);
+        transpose4x4x2(x, y, z, w);
+        const __m256 l = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(x, x), _mm256_mul_ps(y, y)), _mm256_mul_ps(z, z)));
+        const __m256 mask = _mm256_cmp_ps(l, epsilon, _CMP_NLT_UQ);
+        x = _mm256_blendv_ps(x, _mm256_div_ps(x, l), mask);
+        y = _mm256_blendv_ps(y, _mm256_div_ps(y, l), mask);
+        z = _mm256_blendv_ps(z, _mm256_div_ps(z, l), mask);
+        transpose4x4x2(x, y, z, w);
+        float* out = xyz + 3 * i;
+        _mm_storeu_ps(out, _mm256_castps256_ps128(x));
+        _mm_storeu_ps(out + 3, _mm256_castps256_ps128(y));
+        _mm_storeu_ps(out + 6, _mm256_castps256_ps128(z));
+        _mm_storeu_ps(out + 9, _mm256_castps256_ps128(w));
+        _mm_storeu_ps(out + 12, _mm256_extractf128_ps(x, 1));
+        _mm_storeu_ps(out + 15, _mm256_extractf128_ps(y, 1));
+        _mm_storeu_ps(out + 18, _mm256_extractf128_ps(z, 1));
+        alignas(16) float last[4];
+        _mm_store_ps(last, _mm256_extractf128_ps(w, 1));
+        out[21] = last[0]; out[22] = last[1]; out[23] = last[2];
+    }
+    normalizeScalar(normals, i, end, eps, xyz);
+}
+#endif
+
+// ======================
+// === ANGLE WEIGHTED ===
+// ======================
+
+// Every corner adds the unit face normal times its interior angle. The angle at a corner with edges a, b
+// is atan2(|a x b|, a . b), and |a x b| is twice the triangle area at all three corners, so one cross
+// product and three dot products per triangle suffice (no acos, no pow). Degenerate faces, where the sine
+// between the two edges of any corner is below AngleWeightMinSine, are skipped.
+const float AngleWeightMinSine = 1e-6f;
+
+// returns the number of skipped faces
+inline size_t accumulateAngleWeightedNormalsScalar(const float* positions, const unsigned int* indices, size_t begin, size_t end, float* normals) {
+    size_t skipped = 0;
+    for (size_t t = begin; t < end; ++t) {
+        const float* p0 = positions + 4 * indices[3 * t];
+        const float* p1 = positions + 4 * indices[3 * t + 1];
+        const float* p2 = positions + 4 * indices[3 * t + 2];
+        const float e01[3] = { p1[0] - p0[0], p1[1] - p0[1], p1[2] - p0[2] };
+        const float e02[3] = { p2[0] - p0[0], p2[1] - p0[1], p2[2] - p0[2] };
+        const float e12[3] = { p2[0] - p1[0], p2[1] - p1[1], p2[2] - p1[2] };
+        const float n[3] = { e01[1] * e02[2] - e01[2] * e02[1], e01[2] * e02[0] - e01[0] * e02[2], e01[0] * e02[1] - e01[1] * e02[0] };
+        const float nn = n[0] * n[0] + n[1] * n[1] + n[2] * n[2];
+        const float l01 = e01[0] * e01[0] + e01[1] * e01[1] + e01[2] * e01[2];
+        const float l02 = e02[0] * e02[0] + e02[1] * e02[1] + e02[2] * e02[2];
+        const float l12 = e12[0] * e12[0] + e12[1] * e12[1] + e12[2] * e12[2];
+        // |n|^2 = |a|^2 |b|^2 sin^2 for the edges a, b of every corner. also false for NaN.
+        const float minSine2 = AngleWeightMinSine * AngleWeightMinSine;
+        if (!(nn > minSine2 * l01 * l02 && nn > minSine2 * l01 * l12 && nn > minSine2 * l02 * l12)) {
+            skipped++;
+            continue;
+        }
+        const float length = std::sqrt(nn);
+        const float dots[3] = {
+            e01[0] * e02[0] + e01[1] * e02[1] + e01[2] * e02[2],
+            -(e01[0] * e12[0] + e01[1] * e12[1] + e01[2] * e12[2]),
+            e02[0] * e12[0] + e02[1] * e12[1] + e02[2] * e12[2],
+        };
+        for (int corner = 0; corner < 3; ++corner) {
+            const float weight = std::atan2(length, dots[corner]) / length;
+            float* target = normals + 4 * indices[3 * t + corner];
+            target[0] += n[0] * weight; target[1] += n[1] * weight; target[2] += n[2] * weight;
+        }
+    }
+    return skipped;
+}
+
+#ifdef NORMALKERNELS_SSE
+// atan2(y, x) for y > 0 in [0, pi]. single precision Cephes atanf polynomial after reducing
+// min(y, |x|) / max(y, |x|) to [0, tan(pi/8)].
+inline __m128 atan2PositiveSSE(__m128 y, __m128 x) {
+    const __m128 signMask = _mm_set1_ps(-0.f);
+    const __m128 ax = _mm_andnot_ps(signMask, x);
+    const __m128 t = _mm_div_ps(_mm_min_ps(y, ax), _mm_max_ps(y, ax));
+    const __m128 one = _mm_set1_ps(1.f);
+    const __m128 reduce = _mm_cmpgt_ps(t, _mm_set1_ps(0.414213562373095f));
+    const __m128 reduced = _mm_div_ps(_mm_sub_ps(t, one), _mm_add_ps(t, one));
+    const __m128 r = _mm_or_ps(_mm_and_ps(reduce, reduced), _mm_andnot_ps(reduce, t));
+    const __m128 z = _mm_mul_ps(r, r);
+    __m128 p = _mm_set1_ps(8.05374449538e-2f);
+    p = _mm_sub_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.38776856032e-1f));
+    p = _mm_add_ps(_mm_mul_ps(p, z), _mm_set1_ps(1.99777106478e-1f));
+    p = _mm_sub_ps(_mm_mul_ps(p, z), _mm_set1_ps(3.33329491539e-1f));
+    p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, z), r), r);
+    __m128 a = _mm_add_ps(p, _mm_and_ps(reduce, _mm_set1_ps(0.785398163397448f)));
+    // atan(y / |x|) = pi/2 - atan(|x| / y)
+    const __m128 swapped = _mm_cmpgt_ps(y, ax);
+    a = _mm_or_ps(_mm_and_ps(swapped, _mm_sub_ps(_mm_set1_ps(1.570796326794897f), a)), _mm_andnot_ps(swapped, a));
+    // second quadrant
+    const __m128 negative = _mm_cmplt_ps(x, _mm_setzero_ps());
+    return _mm_or_ps(_mm_and_ps(negative, _mm_sub_ps(_mm_set1_ps(3.141592653589793f), a)), _mm_andnot_ps(negative, a));
+}
+
+inline __m128 dot3SSE(__m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz) {
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax, bx), _mm_mul_ps(ay, by)), _mm_mul_ps(az, bz));
+}
+
+inline size_t accumulateAngleWeightedNormalsSSE(const float* positions, const unsigned int* indices, size_t begin, size_t end, float* normals) {
+    const __m128 minSine2 = _mm_set1_ps(AngleWeightMinSine * AngleWeightMinSine);
+    size_t skipped = 0;
+    size_t t = begin;
+    for (; t + 4 <= end; t += 4) {
+        const unsigned int* tri = indices + 3 * t;
+        __m128 x[3], y[3], z[3];
+        for (int corner = 0; corner < 3; ++corner) {
+            __m128 r0 = _mm_loadu_ps(positions + 4 * tri[corner]);
+            __m128 r1 = _mm_loadu_ps(positions + 4 * tri[3 + corner]);
+            __m128 r2 = _mm_loadu_ps(positions + 4 * tri[6 + corner]);
+            __m128 r3 = _mm_loadu_ps(positions + 4 * tri[9 + corner]);
+            _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+            x[corner] = r0; y[corner] = r1; z[corner] = r2;
+        }
+        const __m128 e01x = _mm_sub_ps(x[1], x[0]), e01y = _mm_sub_ps(y[1], y[0]), e01z = _mm_sub_ps(z[1], z[0]);
+        const __m128 e02x = _mm_sub_ps(x[2], x[0]), e02y = _mm_sub_ps(y[2], y[0]), e02z = _mm_sub_ps(z[2], z[0]);
+        const __m128 e12x = _mm_sub_ps(x[2], x[1]), e12y = _mm_sub_ps(y[2], y[1]), e12z = _mm_sub_ps(z[2], z[1]);
+        const __m128 nx = _mm_sub_ps(_mm_mul_ps(e01y, e02z), _mm_mul_ps(e01z, e02y));
+        const __m128 ny = _mm_sub_ps(_mm_mul_ps(e01z, e02x), _mm_mul_ps(e01x, e02z));
+        const __m128 nz = _mm_sub_ps(_mm_mul_ps(e01x, e02y), _mm_mul_ps(e01y, e02x));
+        const __m128 nn = dot3SSE(nx, ny, nz, nx, ny, nz);
+        const __m128 l01 = dot3SSE(e01x, e01y, e01z, e01x, e01y, e01z);
+        const __m128 l02 = dot3SSE(e02x, e02y, e02z, e02x, e02y, e02z);
+        const __m128 l12 = dot3SSE(e12x, e12y, e12z, e12x, e12y, e12z);
+        const __m128 valid = _mm_and_ps(_mm_cmpgt_ps(nn, _mm_mul_ps(_mm_mul_ps(minSine2, l01), l02)),
+                                        _mm_and_ps(_mm_cmpgt_ps(nn, _mm_mul_ps(_mm_mul_ps(minSine2, l01), l12)),
+                                                   _mm_cmpgt_ps(nn, _mm_mul_ps(_mm_mul_ps(minSine2, l02), l12))));
+        const int validMask = _mm_movemask_ps(valid);
+        skipped += 4 - ((validMask & 1) + (validMask >> 1 & 1) + (validMask >> 2 & 1) + (validMask >> 3 & 1));
+        if (validMask == 0) continue;
+        const __m128 length = _mm_sqrt_ps(nn);
+        const __m128 dots[3] = {
+            dot3SSE(e01x, e01y, e01z, e02x, e02y, e02z),
+            _mm_xor_ps(dot3SSE(e01x, e01y, e01z, e12x, e12y, e12z), _mm_set1_ps(-0.f)),
+            dot3SSE(e02x, e02y, e02z, e12x, e12y, e12z),
+        };
+        __m128 contribution[3][4];
+        for (int corner = 0; corner < 3; ++corner) {
+            const __m128 weight = _mm_div_ps(atan2PositiveSSE(length, dots[corner]), length);
+            __m128 cx = _mm_mul_ps(nx, weight), cy = _mm_mul_ps(ny, weight), cz = _mm_mul_ps(nz, weight), cw = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(cx, cy, cz, cw);
+            contribution[corner][0] = cx; contribution[corner][1] = cy; contribution[corner][2] = cz; contribution[corner][3] = cw;
+        }
+        // skipped faces have NaN weights and are left out
+        for (int k = 0; k < 4; ++k) {
+            if (!(validMask >> k & 1)) continue;
+            for (int corner = 0; corner < 3; ++corner) {
+                float* target = normals + 4 * tri[3 * k + corner];
+                _mm_storeu_ps(target, _mm_add_ps(_mm_loadu_ps(target), contribution[corner][k]));
+            }
+        }
+    }
+    return skipped + accumulateAngleWeightedNormalsScalar(positions, indices, t, end, normals);
+}
+#endif
+
+// ================
+// === DISPATCH ===
+// ================
+
+// adds the unnormalized face normal of triangles [begin, end) to each of its three vertices.
+// positions and normals are in the padded layout.
+inline void accumulateFaceNormals(NormalKernel kernel, const float* positions, const unsigned int* indices, size_t begin, size_t end, float* normals) {
+#ifdef NORMALKERNELS_AVX2
+    if (kernel == NormalKernel::AVX2) return accumulateFaceNormalsAVX2(positions, indices, begin, end, normals);
+#endif
+#ifdef NORMALKERNELS_SSE
+    if (kernel != NormalKernel::SCALAR) return accumulateFaceNormalsSSE(positions, indices, begin, end, normals);
+#endif
+    accumulateFaceNormalsScalar(positions, indices, begin, end, normals);
+}
+
+// adds the angle weighted unit face normals of triangles [begin, end) to their vertices, positions and
+// normals are in the padded layout. AVX2 uses the SSE kernel. returns the number of skipped degenerate faces.
+inline size_t accumulateAngleWeightedNormals(NormalKernel kernel, const float* positions, const unsigned int* indices, size_t begin, size_t end, float* normals) {
+#ifdef NORMALKERNELS_SSE
+    if (kernel != NormalKernel::SCALAR) return accumulateAngleWeightedNormalsSSE(positions, indices, begin, end, normals);
+#endif
+    return accumulateAngleWeightedNormalsScalar(positions, indices, begin, end, normals);
+}
+
+// writes the face normals of triangles [begin, end) in the padded layout, one vector per triangle
+inline void computeFaceNormals(NormalKernel kernel, const float* positions, const unsigned int* indices, size_t begin, size_t end, float* faceNormals) {
+#ifdef NORMALKERNELS_AVX2
+    if (kernel == NormalKernel::AVX2) return computeFaceNormalsAVX2(positions, indices, begin, end, faceNormals);
+#endif
+#ifdef NORMALKERNELS_SSE
+    if (kernel != NormalKernel::SCALAR) return computeFaceNormalsSSE(positions, indices, begin, end, faceNormals);
+#endif
+    computeFaceNormalsScalar(positions, indices, begin, end, faceNormals);
+}
+
+// sums the face normals of the faces adjacent to vertices [begin, end). faces[offsets[v]] to faces[offsets[v + 1] - 1]
+// are the faces of vertex v in ascending order, so the sums equal those of accumulateFaceNormals.
+inline void gatherFaceNormals(NormalKernel kernel, const float* faceNormals, const unsigned int* offsets, const unsigned int* faces, size_t begin, size_t end, float* normals) {
+#ifdef NORMALKERNELS_SSE
+    if (kernel != NormalKernel::SCALAR) return gatherFaceNormalsSSE(faceNormals, offsets, faces, begin, end, normals);
+#endif
+    gatherFaceNormalsScalar(faceNormals, offsets, faces, begin, end, normals);
+}
+
+// normalizes padded vectors [begin, end) and writes them to the tightly packed xyz array
+inline void normalizeNormals(NormalKernel kernel, const float* normals, size_t begin, size_t end, float eps, float* xyz) {
+#ifdef NORMALKERNELS_AVX2
+    if (kernel == NormalKernel::AVX2) return normalizeAVX2(normals, begin, end, eps, xyz);
+#endif
+#ifdef NORMALKERNELS_SSE
+    if (kernel != NormalKernel::SCALAR) return normalizeSSE(normals, begin, end, eps, xyz);
+#endif
+    normalizeScalar(normals, begin, end, eps, xyz);
+}
+
+#endif //NORMALKERNELS_H
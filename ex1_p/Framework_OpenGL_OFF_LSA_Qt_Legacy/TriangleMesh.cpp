@@ -13,16 +13,43 @@
 #include <fstream>
 #include <cfloat>
 #include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TRIANGLEMESH_SSE2
+#endif
+
+#include <QFile>
 #include <QOpenGLContext>
 #include <QOpenGLFunctions_2_1>
 
 #include "TriangleMesh.h"
+#include "FastParse.h"
+
+NormalKernel TriangleMesh::normalKernel = bestNormalKernel();
+bool TriangleMesh::angleWeightedNormals = false;
+
+void TriangleMesh::setNormalKernel(NormalKernel kernel) {
+  normalKernel = normalKernelSupported(kernel) ? kernel : NormalKernel::SCALAR;
+}
 
 void TriangleMesh::calculateNormals() {
   normals.clear();
   normals.resize(vertices.size());
-  // TODO: calculate normals for each vertex
+  if (normalKernel != NormalKernel::SCALAR) {
+    // padded positions and sums, see NormalKernels.h. (v1 - v2) x (v1 - v3) below is bitwise equal
+    // to the kernels' (v2 - v1) x (v3 - v1), as negating both edges is exact.
+    vector<float> padded(8 * vertices.size(), 0.f);
+    float* paddedPositions = padded.data();
+    float* paddedNormals = padded.data() + 4 * vertices.size();
+    padVertices(reinterpret_cast<const float*>(vertices.data()), 0, vertices.size(), paddedPositions);
+    accumulateFaceNormals(normalKernel, paddedPositions, reinterpret_cast<const unsigned int*>(triangles.data()), 0, triangles.size(), paddedNormals);
+    normalizeNormals(normalKernel, paddedNormals, 0, normals.size(), EPS, reinterpret_cast<float*>(normals.data()));
+    return;
+  }
 
   for(auto& tri : triangles){
       //get vertices from each triangle
@@ -49,39 +76,19 @@ void TriangleMesh::calculateNormals() {
  * 4a) Answer: Because the magnitude of the cross product equals the area of a parallelogram with the vectors for sides.
  * which means. double area of the triangles.
  */
-void TriangleMesh::calculateNormals_1() {
+// calculateNormals_1 weights by the angle at each corner instead of the area, see TriangleMesh.h
+size_t TriangleMesh::calculateNormals_1() {
     normals.clear();
     normals.resize(vertices.size());
-    // TODO: calculate normals for each vertex
-
-    for(auto& tri : triangles){
-        //get vertices from each triangle
-        Vec3f vert1 = vertices[tri[0]];
-        Vec3f vert2 = vertices[tri[1]];
-        Vec3f vert3 = vertices[tri[2]];
-        //calculate edge vectors
-        Vec3f kVector12 = vert1 - vert2;
-        Vec3f kVector13 = vert1 - vert3;
-        //cross product->normal vector
-        Vec3f normal = cross(kVector12,kVector13);
-        //norm of 2 edge vectors
-        float module12 = sqrt(pow(kVector12.x(),2)+ pow(kVector12.y(),2)+pow(kVector12.z(),2));
-        float module13 = sqrt(pow(kVector13.x(),2)+ pow(kVector13.y(),2)+pow(kVector13.z(),2));
-
-        //acos scalar product of edge vector
-        float scalarProduct = kVector13.x()*kVector12.x()+kVector13.y()*kVector12.y()+kVector13.z()*kVector12.z();
-        //calculate the weight:
-        float weight = acos(scalarProduct/(module12*module13));
-        //normal vector in each vertex add up
-        normals[tri[0]] += normal * weight;
-        normals[tri[1]] += normal * weight;
-        normals[tri[2]] += normal * weight;
-    }
-
-    for (auto& normal : normals) {
-        //the normalize() function returns a boolean which can be used if you want to check for erroneous normals
-        normal.normalize();
-    }
+    // padded positions and sums, see NormalKernels.h
+    vector<float> padded(8 * vertices.size(), 0.f);
+    float* paddedPositions = padded.data();
+    float* paddedNormals = padded.data() + 4 * vertices.size();
+    padVertices(reinterpret_cast<const float*>(vertices.data()), 0, vertices.size(), paddedPositions);
+    const size_t skipped = accumulateAngleWeightedNormals(normalKernel, paddedPositions, reinterpret_cast<const unsigned int*>(triangles.data()), 0, triangles.size(), paddedNormals);
+    // vertices of only degenerate faces keep a zero normal
+    normalizeNormals(normalKernel, paddedNormals, 0, normals.size(), EPS, reinterpret_cast<float*>(normals.data()));
+    return skipped;
 }
 
 // ================
@@ -109,16 +116,170 @@ void TriangleMesh::flipNormals() {
 // === LOAD MESH ===
 // =================
 
-void TriangleMesh::loadLSA(const char* filename, float offset_x, float offset_y, float offset_z) {
+void TriangleMesh::loadLSA(const char* filename, float offset_x, float offset_y, float offset_z, unsigned int numThreads) {
+  if (!readLSA(filename, offset_x, offset_y, offset_z, numThreads, true)) return;
+  // calculate normals
+  if (angleWeightedNormals) calculateNormals_1();
+  else calculateNormals();
+}
+
+// LSA vertex from the angles alpha, beta, gamma (degrees) and the baseline, see readLSAStream
+static void convertLSAScalar(const float* alpha, const float* beta, const float* gamma, size_t count,
+                             float baseline, const Vec3f& offset, Vec3f* out) {
+  for (size_t i = 0; i < count; ++i) {
+    float x, y, z;
+    z = -1 * baseline / ( tan(alpha[i]*PI/180) + tan(beta[i]*PI/180) );
+    x = -1 * z * tan(beta[i]*PI/180);
+    y = sqrt(x * x + z * z) * tan(gamma[i]*PI/180);
+    out[i] = Vec3f(x + offset.x(), y + offset.y(), z + offset.z());
+  }
+}
+
+#ifdef TRIANGLEMESH_SSE2
+// tan of 4 angles in radians. single precision Cephes algorithm: reduction to [-pi/4, pi/4] with
+// an extended precision pi/4 and a polynomial approximation, cot for odd octants.
+static inline __m128 tan4(__m128 x) {
+  const __m128 signMask = _mm_set1_ps(-0.f);
+  const __m128 sign = _mm_and_ps(x, signMask);
+  x = _mm_andnot_ps(signMask, x);
+  // octant, rounded up to an even number
+  __m128i j = _mm_cvttps_epi32(_mm_mul_ps(x, _mm_set1_ps(1.27323954473516f)));
+  j = _mm_add_epi32(j, _mm_and_si128(j, _mm_set1_epi32(1)));
+  const __m128 y = _mm_cvtepi32_ps(j);
+  __m128 z = _mm_sub_ps(x, _mm_mul_ps(y, _mm_set1_ps(0.78515625f)));
+  z = _mm_sub_ps(z, _mm_mul_ps(y, _mm_set1_ps(2.4187564849853515625e-4f)));
+  z = _mm_sub_ps(z, _mm_mul_ps(y, _mm_set1_ps(3.77489497744594108e-8f)));
+  const __m128 zz = _mm_mul_ps(z, z);
+  __m128 p = _mm_set1_ps(9.38540185543e-3f);
+  p = _mm_add_ps(_mm_mul_ps(p, zz), _mm_set1_ps(3.11992232697e-3f));
+  p = _mm_add_ps(_mm_mul_ps(p, zz), _mm_set1_ps(2.44301354525e-2f));
+  p = _mm_add_ps(_mm_mul_ps(p, zz), _mm_set1_ps(5.34112807005e-2f));
+  p = _mm_add_ps(_mm_mul_ps(p, zz), _mm_set1_ps(1.33387994085e-1f));
+  p = _mm_add_ps(_mm_mul_ps(p, zz), _mm_set1_ps(3.33331568548e-1f));
+  p = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, zz), z), z);
+  // tan(x) = -1/tan(x - pi/2) in octants 2 and 6
+  const __m128 cotangent = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(j, _mm_set1_epi32(2)), _mm_set1_epi32(2)));
+  const __m128 inverse = _mm_div_ps(_mm_set1_ps(-1.f), p);
+  p = _mm_or_ps(_mm_and_ps(cotangent, inverse), _mm_andnot_ps(cotangent, p));
+  return _mm_xor_ps(p, sign);
+}
+
+// same as convertLSAScalar for 4 vertices at once
+static void convertLSASIMD(const float* alpha, const float* beta, const float* gamma, size_t count,
+                           float baseline, const Vec3f& offset, Vec3f* out) {
+  const __m128 toRadians = _mm_set1_ps(static_cast<float>(PI / 180));
+  const __m128 negBaseline = _mm_set1_ps(-baseline);
+  const __m128 offsetX = _mm_set1_ps(offset.x()), offsetY = _mm_set1_ps(offset.y()), offsetZ = _mm_set1_ps(offset.z());
+  size_t i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128 tanAlpha = tan4(_mm_mul_ps(_mm_loadu_ps(alpha + i), toRadians));
+    const __m128 tanBeta = tan4(_mm_mul_ps(_mm_loadu_ps(beta + i), toRadians));
+    const __m128 tanGamma = tan4(_mm_mul_ps(_mm_loadu_ps(gamma + i), toRadians));
+    const __m128 z = _mm_div_ps(negBaseline, _mm_add_ps(tanAlpha, tanBeta));
+    const __m128 x = _mm_sub_ps(_mm_setzero_ps(), _mm_mul_ps(z, tanBeta));
+    const __m128 y = _mm_mul_ps(_mm_sqrt_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(z, z))), tanGamma);
+    // SoA -> AoS
+    float xs[4], ys[4], zs[4];
+    _mm_storeu_ps(xs, _mm_add_ps(x, offsetX));
+    _mm_storeu_ps(ys, _mm_add_ps(y, offsetY));
+    _mm_storeu_ps(zs, _mm_add_ps(z, offsetZ));
+    for (int k = 0; k < 4; ++k) out[i + k] = Vec3f(xs[k], ys[k], zs[k]);
+  }
+  convertLSAScalar(alpha + i, beta + i, gamma + i, count - i, baseline, offset, out + i);
+}
+#endif
+
+bool TriangleMesh::readLSA(const char* filename, float offset_x, float offset_y, float offset_z, unsigned int numThreads, bool useSIMD) {
+  QFile file(filename);
+  if (!file.open(QFile::ReadOnly)) {
+    cout << "loadLSA: can not open " << filename << endl;
+    return false;
+  }
+  const qint64 fileSize = file.size();
+  uchar* mapped = fileSize > 0 ? file.map(0, fileSize) : nullptr;
+  if (!mapped) return false;
+  const char* p = reinterpret_cast<const char*>(mapped);
+  const char* end = p + fileSize;
+
+  char s[256];
+  p = parseWord(p, end, s, 256);
+  // first word: LSA
+  if (!p || !(s[0] == 'L' && s[1] == 'S' && s[2] == 'A')) p = nullptr;
+  // get number of vertices nv, faces nf, edges ne and baseline distance
+  unsigned int nv = 0, nf = 0, ne = 0;
+  float baseline = 0.f;
+  if (p) p = parseUInt(p, end, nv);
+  if (p) p = parseUInt(p, end, nf);
+  if (p) p = parseUInt(p, end, ne);
+  if (p) p = parseFloat(p, end, baseline);
+  if (!p || nv == 0 || nf == 0) {
+    file.unmap(mapped);
+    return false;
+  }
+
+  // read alpha, beta, gamma of all vertices into separate arrays for the batch conversion
+  vector<float> angles(3 * size_t(nv));
+  float* alpha = angles.data();
+  float* beta = alpha + nv;
+  float* gamma = beta + nv;
+  for (unsigned int i = 0; i < nv && p; ++i) {
+    p = parseFloat(p, end, alpha[i]);
+    if (p) p = parseFloat(p, end, beta[i]);
+    if (p) p = parseFloat(p, end, gamma[i]);
+  }
+
+  // read triangles
+  triangles.resize(nf);
+  for (unsigned int i = 0; i < nf && p; ++i) {
+    unsigned int numVerts, a, b, c;
+    p = parseUInt(p, end, numVerts); // ignored
+    if (p) p = parseUInt(p, end, a);
+    if (p) p = parseUInt(p, end, b);
+    if (p) p = parseUInt(p, end, c);
+    if (p && (a >= nv || b >= nv || c >= nv)) p = nullptr;
+    if (p) triangles[i] = Triangle(a, b, c);
+  }
+  file.unmap(mapped);
+  if (!p) {
+    cout << "loadLSA: " << filename << " is malformed" << endl;
+    triangles.clear();
+    return false;
+  }
+
+  // calculate vertex coordinates, every thread converts one contiguous range
+  vertices.resize(nv);
+  const Vec3f offset(offset_x, offset_y, offset_z);
+  auto convert = [&](size_t begin, size_t count) {
+#ifdef TRIANGLEMESH_SSE2
+    if (useSIMD) {
+      convertLSASIMD(alpha + begin, beta + begin, gamma + begin, count, baseline, offset, &vertices[begin]);
+      return;
+    }
+#endif
+    convertLSAScalar(alpha + begin, beta + begin, gamma + begin, count, baseline, offset, &vertices[begin]);
+  };
+  numThreads = std::max(1u, std::min(numThreads, nv / 1024 + 1));
+  vector<thread> threads;
+  const size_t chunk = (nv + numThreads - 1) / numThreads;
+  for (unsigned int t = 1; t < numThreads; ++t) {
+    const size_t begin = t * chunk;
+    if (begin < nv) threads.emplace_back(convert, begin, std::min<size_t>(chunk, nv - begin));
+  }
+  convert(0, std::min<size_t>(chunk, nv));
+  for (auto& t : threads) t.join();
+  return true;
+}
+
+bool TriangleMesh::readLSAStream(const char* filename, float offset_x, float offset_y, float offset_z) {
   std::ifstream in(filename);
   if (!in.is_open()) {
     cout << "loadLSA: can not open " << filename << endl;
-    return;
+    return false;
   }
   char s[256];
   in >> s;
   // first word: LSA
-  if (!(s[0] == 'L' && s[1] == 'S' && s[2] == 'A')) return;
+  if (!(s[0] == 'L' && s[1] == 'S' && s[2] == 'A')) return false;
   // get number of vertices nv, faces nf, edges ne and baseline distance
   int nv, nf, ne;
   float baseline;
@@ -126,7 +287,7 @@ void TriangleMesh::loadLSA(const char* filename, float offset_x, float offset_y,
   in >> nf;
   in >> ne;
   in >> baseline;
-  if (nv <= 0 || nf <= 0) return;
+  if (nv <= 0 || nf <= 0) return false;
 
   // read vertices
   vertices.resize(nv);
@@ -167,9 +328,90 @@ void TriangleMesh::loadLSA(const char* filename, float offset_x, float offset_y,
       tri[1] = b;
       tri[2] = c;
   }
-  // calculate normals
-  calculateNormals();
-  //calculateNormals_1();
+  return true;
+}
+
+void TriangleMesh::benchmarkLoadLSA(const char* filename, int runs) {
+  typedef std::chrono::steady_clock Clock;
+  const unsigned int numThreads = std::max(1u, thread::hardware_concurrency());
+  struct Variant { const char* name; unsigned int threads; bool simd; bool stream; };
+  const Variant variants[] = {
+    { "ifstream, scalar    ", 1, false, true },
+    { "mapped, scalar      ", 1, false, false },
+    { "mapped, SIMD        ", 1, true, false },
+    { "mapped, SIMD+threads", numThreads, true, false },
+  };
+  TriangleMesh reference;
+  if (!reference.readLSAStream(filename, 0, 0, 0)) return;
+  cout << filename << ": " << reference.vertices.size() << " vertices, " << numThreads << " threads" << endl;
+  for (const Variant& variant : variants) {
+    TriangleMesh mesh;
+    double seconds = 0.0;
+    for (int run = 0; run < runs; ++run) {
+      mesh.vertices.clear();
+      mesh.triangles.clear();
+      const auto begin = Clock::now();
+      if (variant.stream) mesh.readLSAStream(filename, 0, 0, 0);
+      else mesh.readLSA(filename, 0, 0, 0, variant.threads, variant.simd);
+      seconds += std::chrono::duration<double>(Clock::now() - begin).count();
+    }
+    // deviation from the double precision reference conversion
+    float maxError = 0.f;
+    for (size_t i = 0; i < mesh.vertices.size(); ++i) {
+      maxError = std::max(maxError, (mesh.vertices[i] - reference.vertices[i]).length() / std::max(1.f, reference.vertices[i].length()));
+    }
+    cout << "  " << variant.name << ": " << 1000.0 * seconds / runs << " ms, "
+         << reference.vertices.size() * runs / seconds / 1e6 << " M vertices/s, max. rel. error " << maxError << endl;
+  }
+}
+
+void TriangleMesh::benchmarkNormals(const char* filename, int runs) {
+  typedef std::chrono::steady_clock Clock;
+  TriangleMesh mesh;
+  const string name(filename);
+  if (name.size() >= 4 && name.compare(name.size() - 4, 4, ".off") == 0) mesh.loadOFF(filename);
+  else mesh.loadLSA(filename, 0, 0, 0);
+  if (mesh.vertices.empty()) return;
+  cout << filename << ": " << mesh.vertices.size() << " vertices, " << mesh.triangles.size() << " triangles" << endl;
+  const NormalKernel previous = normalKernel;
+  const NormalKernel simd = normalKernelSupported(NormalKernel::SSE) ? NormalKernel::SSE : NormalKernel::SCALAR;
+  size_t skipped = 0;
+  // times one variant and returns its normals
+  auto measure = [&](const char* label, bool angleWeighted, NormalKernel kernel) {
+    normalKernel = kernel;
+    double seconds = 0.0;
+    for (int run = 0; run < runs; ++run) {
+      const auto begin = Clock::now();
+      if (angleWeighted) skipped = mesh.calculateNormals_1();
+      else mesh.calculateNormals();
+      seconds += std::chrono::duration<double>(Clock::now() - begin).count();
+    }
+    cout << "  " << label << " (" << normalKernelName(kernel) << "): " << 1000.0 * seconds / runs << " ms" << endl;
+    return mesh.normals;
+  };
+  const Normals area = measure("area weighted ", false, NormalKernel::SCALAR);
+  measure("area weighted ", false, bestNormalKernel());
+  const Normals angle = measure("angle weighted", true, NormalKernel::SCALAR);
+  const Normals angleSIMD = measure("angle weighted", true, simd);
+  normalKernel = previous;
+
+  // angle between two normals in degrees
+  auto deviation = [](const Vec3f& a, const Vec3f& b) {
+    return float(atan2(cross(a, b).length(), a * b) * 180.0 / PI);
+  };
+  float maxSIMD = 0.f, maxArea = 0.f;
+  double sumArea = 0.0;
+  size_t nonUnit = 0;
+  for (size_t i = 0; i < area.size(); ++i) {
+    maxSIMD = std::max(maxSIMD, deviation(angle[i], angleSIMD[i]));
+    const float d = deviation(angle[i], area[i]);
+    maxArea = std::max(maxArea, d);
+    sumArea += d;
+    if (!(fabs(angleSIMD[i].length() - 1.f) < 1e-3f)) nonUnit++;
+  }
+  cout << "  angle weighted SIMD vs. scalar: max. " << maxSIMD << " deg" << endl;
+  cout << "  angle vs. area weighted:        mean " << sumArea / area.size() << " deg, max. " << maxArea << " deg" << endl;
+  cout << "  degenerate faces skipped: " << skipped << ", non-unit normals: " << nonUnit << endl;
 }
 
 void TriangleMesh::loadOFF(const char* filename) {
@@ -222,7 +464,8 @@ void TriangleMesh::loadOFF(const char* filename) {
   }
 
   // calculate normals
-  calculateNormals();
+  if (angleWeightedNormals) calculateNormals_1();
+  else calculateNormals();
 }
 
 // ==============
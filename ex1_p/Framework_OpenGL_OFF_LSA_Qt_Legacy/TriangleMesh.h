@@ -16,6 +16,7 @@
 #include <vector>
 
 #include "Vec3.h"
+#include "NormalKernels.h"
 
 #define PI 3.14159265
 
@@ -39,8 +40,22 @@ private:
   Triangles triangles;
 
   // private methods
+  // area weighted normals. uses normalKernel, all kernels give identical results.
   void calculateNormals();
-  void calculateNormals_1();
+  // angle weighted normals: each corner adds the unit face normal times its interior angle, computed with
+  // atan2 instead of acos (see NormalKernels.h). returns the number of skipped degenerate faces.
+  size_t calculateNormals_1();
+
+  // reads vertices and triangles of an LSA file without calculating normals.
+  // the file is memory mapped and tokenized in place, the angles are converted in batches (SIMD if
+  // useSIMD is set and supported), split on numThreads threads.
+  bool readLSA(const char* filename, float offset_x, float offset_y, float offset_z, unsigned int numThreads, bool useSIMD);
+  // reference implementation using ifstream and one scalar conversion per vertex, only used by benchmarkLoadLSA
+  bool readLSAStream(const char* filename, float offset_x, float offset_y, float offset_z);
+
+  static NormalKernel normalKernel;
+  // loaders use calculateNormals_1 instead of calculateNormals
+  static bool angleWeightedNormals;
 
 public:
 
@@ -56,6 +71,16 @@ public:
   // flip all normals
   void flipNormals();
 
+  // implementation used by calculateNormals. defaults to the fastest one supported by the CPU,
+  // unsupported kernels fall back to SCALAR.
+  static void setNormalKernel(NormalKernel kernel);
+  static NormalKernel getNormalKernel() { return normalKernel; }
+  // weight normals by the corner angles instead of the triangle areas when loading meshes
+  static void setAngleWeightedNormals(bool enabled) { angleWeightedNormals = enabled; }
+
+  // compares area and angle weighted normals (scalar and SIMD) in speed and result on an OFF or LSA file
+  static void benchmarkNormals(const char* filename, int runs = 20);
+
   void drawNormals();
 
   // =================
@@ -63,7 +88,11 @@ public:
   // =================
 
   // read from an LSA file. also calculates normals.
-  void loadLSA(const char* filename, float offset_x, float offset_y, float offset_z);
+  // numThreads > 1 converts the vertices on several threads, which only pays off for large files.
+  void loadLSA(const char* filename, float offset_x, float offset_y, float offset_z, unsigned int numThreads = 1);
+
+  // times the LSA reader variants and prints the throughput in vertices per second
+  static void benchmarkLoadLSA(const char* filename, int runs = 20);
 
   // read from an OFF file. also calculates normals.
   void loadOFF(const char* filename);
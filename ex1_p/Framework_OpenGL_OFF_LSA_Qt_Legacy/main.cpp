@@ -18,6 +18,17 @@
 
 int main(int argc, char *argv[])
 {
+    //Benchmark mode: uebung_01 --benchmark-lsa file1.lsa file2.lsa ...
+    if (argc > 2 && std::string(argv[1]) == "--benchmark-lsa") {
+        for (int i = 2; i < argc; ++i) TriangleMesh::benchmarkLoadLSA(argv[i]);
+        return 0;
+    }
+    //Benchmark mode: uebung_01 --benchmark-normals file1.off file2.lsa ...
+    if (argc > 2 && std::string(argv[1]) == "--benchmark-normals") {
+        for (int i = 2; i < argc; ++i) TriangleMesh::benchmarkNormals(argv[i]);
+        return 0;
+    }
+
     QGuiApplication a(argc, argv);
 
     //A surface format specifies several parameters about the OpenGL context we want to create
@@ -35,9 +35,25 @@
 // === PRIVATE FUNCTIONS ===
 // =========================
 
+NormalKernel TriangleMesh::normalKernel = bestNormalKernel();
+
+void TriangleMesh::setNormalKernel(NormalKernel kernel) {
+    normalKernel = normalKernelSupported(kernel) ? kernel : NormalKernel::SCALAR;
+}
+
 void TriangleMesh::calculateNormals() {
     normals.clear();
     normals.resize(vertices.size());
+    if (normalKernel != NormalKernel::SCALAR) {
+        // padded positions and sums, see NormalKernels.h
+        std::vector<float> padded(8 * vertices.size(), 0.f);
+        float* paddedPositions = padded.data();
+        float* paddedNormals = padded.data() + 4 * vertices.size();
+        padVertices(reinterpret_cast<const float*>(vertices.data()), 0, vertices.size(), paddedPositions);
+        accumulateFaceNormals(normalKernel, paddedPositions, reinterpret_cast<const unsigned int*>(triangles.data()), 0, triangles.size(), paddedNormals);
+        normalizeNormals(normalKernel, paddedNormals, 0, normals.size(), EPS, reinterpret_cast<float*>(normals.data()));
+        return;
+    }
     for (const auto& face : triangles) {
         const GLuint iX = face[0];
         const GLuint iY = face[1];
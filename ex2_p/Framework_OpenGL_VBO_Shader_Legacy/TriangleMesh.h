@@ -20,6 +20,7 @@
 #include <vector>
 
 #include "Vec3.h"
+#include "NormalKernels.h"
 
 #define M_PI 3.14159265358979f
 
@@ -59,8 +60,9 @@ private:
   // === PRIVATE FUNCTIONS ===
   // =========================
 
-  // calculate normals
+  // calculate normals, weighted by area. uses normalKernel, all kernels give identical results.
   void calculateNormals();
+  static NormalKernel normalKernel;
 
   // create VBOs for vertices, faces and normals
   void createAllVBOs();
@@ -102,6 +104,11 @@ public:
   // flip all normals
   void flipNormals();
 
+  // implementation used by calculateNormals. defaults to the fastest one supported by the CPU,
+  // unsupported kernels fall back to SCALAR.
+  static void setNormalKernel(NormalKernel kernel);
+  static NormalKernel getNormalKernel() { return normalKernel; }
+
   // translates vertices so that the bounding box center is at newBBmid
   void translateToCenter(const Vec3f& newBBmid);
 
@@ -0,0 +1,64 @@
+#include "AsyncMeshLoader.h"
+#include "ThreadPool.h"
+#include "TriangleMesh.h"
+
+AsyncMeshLoader::~AsyncMeshLoader() {
+    waitForLoads();
+}
+
+void AsyncMeshLoader::loadAsync(TriangleMesh& target, std::function<void(TriangleMesh&)> load) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        loading++;
+    }
+    TriangleMesh* targetPtr = &target;
+    ThreadPool::global().enqueue([this, targetPtr, load] {
+        std::unique_ptr<TriangleMesh> mesh(new TriangleMesh());
+        load(*mesh);
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.push_back(FinishedMesh{ targetPtr, std::move(mesh) });
+        loading--;
+        allLoaded.notify_all();
+    });
+}
+
+void AsyncMeshLoader::runAsync(std::function<void()> work, std::function<void()> upload) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        loading++;
+    }
+    ThreadPool::global().enqueue([this, work, upload] {
+        work();
+        std::lock_guard<std::mutex> lock(mutex);
+        finishedUploads.push_back(upload);
+        loading--;
+        allLoaded.notify_all();
+    });
+}
+
+unsigned int AsyncMeshLoader::uploadFinished() {
+    std::vector<FinishedMesh> ready;
+    std::vector<std::function<void()>> readyUploads;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (finished.empty() && finishedUploads.empty()) return 0;
+        ready.swap(finished);
+        readyUploads.swap(finishedUploads);
+    }
+    for (auto& entry : ready) {
+        entry.target->takeGeometry(std::move(*entry.mesh));
+        entry.target->uploadToGPU();
+    }
+    for (auto& upload : readyUploads) upload();
+    return static_cast<unsigned int>(ready.size() + readyUploads.size());
+}
+
+unsigned int AsyncMeshLoader::getNumPending() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return loading + finished.size() + finishedUploads.size();
+}
+
+void AsyncMeshLoader::waitForLoads() {
+    std::unique_lock<std::mutex> lock(mutex);
+    allLoaded.wait(lock, [this] { return loading == 0; });
+}
@@ -0,0 +1,56 @@
+#ifndef ASYNCMESHLOADER_H
+#define ASYNCMESHLOADER_H
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+class TriangleMesh;
+
+// Loads and post-processes meshes on the worker threads of ThreadPool::global(). A finished mesh is not
+// touched until uploadFinished() hands its data over to the target mesh and creates the VBOs, which has
+// to happen on the thread owning the OpenGL context (e.g. at the start of paintGL). Other data, like the
+// heights of CdlodTerrain, goes the same way with runAsync.
+class AsyncMeshLoader {
+    struct FinishedMesh {
+        TriangleMesh* target;
+        std::unique_ptr<TriangleMesh> mesh;
+    };
+
+    std::mutex mutex;
+    std::condition_variable allLoaded;
+    std::vector<FinishedMesh> finished;
+    // uploads of runAsync whose work is done
+    std::vector<std::function<void()>> finishedUploads;
+    unsigned int loading{0};
+
+public:
+    AsyncMeshLoader() = default;
+    // waits for all running loads
+    ~AsyncMeshLoader();
+    AsyncMeshLoader(const AsyncMeshLoader& other) = delete;
+    AsyncMeshLoader& operator= (const AsyncMeshLoader& other) = delete;
+
+    // runs load on a fresh mesh in the background. target must stay at the same address until the
+    // mesh has been uploaded, its draw settings (colors, textures, toggles) are kept.
+    // load must not create VBOs, e.g. mesh.loadOFF(filename, false).
+    void loadAsync(TriangleMesh& target, std::function<void(TriangleMesh&)> load);
+
+    // runs work in the background and upload in uploadFinished once work is done. work must not touch
+    // OpenGL, whatever it writes must not be read elsewhere until upload runs.
+    void runAsync(std::function<void()> work, std::function<void()> upload);
+
+    // moves finished meshes into their targets and uploads them, then runs the uploads of finished runAsync
+    // calls. returns the number of uploads. requires a current OpenGL context.
+    unsigned int uploadFinished();
+
+    // number of meshes (and runAsync calls) that are loading or waiting for their upload
+    unsigned int getNumPending();
+
+    // blocks until no mesh is loading anymore (they might still wait for their upload)
+    void waitForLoads();
+};
+
+#endif //ASYNCMESHLOADER_H
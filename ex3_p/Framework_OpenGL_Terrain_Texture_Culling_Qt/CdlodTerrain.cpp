@@ -0,0 +1,255 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <cstdint>
+
+#include <QOpenGLFunctions_3_3_Core>
+
+#include "CdlodTerrain.h"
+#include "ClipPlane.h"
+#include "RenderState.h"
+#include "ThreadPool.h"
+#include "shader.h"
+
+float CdlodTerrain::lodDistance = 3.0f;
+const float CdlodTerrain::MorphRegion = 0.3f;
+
+// texture unit of the heights, units 0 to 3 are used by the other shaders
+const GLenum HeightTextureUnit = 4;
+
+float CdlodTerrain::nodeSize(unsigned int level) const {
+    return settings.size * float(PatchResolution << level) / float(resolution - 1);
+}
+
+void CdlodTerrain::generate(const TriangleMesh::TerrainSettings& terrainSettings, const NoiseSettings& noise) {
+    settings = terrainSettings;
+    unsigned int quads = PatchResolution;
+    while (quads + 1 < settings.resolution) quads *= 2;
+    resolution = quads + 1;
+    const unsigned int n = resolution;
+
+    // same heights as TriangleMesh::generateTerrain
+    static const NoiseKernel kernel = bestNoiseKernel();
+    heights.resize(size_t(n) * n);
+    ThreadPool& pool = ThreadPool::global();
+    pool.parallelFor(n, [&](unsigned int j) {
+        float* row = &heights[size_t(j) * n];
+        fbmRow(kernel, noise, 0.0f, 1.0f / float(n - 1), float(j) / float(n - 1), n, row);
+        for (unsigned int i = 0; i < n; ++i) row[i] *= settings.heightScale;
+    });
+
+    const float origin = -0.5f * settings.size;
+    OcclusionCuller::buildHeightfieldOccluder(heights.data(), n, n, origin, origin, settings.size / float(quads), settings.occluderCells, occluder);
+
+    // bounding boxes of the leaves from the heights, of all other nodes from their children
+    const unsigned int levels = static_cast<unsigned int>(std::log2(quads / PatchResolution)) + 1;
+    nodes.assign(levels, std::vector<Node>());
+    for (unsigned int level = 0; level < levels; ++level) {
+        const unsigned int side = nodesPerSide(level);
+        const float size = nodeSize(level);
+        std::vector<Node>& levelNodes = nodes[level];
+        levelNodes.resize(size_t(side) * side);
+        pool.parallelFor(side, [&](unsigned int z) {
+            for (unsigned int x = 0; x < side; ++x) {
+                float low = FLT_MAX, high = -FLT_MAX;
+                if (level == 0) {
+                    for (unsigned int j = z * PatchResolution; j <= (z + 1) * PatchResolution; ++j) {
+                        const auto row = heights.begin() + size_t(j) * n;
+                        const auto range = std::minmax_element(row + x * PatchResolution, row + (x + 1) * PatchResolution + 1);
+                        low = std::min(low, *range.first);
+                        high = std::max(high, *range.second);
+                    }
+                } else {
+                    const std::vector<Node>& children = nodes[level - 1];
+                    for (unsigned int child = 0; child < 4; ++child) {
+                        const Node& node = children[size_t(2 * z + child / 2) * (2 * side) + 2 * x + child % 2];
+                        low = std::min(low, node.boundingBoxMin.y());
+                        high = std::max(high, node.boundingBoxMax.y());
+                    }
+                }
+                Node& node = levelNodes[size_t(z) * side + x];
+                node.boundingBoxMin = Vec3f(origin + x * size, low, origin + z * size);
+                node.boundingBoxMax = Vec3f(origin + (x + 1) * size, high, origin + (z + 1) * size);
+            }
+        });
+    }
+
+    // a node of level l may touch nodes of level l + 1 at distances up to lodRanges[l] + its diagonal. these have to
+    // be closer than the start of their morph, otherwise the two levels would not meet: the diagonal of every node
+    // has to fit into the unmorphed part of the next range, (1 - MorphRegion) * (lodRanges[l + 1] - lodRanges[l]).
+    lodRanges.assign(levels, 0.0f);
+    for (unsigned int level = 0; level < levels; ++level) {
+        float diagonal = 0.0f;
+        for (const Node& node : nodes[level]) diagonal = std::max(diagonal, (node.boundingBoxMax - node.boundingBoxMin).length());
+        lodRanges[level] = std::max(lodDistance * nodeSize(level), diagonal / (1.0f - MorphRegion));
+        if (level > 0) lodRanges[level] = std::max(lodRanges[level], 2.0f * lodRanges[level - 1]);
+    }
+}
+
+void CdlodTerrain::uploadToGPU() {
+    auto* context = QOpenGLContext::currentContext();
+    auto* f = context ? context->versionFunctions<QOpenGLFunctions_3_3_Core>() : nullptr;
+    if (!f || heights.empty()) return;
+    cleanupGPU();
+
+    // patch vertices row by row, indices quadrant by quadrant with the winding of TriangleMesh::generateTerrain
+    const unsigned int side = PatchResolution + 1, half = PatchResolution / 2;
+    std::vector<float> vertices;
+    vertices.reserve(2 * side * side);
+    for (unsigned int j = 0; j < side; ++j) {
+        for (unsigned int i = 0; i < side; ++i) {
+            vertices.push_back(float(i) / PatchResolution);
+            vertices.push_back(float(j) / PatchResolution);
+        }
+    }
+    std::vector<uint16_t> indices;
+    indices.reserve(6 * PatchResolution * PatchResolution);
+    for (unsigned int quadrant = 0; quadrant < 4; ++quadrant) {
+        const unsigned int i0 = (quadrant % 2) * half, j0 = (quadrant / 2) * half;
+        for (unsigned int j = j0; j < j0 + half; ++j) {
+            for (unsigned int i = i0; i < i0 + half; ++i) {
+                const uint16_t v00 = j * side + i, v10 = v00 + 1, v01 = v00 + side, v11 = v01 + 1;
+                indices.insert(indices.end(), { v00, v01, v10, v10, v01, v11 });
+            }
+        }
+    }
+    quadrantIndices = GLsizei(indices.size() / 4);
+
+    f->glGenVertexArrays(1, &VAO.val);
+    f->glBindVertexArray(VAO.val);
+    f->glGenBuffers(1, &VBOv.val);
+    f->glBindBuffer(GL_ARRAY_BUFFER, VBOv.val);
+    f->glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+    f->glVertexAttribPointer(POSITION_LOCATION, 2, GL_FLOAT, GL_FALSE, 0, nullptr);
+    f->glEnableVertexAttribArray(POSITION_LOCATION);
+    f->glGenBuffers(1, &VBOf.val);
+    f->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, VBOf.val);
+    f->glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(uint16_t), indices.data(), GL_STATIC_DRAW);
+    f->glBindVertexArray(0);
+    f->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    // one float texel per vertex, filtered linearly for the morphed vertices between the grid points
+    f->glGenTextures(1, &heightTexture.val);
+    f->glBindTexture(GL_TEXTURE_2D, heightTexture.val);
+    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    f->glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    f->glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    f->glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, resolution, resolution, 0, GL_RED, GL_FLOAT, heights.data());
+    f->glBindTexture(GL_TEXTURE_2D, 0);
+}
+
+void CdlodTerrain::cleanupGPU() {
+    auto* context = QOpenGLContext::currentContext();
+    auto* f = context ? context->versionFunctions<QOpenGLFunctions_3_3_Core>() : nullptr;
+    if (!f) return;
+    if (VAO.val != 0) f->glDeleteVertexArrays(1, &VAO.val);
+    if (VBOv.val != 0) f->glDeleteBuffers(1, &VBOv.val);
+    if (VBOf.val != 0) f->glDeleteBuffers(1, &VBOf.val);
+    if (heightTexture.val != 0) f->glDeleteTextures(1, &heightTexture.val);
+    VAO.val = 0;
+    VBOv.val = 0;
+    VBOf.val = 0;
+    heightTexture.val = 0;
+}
+
+void CdlodTerrain::setProgram(QOpenGLFunctions_3_3_Core* f, GLuint terrainProgram) {
+    program = terrainProgram;
+    heightTextureUniform = f->glGetUniformLocation(program, "heightTexture");
+    terrainOriginUniform = f->glGetUniformLocation(program, "terrainOrigin");
+    gridSpacingUniform = f->glGetUniformLocation(program, "gridSpacing");
+    heightScaleUniform = f->glGetUniformLocation(program, "heightScale");
+    nodeOffsetUniform = f->glGetUniformLocation(program, "nodeOffset");
+    nodeSizeUniform = f->glGetUniformLocation(program, "nodeSize");
+    patchResolutionUniform = f->glGetUniformLocation(program, "patchResolution");
+    morphRangeUniform = f->glGetUniformLocation(program, "morphRange");
+}
+
+void CdlodTerrain::morphRange(unsigned int level, float& start, float& end) const {
+    // the root has no coarser level to morph into
+    if (level + 1 == lodRanges.size()) {
+        start = end = FLT_MAX;
+        return;
+    }
+    const float previous = level > 0 ? lodRanges[level - 1] : 0.0f;
+    end = lodRanges[level];
+    start = end - MorphRegion * (end - previous);
+}
+
+// squared distance of p to the box, 0 inside
+static float squaredDistance(const Vec3f& boxMin, const Vec3f& boxMax, const Vec3f& p) {
+    float result = 0.0f;
+    for (unsigned int i = 0; i < 3; ++i) {
+        const float d = std::max(0.0f, std::max(boxMin[i] - p[i], p[i] - boxMax[i]));
+        result += d * d;
+    }
+    return result;
+}
+
+bool CdlodTerrain::selectNode(unsigned int level, unsigned int x, unsigned int z, const std::vector<ClipPlane>& planes, const Vec3f& camera) {
+    const Node& node = nodes[level][size_t(z) * nodesPerSide(level) + x];
+    const bool root = level + 1 == nodes.size();
+    if (!root && squaredDistance(node.boundingBoxMin, node.boundingBoxMax, camera) > lodRanges[level] * lodRanges[level]) return false;
+    // outside the frustum: handled, but nothing to draw
+    if (!TriangleMesh::boxIsVisible(planes, node.boundingBoxMin, node.boundingBoxMax)) return true;
+    // no part of the node is close enough for the finer level
+    if (level == 0 || squaredDistance(node.boundingBoxMin, node.boundingBoxMax, camera) > lodRanges[level - 1] * lodRanges[level - 1]) {
+        selection.push_back({ level, x, z, 15u });
+        return true;
+    }
+    // the children out of the finer range are drawn as quadrants of this node
+    unsigned int quadrants = 0;
+    for (unsigned int child = 0; child < 4; ++child) {
+        if (!selectNode(level - 1, 2 * x + child % 2, 2 * z + child / 2, planes, camera)) quadrants |= 1u << child;
+    }
+    if (quadrants != 0) selection.push_back({ level, x, z, quadrants });
+    return true;
+}
+
+unsigned int CdlodTerrain::draw(RenderState& state, const QVector3D& cameraPos) {
+    if (!isResident() || program == 0) return 0;
+    selection.clear();
+    const Vec3f camera(cameraPos.x(), cameraPos.y(), cameraPos.z());
+    selectNode(getNumLevels() - 1, 0, 0, state.getFrustumPlanes(), camera);
+
+    auto* f = state.getOpenGLFunctions();
+    f->glBindVertexArray(VAO.val);
+    f->glUniformMatrix4fv(state.getModelViewUniform(), 1, GL_FALSE, state.getCurrentModelViewMatrix().data());
+    f->glUniformMatrix3fv(state.getNormalMatrixUniform(), 1, GL_FALSE, state.calculateNormalMatrix().data());
+    f->glUniform3f(state.getCameraPositionUniform(), camera.x(), camera.y(), camera.z());
+    f->glUniform1ui(state.getUseTextureUniform(), GL_FALSE);
+    f->glActiveTexture(GL_TEXTURE0 + HeightTextureUnit);
+    f->glBindTexture(GL_TEXTURE_2D, heightTexture.val);
+    f->glUniform1i(heightTextureUniform, HeightTextureUnit);
+    f->glActiveTexture(GL_TEXTURE0);
+    f->glUniform2f(terrainOriginUniform, -0.5f * settings.size, -0.5f * settings.size);
+    f->glUniform1f(gridSpacingUniform, settings.size / float(resolution - 1));
+    f->glUniform1f(heightScaleUniform, settings.heightScale);
+    f->glUniform1f(patchResolutionUniform, float(PatchResolution));
+
+    unsigned int trianglesDrawn = 0;
+    for (const SelectedNode& selected : selection) {
+        const Node& node = nodes[selected.level][size_t(selected.z) * nodesPerSide(selected.level) + selected.x];
+        float start, end;
+        morphRange(selected.level, start, end);
+        f->glUniform2f(nodeOffsetUniform, node.boundingBoxMin.x(), node.boundingBoxMin.z());
+        f->glUniform1f(nodeSizeUniform, nodeSize(selected.level));
+        f->glUniform2f(morphRangeUniform, start, end);
+        // consecutive quadrants are consecutive in the index buffer and drawn together
+        for (unsigned int first = 0; first < 4;) {
+            if (!(selected.quadrants & (1u << first))) {
+                ++first;
+                continue;
+            }
+            unsigned int last = first;
+            while (last < 4 && (selected.quadrants & (1u << last))) ++last;
+            const GLsizei count = GLsizei(last - first) * quadrantIndices;
+            f->glDrawElements(GL_TRIANGLES, count, GL_UNSIGNED_SHORT, reinterpret_cast<const void*>(first * quadrantIndices * sizeof(uint16_t)));
+            trianglesDrawn += count / 3;
+            first = last;
+        }
+    }
+    f->glBindVertexArray(0);
+    return trianglesDrawn;
+}
@@ -0,0 +1,106 @@
+#ifndef CDLODTERRAIN_H
+#define CDLODTERRAIN_H
+
+#include <vector>
+
+#include <QVector3D>
+#include <QOpenGLFunctions_3_3_Core>
+
+#include "Vec3.h"
+#include "Utilities.h"
+#include "TriangleMesh.h"
+#include "NoiseKernels.h"
+
+class RenderState;
+class ClipPlane;
+
+// Continuous distance-dependent level of detail (Strugar, "Continuous Distance-Dependent Level of Detail for
+// Rendering Heightmaps") for the fBm terrain of TriangleMesh::generateTerrain.
+// The heights are kept in a float texture that Shader/terrain.vert samples. Every node of the quadtree is drawn
+// with the same patch of PatchResolution^2 quads scaled to the size of the node, so the GPU memory besides the
+// heights does not depend on the terrain size. Nodes are selected by their distance to the camera: level l is
+// used up to lodRanges[l], which doubles from level to level, so the number of drawn triangles stays roughly
+// constant. Over the last MorphRegion of its range every vertex of a level slides onto the grid of the next
+// coarser level, so neighbouring levels meet without cracks and the switch does not pop.
+class CdlodTerrain {
+public:
+    // quads per side of the shared patch. a leaf of the quadtree covers as many quads of the height grid.
+    static const unsigned int PatchResolution = 32;
+
+private:
+    struct Node {
+        Vec3f boundingBoxMin, boundingBoxMax;
+    };
+    // node of the current selection, drawn at its level. quadrants has a bit for every quarter of the node
+    // to draw (bit 0: low x, low z, bit 1: high x, low z, bit 2: low x, high z, bit 3: high x, high z),
+    // the other quarters are drawn by finer nodes or culled.
+    struct SelectedNode {
+        unsigned int level, x, z;
+        unsigned int quadrants;
+    };
+
+    TriangleMesh::TerrainSettings settings;
+    // vertices per side of the height grid, PatchResolution * 2^k + 1
+    unsigned int resolution{0};
+    std::vector<float> heights;
+    // coarse version of the heights for OcclusionCuller, see TriangleMesh::getOccluder
+    Occluder occluder;
+    // nodes[0] are the leaves, nodes.back() holds the root. level l has (resolution - 1) / (PatchResolution << l)
+    // nodes per side, numbered row by row.
+    std::vector<std::vector<Node>> nodes;
+    // distance from the camera up to which a level is used, see selectNode
+    std::vector<float> lodRanges;
+    std::vector<SelectedNode> selection;
+
+    // patch vertices (x, z in [0, 1]) and indices, the indices of each quadrant are consecutive
+    autoMoved<GLuint> VAO{}, VBOv{}, VBOf{};
+    autoMoved<GLuint> heightTexture{};
+    GLsizei quadrantIndices{0};
+    // uniforms of terrain.vert
+    GLuint program{0};
+    GLint heightTextureUniform{-1}, terrainOriginUniform{-1}, gridSpacingUniform{-1}, heightScaleUniform{-1},
+          nodeOffsetUniform{-1}, nodeSizeUniform{-1}, patchResolutionUniform{-1}, morphRangeUniform{-1};
+
+    // adds the node or the parts of it within the range of its level to the selection. returns false if
+    // the node is out of its range, the parent draws the quadrant then.
+    bool selectNode(unsigned int level, unsigned int x, unsigned int z, const std::vector<ClipPlane>& planes, const Vec3f& camera);
+    // distance at which the vertices of level start and end morphing into the next coarser level
+    void morphRange(unsigned int level, float& start, float& end) const;
+    unsigned int nodesPerSide(unsigned int level) const { return (resolution - 1) / (PatchResolution << level); }
+    float nodeSize(unsigned int level) const;
+
+public:
+    // multiple of the leaf size up to which the finest level is used
+    static float lodDistance;
+    // last part of every range over which the vertices morph into the next level
+    static const float MorphRegion;
+
+    CdlodTerrain() = default;
+    CdlodTerrain(const CdlodTerrain& other) = delete;
+    CdlodTerrain& operator= (const CdlodTerrain& other) = delete;
+
+    // fBm heights like TriangleMesh::generateTerrain(settings, noise), settings.resolution is rounded up to
+    // PatchResolution * 2^k + 1. the rows are filled in parallel, no OpenGL context is needed.
+    void generate(const TriangleMesh::TerrainSettings& settings, const NoiseSettings& noise);
+    // creates the patch buffers and the height texture. needs a current OpenGL context.
+    void uploadToGPU();
+    // deletes the buffers and the texture, needs a current OpenGL context
+    void cleanupGPU();
+    bool isResident() const { return VAO.val != 0; }
+    // program built from Shader/terrain.vert, looks up its uniforms. needs a current OpenGL context.
+    void setProgram(QOpenGLFunctions_3_3_Core* f, GLuint program);
+
+    unsigned int getNumLevels() const { return static_cast<unsigned int>(nodes.size()); }
+    // quads per side of the height grid
+    unsigned int getNumQuadsPerSide() const { return resolution > 0 ? resolution - 1 : 0; }
+    // below the terrain surface, built by generate from settings.occluderCells
+    const Occluder& getOccluder() const { return occluder; }
+    // nodes of the last draw
+    unsigned int getNumSelectedNodes() const { return static_cast<unsigned int>(selection.size()); }
+
+    // selects the nodes for the camera position (in object coordinates of the terrain) and draws them with the
+    // program set by setProgram, which has to be the current program of state. returns the number of triangles drawn.
+    unsigned int draw(RenderState& state, const QVector3D& cameraPos);
+};
+
+#endif //CDLODTERRAIN_H
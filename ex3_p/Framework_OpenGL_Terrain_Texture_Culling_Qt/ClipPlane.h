@@ -12,6 +12,8 @@
 #ifndef CLIPPLANE_H
 #define CLIPPLANE_H
 
+#include <cmath>
+
 #include "Vec3.h"
 
 using namespace std;
@@ -35,6 +37,17 @@ public:
     return planeNormal*p + planeDistance;
   }
 
+  const Vec3f& getNormal() const { return planeNormal; }
+  float getDistance() const { return planeDistance; }
+
+  // largest value of evaluatePoint over the axis aligned box with the given center and half extents, taken at the
+  // corner furthest along the normal (p-vertex). the box is completely on the negative side if this is negative.
+  float evaluateBox(const Vec3f& center, const Vec3f& extent) const {
+    const float distance = planeNormal[0] * center[0] + planeNormal[1] * center[1] + planeNormal[2] * center[2] + planeDistance;
+    const float radius = std::fabs(planeNormal[0]) * extent[0] + std::fabs(planeNormal[1]) * extent[1] + std::fabs(planeNormal[2]) * extent[2];
+    return distance + radius;
+  }
+
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,211 @@
+#ifndef CULLINGKERNELS_H
+#define CULLINGKERNELS_H
+
+// View frustum culling of many axis aligned boxes at once. The boxes are stored as structure of arrays of centers
+// and half extents, so the SIMD kernels test 4 (SSE) or 8 (AVX) boxes against one plane with a few instructions.
+// A box is outside a plane if the center is further behind it than the extent projected onto the normal
+// (n * c + d + |n| * e < 0), the same test as ClipPlane::evaluateBox. All kernels perform the same floating point
+// operations in the same order, so their results are identical.
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+#include "ClipPlane.h"
+#include "Vec3.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define CULLINGKERNELS_SSE
+#if defined(__GNUC__) || defined(__clang__)
+#define CULLINGKERNELS_AVX
+#define CULLINGKERNELS_TARGET_AVX __attribute__((target("avx")))
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define CULLINGKERNELS_AVX
+#define CULLINGKERNELS_TARGET_AVX
+#endif
+#endif
+
+enum class CullingKernel {
+    SCALAR,
+    SSE,
+    AVX,
+};
+
+inline const char* cullingKernelName(CullingKernel kernel) {
+    switch (kernel) {
+        case CullingKernel::SSE: return "SSE";
+        case CullingKernel::AVX: return "AVX";
+        default: return "scalar";
+    }
+}
+
+inline bool cullingKernelSupported(CullingKernel kernel) {
+    switch (kernel) {
+        case CullingKernel::SCALAR:
+            return true;
+        case CullingKernel::SSE:
+#ifdef CULLINGKERNELS_SSE
+            return true;
+#else
+            return false;
+#endif
+        case CullingKernel::AVX:
+#if defined(CULLINGKERNELS_AVX) && defined(_MSC_VER) && !defined(__clang__)
+            {
+                int info[4];
+                __cpuid(info, 1);
+                return (info[2] & (1 << 28)) != 0;
+            }
+#elif defined(CULLINGKERNELS_AVX)
+            return __builtin_cpu_supports("avx");
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+// fastest kernel the CPU supports
+inline CullingKernel bestCullingKernel() {
+    if (cullingKernelSupported(CullingKernel::AVX)) return CullingKernel::AVX;
+    if (cullingKernelSupported(CullingKernel::SSE)) return CullingKernel::SSE;
+    return CullingKernel::SCALAR;
+}
+
+// axis aligned boxes as centers and half extents, one array per coordinate
+struct BoxArray {
+    std::vector<float> centerX, centerY, centerZ;
+    std::vector<float> extentX, extentY, extentZ;
+
+    size_t size() const { return centerX.size(); }
+    void clear() {
+        for (std::vector<float>* values : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ }) values->clear();
+    }
+    void reserve(size_t count) {
+        for (std::vector<float>* values : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ }) values->reserve(count);
+    }
+    void push_back(const Vec3f& boxMin, const Vec3f& boxMax) {
+        centerX.push_back(0.5f * (boxMin[0] + boxMax[0]));
+        centerY.push_back(0.5f * (boxMin[1] + boxMax[1]));
+        centerZ.push_back(0.5f * (boxMin[2] + boxMax[2]));
+        extentX.push_back(0.5f * (boxMax[0] - boxMin[0]));
+        extentY.push_back(0.5f * (boxMax[1] - boxMin[1]));
+        extentZ.push_back(0.5f * (boxMax[2] - boxMin[2]));
+    }
+};
+
+// the coefficients the kernels need per plane: normal, absolute normal and distance
+struct CullingPlane {
+    float nx, ny, nz, ax, ay, az, d;
+};
+
+inline std::vector<CullingPlane> cullingPlanes(const std::vector<ClipPlane>& planes) {
+    std::vector<CullingPlane> result;
+    result.reserve(planes.size());
+    for (const ClipPlane& plane : planes) {
+        const Vec3f& n = plane.getNormal();
+        result.push_back({ n[0], n[1], n[2], std::fabs(n[0]), std::fabs(n[1]), std::fabs(n[2]), plane.getDistance() });
+    }
+    return result;
+}
+
+// ==============
+// === SCALAR ===
+// ==============
+
+inline size_t cullBoxesScalar(const std::vector<CullingPlane>& planes, const BoxArray& boxes, size_t begin, size_t end, uint8_t* visible) {
+    size_t count = 0;
+    for (size_t i = begin; i < end; ++i) {
+        bool inside = true;
+        for (const CullingPlane& p : planes) {
+            const float distance = p.nx * boxes.centerX[i] + p.ny * boxes.centerY[i] + p.nz * boxes.centerZ[i] + p.d;
+            const float radius = p.ax * boxes.extentX[i] + p.ay * boxes.extentY[i] + p.az * boxes.extentZ[i];
+            if (distance + radius < 0.0f) {
+                inside = false;
+                break;
+            }
+        }
+        visible[i] = inside;
+        count += inside;
+    }
+    return count;
+}
+
+// ===========
+// === SSE ===
+// ===========
+
+#ifdef CULLINGKERNELS_SSE
+inline size_t cullBoxesSSE(const std::vector<CullingPlane>& planes, const BoxArray& boxes, size_t begin, size_t end, uint8_t* visible) {
+    size_t count = 0, i = begin;
+    for (; i + 4 <= end; i += 4) {
+        const __m128 cx = _mm_loadu_ps(&boxes.centerX[i]), cy = _mm_loadu_ps(&boxes.centerY[i]), cz = _mm_loadu_ps(&boxes.centerZ[i]);
+        const __m128 ex = _mm_loadu_ps(&boxes.extentX[i]), ey = _mm_loadu_ps(&boxes.extentY[i]), ez = _mm_loadu_ps(&boxes.extentZ[i]);
+        int outside = 0;
+        for (const CullingPlane& p : planes) {
+            const __m128 distance = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.nx), cx), _mm_mul_ps(_mm_set1_ps(p.ny), cy)),
+                                                          _mm_mul_ps(_mm_set1_ps(p.nz), cz)), _mm_set1_ps(p.d));
+            const __m128 radius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(p.ax), ex), _mm_mul_ps(_mm_set1_ps(p.ay), ey)),
+                                             _mm_mul_ps(_mm_set1_ps(p.az), ez));
+            outside |= _mm_movemask_ps(_mm_cmplt_ps(_mm_add_ps(distance, radius), _mm_setzero_ps()));
+            if (outside == 0xf) break;
+        }
+        for (int lane = 0; lane < 4; ++lane) {
+            visible[i + lane] = !((outside >> lane) & 1);
+            count += visible[i + lane];
+        }
+    }
+    return count + cullBoxesScalar(planes, boxes, i, end, visible);
+}
+#endif
+
+// ===========
+// === AVX ===
+// ===========
+
+#ifdef CULLINGKERNELS_AVX
+CULLINGKERNELS_TARGET_AVX
+inline size_t cullBoxesAVX(const std::vector<CullingPlane>& planes, const BoxArray& boxes, size_t begin, size_t end, uint8_t* visible) {
+    size_t count = 0, i = begin;
+    for (; i + 8 <= end; i += 8) {
+        const __m256 cx = _mm256_loadu_ps(&boxes.centerX[i]), cy = _mm256_loadu_ps(&boxes.centerY[i]), cz = _mm256_loadu_ps(&boxes.centerZ[i]);
+        const __m256 ex = _mm256_loadu_ps(&boxes.extentX[i]), ey = _mm256_loadu_ps(&boxes.extentY[i]), ez = _mm256_loadu_ps(&boxes.extentZ[i]);
+        int outside = 0;
+        for (const CullingPlane& p : planes) {
+            const __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.nx), cx), _mm256_mul_ps(_mm256_set1_ps(p.ny), cy)),
+                                                                _mm256_mul_ps(_mm256_set1_ps(p.nz), cz)), _mm256_set1_ps(p.d));
+            const __m256 radius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(p.ax), ex), _mm256_mul_ps(_mm256_set1_ps(p.ay), ey)),
+                                                _mm256_mul_ps(_mm256_set1_ps(p.az), ez));
+            outside |= _mm256_movemask_ps(_mm256_cmp_ps(_mm256_add_ps(distance, radius), _mm256_setzero_ps(), _CMP_LT_OQ));
+            if (outside == 0xff) break;
+        }
+        for (int lane = 0; lane < 8; ++lane) {
+            visible[i + lane] = !((outside >> lane) & 1);
+            count += visible[i + lane];
+        }
+    }
+    return count + cullBoxesScalar(planes, boxes, i, end, visible);
+}
+#endif
+
+// ================
+// === DISPATCH ===
+// ================
+
+// sets visible[i] to 1 if box i is not completely outside one of the planes, 0 otherwise. returns the number of
+// visible boxes.
+inline size_t cullBoxes(CullingKernel kernel, const std::vector<CullingPlane>& planes, const BoxArray& boxes, uint8_t* visible) {
+#ifdef CULLINGKERNELS_AVX
+    if (kernel == CullingKernel::AVX) return cullBoxesAVX(planes, boxes, 0, boxes.size(), visible);
+#endif
+#ifdef CULLINGKERNELS_SSE
+    if (kernel != CullingKernel::SCALAR) return cullBoxesSSE(planes, boxes, 0, boxes.size(), visible);
+#endif
+    return cullBoxesScalar(planes, boxes, 0, boxes.size(), visible);
+}
+
+#endif //CULLINGKERNELS_H
@@ -2,7 +2,9 @@
 // Created by danielr on 28.11.20.
 //
 
+#include <algorithm>
 #include <cmath>
+#include <fstream>
 
 #include <Qt>
 #include <QInputEvent>
@@ -26,6 +28,11 @@ void coutHelp()
     std::cout << "F: toggle FPS output" << std::endl << std::endl;
     std::cout << "W,A,S,D: first person movement" << std::endl;
     std::cout << "+,-: movement speed up and down" << std::endl;
+    std::cout << "PgUp,PgDn: LOD pixel error threshold up and down" << std::endl;
+    std::cout << "G: switch between CDLOD terrain, streamed endless terrain and chunked terrain mesh" << std::endl;
+    std::cout << "J,K: de-/increase the grid of airplanes" << std::endl;
+    std::cout << "O: toggle occlusion culling of the airplanes behind the terrain" << std::endl;
+    std::cout << "P: start/stop recording the camera path to camera_path.txt (replay with --benchmark-bvh)" << std::endl;
     std::cout << "1+:  Custom Shader" << std::endl;
     std::cout <<  std::endl;
     std::cout << "M: Switch Draw (M)ode. 0: Array, 1: VBO" << std::endl;
@@ -34,6 +41,7 @@ void coutHelp()
     std::cout << "T: toggle use of (T)extures" << std::endl;
     std::cout << "B: toggle (B)ounding Box" << std::endl;
     std::cout << "N: toggle (N)ormal Rendering" << std::endl;
+    std::cout << "V: benchmark separate vs. interleaved vs. quantized (V)ertex layout" << std::endl;
     std::cout << "==========================" << std::endl;
     std::cout << "BUMP MAPPING / DISPLACEMENT MAPPING" << std::endl;
     std::cout << "Z: toggle diffuse texture" << std::endl;
@@ -66,28 +74,36 @@ void MainWindow::initializeGL() {
     GLuint normalTexture = loadImageIntoTexture("../Textures/rough_block_wall_nor_1k.jpg", true);
     GLuint displacementTexture = loadImageIntoTexture("../Textures/rough_block_wall_disp_1k.jpg", true);
 
+    //Meshes are loaded in the background and uploaded at the start of paintGL once they are ready.
+    //All meshes have to exist before the loads start, because the loader keeps pointers to them.
+    meshes.resize(2);
+
     //Load the sphere of the light
-    sphereMesh.loadOFF("../Models/sphere.off");
     sphereMesh.setStaticColor(Vec3f(1.0f, 1.0f, 0.0f));
+    sphereMesh.setVertexLayout(TriangleMesh::VertexLayout::QUANTIZED);
+    meshLoader.loadAsync(sphereMesh, [](TriangleMesh& mesh) { mesh.loadOFF("../Models/sphere.off", false); });
 
     //load meshes
-    meshes.emplace_back();
-    meshes[0].loadOFF("../Models/doppeldecker.off");
     meshes[0].setStaticColor(Vec3f(0.0f, 1.0f, 0.0f));
     meshes[0].setTexture(testTexture);
     meshes[0].setColoringMode(TriangleMesh::ColoringType::TEXTURE);
+    meshes[0].setVertexLayout(TriangleMesh::VertexLayout::QUANTIZED);
+    meshLoader.loadAsync(meshes[0], [](TriangleMesh& mesh) { mesh.loadOFF("../Models/doppeldecker.off", false); });
 
-    meshes.emplace_back();
-    meshes[1].generateTerrain();
     meshes[1].setStaticColor(Vec3f(1.f, 1.f, 0.f));
     meshes[1].setColoringMode(TriangleMesh::ColoringType::COLOR_ARRAY);
+    meshes[1].setVertexLayout(TriangleMesh::VertexLayout::QUANTIZED);
+    //the terrain is drawn in chunks that are culled on their own, each small enough for 16 bit indices
+    meshLoader.loadAsync(meshes[1], [](TriangleMesh& mesh) { mesh.generateTerrain(false); });
 
-    bumpSphereMesh.generateSphere();
     bumpSphereMesh.setStaticColor(Vec3f(0.8f, 0.8f, 0.8f));
     bumpSphereMesh.setColoringMode(TriangleMesh::ColoringType::BUMP_MAPPING);
+    //stays unquantized, the displacement mapping offsets the positions in object coordinates
     bumpSphereMesh.setTexture(diffuseTexture);
     bumpSphereMesh.setNormalTexture(normalTexture);
     bumpSphereMesh.setDisplacementTexture(displacementTexture);
+    //the bump shader is expensive per fragment, so its triangles are also sorted against overdraw
+    meshLoader.loadAsync(bumpSphereMesh, [](TriangleMesh& mesh) { mesh.generateSphere(false); mesh.optimizeOverdraw(); });
 
     //load coordinate system
     csVAO = genCSVAO();
@@ -102,6 +118,14 @@ void MainWindow::initializeGL() {
 
     bumpProgramID = readShaders("../Shader/bump.vert", "../Shader/bump.frag");
 
+    //the CDLOD terrain uses the settings of the terrain mesh at a higher resolution, its heights are only a texture.
+    //they are generated in the background like the meshes, the terrain is drawn once its texture is uploaded.
+    TriangleMesh::TerrainSettings terrainSettings;
+    terrainSettings.resolution = 2049;
+    meshLoader.runAsync([this, terrainSettings] { terrain.generate(terrainSettings, NoiseSettings()); }, [this] { terrain.uploadToGPU(); });
+    terrainProgramID = readShaders("../Shader/terrain.vert", "../Shader/lambert.frag");
+    terrain.setProgram(f, terrainProgramID);
+
     std::cout << programIDs.size() << " shaders loaded. Use keys 1 to " << programIDs.size() << "." << std::endl;
 
     //print key bindings
@@ -109,11 +133,16 @@ void MainWindow::initializeGL() {
 }
 
 void MainWindow::paintGL() {
+    //upload meshes that finished loading since the last frame. their bounding boxes define the grid spacing.
+    if (meshLoader.uploadFinished() > 0) sceneMoved = true;
+    if (sceneChanged || sceneMoved) updateScene();
+
     f->glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     state.loadIdentityModelViewMatrix();
 
     //translate to center, rotate and render coordinate system and light sphere
     QVector3D cameraLookAt = cameraPos + cameraDir;
+    if (recordingCameraPath) cameraPath.emplace_back(cameraPos, cameraDir);
     static QVector3D upVector(0.0f, 1.0f, 0.0f);
     state.getCurrentModelViewMatrix().lookAt(cameraPos, cameraLookAt, upVector);
     drawSkybox();
@@ -132,12 +161,71 @@ void MainWindow::paintGL() {
     state.setCurrentProgram(currentProgramID);
     state.setLightUniform();
 
+    // cull the scene objects in world coordinates, the modelView matrix is the view matrix here
+    visibleObjects.clear();
+    sceneBvh.cull(state.getFrustumCullingPlanes(), visibleObjects);
+    cullFrames++;
+    cullNodesVisited += sceneBvh.getStats().nodesVisited;
+    cullBoxesTested += sceneBvh.getStats().boxesTested;
+    cullPlaneTests += sceneBvh.getStats().planeTests;
+    cullMicroseconds += sceneBvh.getStats().microseconds;
+
+    // the terrain that is drawn hides the objects behind it. rasterized and tested on the worker threads.
+    unsigned int objectsOccluded = 0;
+    if (useOcclusionCulling) {
+        const QMatrix4x4 identity;
+        occlusionCuller.beginFrame(state.getCurrentProjectionMatrix() * state.getCurrentModelViewMatrix());
+        if (terrainMode == TerrainMode::CDLOD) {
+            //the occluder is written by the background generation until the terrain is uploaded
+            if (terrain.isResident()) occlusionCuller.addOccluder(terrain.getOccluder(), identity);
+        } else if (terrainMode == TerrainMode::STREAMED) {
+            terrainStreamer.addOccluders(occlusionCuller);
+        } else {
+            occlusionCuller.addOccluder(meshes[1].getOccluder(), identity);
+        }
+        occlusionCuller.rasterize();
+        occlusionCuller.cull(visibleObjects, sceneBoxMin, sceneBoxMax);
+        objectsOccluded = occlusionCuller.getStats().objectsOccluded;
+        occlusionMicroseconds += occlusionCuller.getStats().rasterMicroseconds + occlusionCuller.getStats().testMicroseconds;
+    }
+
     // draw objects. count triangles and objects drawn.
-    unsigned int triangles, trianglesDrawn = 0, objectsDrawn = 0;
-    for (auto& mesh : meshes) {
-        triangles = mesh.draw(state);
+    unsigned int triangles, trianglesDrawn = 0, objectsDrawn = 0, trianglesSaved = 0;
+    for (unsigned int object : visibleObjects) {
+        SceneObject& sceneObject = sceneObjects[object];
+        TriangleMesh& mesh = *sceneObject.mesh;
+        //meshes[1] is the terrain mesh
+        if (terrainMode != TerrainMode::MESH && &mesh == &meshes[1]) continue;
+        state.pushModelViewMatrix();
+        state.getCurrentModelViewMatrix() *= sceneObject.model;
+        //the BVH has tested the bounding box already
+        triangles = mesh.draw(state, sceneObject.lod, false);
+        state.popModelViewMatrix();
+        if (triangles > 0) {
+            trianglesDrawn += triangles;
+            //a coarser level of detail or only the visible chunks were drawn
+            trianglesSaved += mesh.getNumTriangles() - triangles;
+            objectsDrawn++;
+        }
+    }
+    if (terrainMode == TerrainMode::CDLOD) {
+        state.setCurrentProgram(terrainProgramID);
+        state.setLightUniform();
+        triangles = terrain.draw(state, cameraPos);
+        if (triangles > 0) {
+            trianglesDrawn += triangles;
+            //compared to the full resolution grid
+            trianglesSaved += 2 * terrain.getNumQuadsPerSide() * terrain.getNumQuadsPerSide() - triangles;
+            objectsDrawn++;
+        }
+        state.setCurrentProgram(currentProgramID);
+    } else if (terrainMode == TerrainMode::STREAMED) {
+        //generation runs in the background, only finished tiles within the upload budget are uploaded here
+        terrainStreamer.update(cameraPos);
+        triangles = terrainStreamer.draw(state);
         if (triangles > 0) {
             trianglesDrawn += triangles;
+            trianglesSaved += terrainStreamer.getNumTriangles() - triangles;
             objectsDrawn++;
         }
     }
@@ -145,13 +233,51 @@ void MainWindow::paintGL() {
     if (objectsDrawn != objectsLastRun || trianglesDrawn != trianglesLastRun) {
         objectsLastRun = objectsDrawn;
         trianglesLastRun = trianglesDrawn;
-        std::cout << "renderScene: " << objectsDrawn << " objects and " << trianglesDrawn << " triangles." << std::endl;
+        std::cout << "renderScene: " << objectsDrawn << " objects and " << trianglesDrawn << " triangles ("
+                  << trianglesSaved << " saved by LOD and chunk culling, " << objectsOccluded << " objects occluded)." << std::endl;
     }
 
     frameCounter++;
     update();
 }
 
+void MainWindow::updateScene() {
+    if (sceneChanged) {
+        sceneObjects.clear();
+        QMatrix4x4 identity;
+        sceneObjects.push_back({ &meshes[1], identity, 0 });
+        for (int i = -gridSize; i <= gridSize; ++i) {
+            for (int j = -gridSize; j <= gridSize; ++j) sceneObjects.push_back({ &meshes[0], identity, 0 });
+        }
+    }
+    //the airplanes are placed 1.5 times their size apart, around the first one at the origin
+    const Vec3f planeSize = meshes[0].getBoundingBoxSize();
+    const float spacing = meshes[0].isResident() ? 1.5f * std::max(planeSize.x(), std::max(planeSize.y(), planeSize.z())) : 0.0f;
+    size_t object = 1;
+    for (int i = -gridSize; i <= gridSize; ++i) {
+        for (int j = -gridSize; j <= gridSize; ++j) {
+            QMatrix4x4& model = sceneObjects[object++].model;
+            model.setToIdentity();
+            model.translate(spacing * i, 0.0f, spacing * j);
+        }
+    }
+    sceneBoxMin.resize(sceneObjects.size());
+    sceneBoxMax.resize(sceneObjects.size());
+    for (size_t i = 0; i < sceneObjects.size(); ++i) {
+        TriangleMesh& mesh = *sceneObjects[i].mesh;
+        SceneBvh::transformBox(sceneObjects[i].model, mesh.getBoundingBoxMin(), mesh.getBoundingBoxMax(), sceneBoxMin[i], sceneBoxMax[i]);
+    }
+    //new objects need a new tree, moved ones only new boxes
+    if (sceneChanged) {
+        sceneBvh.build(sceneBoxMin, sceneBoxMax);
+        bvhBuilds++;
+    } else if (sceneBvh.refit(sceneBoxMin, sceneBoxMax)) {
+        bvhBuilds++;
+    }
+    sceneChanged = false;
+    sceneMoved = false;
+}
+
 void MainWindow::drawSkybox() {
     // TODO(3.2): Draw a skybox
     // prepare (no depth test)
@@ -212,11 +338,53 @@ void MainWindow::drawLight() {
     state.popModelViewMatrix();
 }
 
+void MainWindow::benchmarkVertexLayouts() {
+    //Draw every mesh many times with both vertex layouts and measure the GPU time with a timer query.
+    //Rasterization is discarded, so only the vertex stage (attribute fetch and vertex shader) is timed.
+    //Always the full resolution without culling, so every layout draws the same indices whatever the camera.
+    const int draws = 100;
+    makeCurrent();
+    GLuint query;
+    f->glGenQueries(1, &query);
+    f->glEnable(GL_RASTERIZER_DISCARD);
+    state.setCurrentProgram(currentProgramID);
+    state.loadIdentityModelViewMatrix();
+    std::vector<TriangleMesh*> benchmarkMeshes = { &sphereMesh, &bumpSphereMesh };
+    for (auto& mesh : meshes) benchmarkMeshes.push_back(&mesh);
+    std::cout << "vertex layout benchmark, " << draws << " draws per mesh:" << std::endl;
+    for (TriangleMesh* mesh : benchmarkMeshes) {
+        if (!mesh->isResident()) continue;
+        std::cout << "  " << mesh->getNumVertices() << " vertices, " << mesh->getNumTriangles() << " triangles" << std::endl;
+        const TriangleMesh::VertexLayout originalLayout = mesh->getVertexLayout();
+        for (auto layout : { TriangleMesh::VertexLayout::SEPARATE, TriangleMesh::VertexLayout::INTERLEAVED, TriangleMesh::VertexLayout::QUANTIZED }) {
+            mesh->setVertexLayout(layout);
+            //warm up
+            mesh->drawFullResolution(state);
+            f->glBeginQuery(GL_TIME_ELAPSED, query);
+            unsigned long long indices = 0;
+            for (int i = 0; i < draws; ++i) indices += 3ull * mesh->drawFullResolution(state);
+            f->glEndQuery(GL_TIME_ELAPSED);
+            GLuint64 nanoseconds = 0;
+            f->glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+            const double seconds = std::max(1e-9, nanoseconds * 1e-9);
+            const char* name = layout == TriangleMesh::VertexLayout::SEPARATE ? "separate:    "
+                             : layout == TriangleMesh::VertexLayout::INTERLEAVED ? "interleaved: " : "quantized:   ";
+            std::cout << "    " << name << 1000.0 * seconds / draws << " ms per draw, " << indices / seconds / 1e6 << " M indices/s, "
+                      << mesh->getVertexMemory() / 1024 << " KB vertex data" << std::endl;
+        }
+        mesh->setVertexLayout(originalLayout);
+    }
+    f->glDisable(GL_RASTERIZER_DISCARD);
+    f->glDeleteQueries(1, &query);
+    doneCurrent();
+}
+
 void MainWindow::resizeGL(int width, int height) {
     //Calculate new projection matrix
     const float aspectRatio = static_cast<float>(width) / static_cast<float>(height);
     state.loadIdentityProjectionMatrix();
     state.getCurrentProjectionMatrix().perspective(65.f, aspectRatio, 0.5f, 10000.f);
+    state.setViewportSize(width, height);
     //Get OpenGL context (Qt does not guarantee the context to be current in resizeGL function)
     makeCurrent();
 
@@ -225,6 +393,8 @@ void MainWindow::resizeGL(int width, int height) {
     f->glUniformMatrix4fv(state.getProjectionUniform(), 1, GL_FALSE, state.getCurrentProjectionMatrix().constData());
     state.setCurrentProgram(bumpProgramID);
     f->glUniformMatrix4fv(state.getProjectionUniform(), 1, GL_FALSE, state.getCurrentProjectionMatrix().constData());
+    state.setCurrentProgram(terrainProgramID);
+    f->glUniformMatrix4fv(state.getProjectionUniform(), 1, GL_FALSE, state.getCurrentProjectionMatrix().constData());
     for (GLuint progID : programIDs) {
         state.setCurrentProgram(progID);
         f->glUniformMatrix4fv(state.getProjectionUniform(), 1, GL_FALSE, state.getCurrentProjectionMatrix().constData());
@@ -260,6 +430,21 @@ void MainWindow::keyPressEvent(QKeyEvent *ev) {
         case Qt::Key_F:
             outputFPS = !outputFPS;
             break;
+        case Qt::Key_V:
+            benchmarkVertexLayouts();
+            break;
+        case Qt::Key_G:
+            if (terrainMode == TerrainMode::CDLOD) {
+                terrainMode = TerrainMode::STREAMED;
+                std::cout << "streamed terrain" << std::endl;
+            } else if (terrainMode == TerrainMode::STREAMED) {
+                terrainMode = TerrainMode::MESH;
+                std::cout << "chunked terrain mesh" << std::endl;
+            } else {
+                terrainMode = TerrainMode::CDLOD;
+                std::cout << "CDLOD terrain" << std::endl;
+            }
+            break;
         case Qt::Key_W:
             cameraPos += movementSpeed * cameraDir;
             break;
@@ -300,12 +485,50 @@ void MainWindow::keyPressEvent(QKeyEvent *ev) {
             ortho.normalize();
             cameraPos += movementSpeed * ortho;
             break;
+        case Qt::Key_K:
+            ++gridSize;
+            gridLength = 2 * gridSize + 1;
+            std::cout << "Drawing " << gridLength * gridLength << " airplanes." << std::endl;
+            sceneChanged = true;
+            break;
+        case Qt::Key_J:
+            if (gridSize > 0) --gridSize;
+            gridLength = 2 * gridSize + 1;
+            std::cout << "Drawing " << gridLength * gridLength << " airplanes." << std::endl;
+            sceneChanged = true;
+            break;
+        case Qt::Key_O:
+            useOcclusionCulling = !useOcclusionCulling;
+            std::cout << "Occlusion culling " << (useOcclusionCulling ? "on" : "off") << "." << std::endl;
+            break;
+        case Qt::Key_P:
+            recordingCameraPath = !recordingCameraPath;
+            if (recordingCameraPath) {
+                cameraPath.clear();
+                std::cout << "Recording the camera path." << std::endl;
+            } else {
+                std::ofstream file("camera_path.txt");
+                for (const auto& camera : cameraPath) {
+                    file << camera.first.x() << " " << camera.first.y() << " " << camera.first.z() << " "
+                         << camera.second.x() << " " << camera.second.y() << " " << camera.second.z() << "\n";
+                }
+                std::cout << "Saved " << cameraPath.size() << " frames to camera_path.txt." << std::endl;
+            }
+            break;
         case Qt::Key_Plus:
             movementSpeed *= 2.0f;
             break;
         case Qt::Key_Minus:
             movementSpeed /= 2.0f;
             break;
+        case Qt::Key_PageUp:
+            TriangleMesh::setLodPixelThreshold(2.0f * TriangleMesh::getLodPixelThreshold());
+            std::cout << "LOD pixel error threshold: " << TriangleMesh::getLodPixelThreshold() << std::endl;
+            break;
+        case Qt::Key_PageDown:
+            TriangleMesh::setLodPixelThreshold(0.5f * TriangleMesh::getLodPixelThreshold());
+            std::cout << "LOD pixel error threshold: " << TriangleMesh::getLodPixelThreshold() << std::endl;
+            break;
         case Qt::Key_1:
         case Qt::Key_2:
         case Qt::Key_3:
@@ -352,8 +575,35 @@ void MainWindow::timerEvent(QTimerEvent *ev) {
         update();
     } else if (outputFPS && ev->timerId() == fpsCounterTimer.timerId()) {
         //print current FPS
-        std::cout << "Current FPS: " << frameCounter << std::endl;
+        std::cout << "Current FPS: " << frameCounter;
+        if (cullFrames > 0) {
+            std::cout << " (BVH culling: " << sceneObjects.size() << " objects, SAH cost " << sceneBvh.cost() << ", " << bvhBuilds << " builds, "
+                      << cullNodesVisited / cullFrames << " of " << sceneBvh.getNumNodes() << " nodes visited, "
+                      << double(cullPlaneTests) / std::max(1ull, cullBoxesTested) << " plane tests per box, "
+                      << cullMicroseconds / cullFrames << " us per frame)";
+            if (useOcclusionCulling) std::cout << " (occlusion culling: " << occlusionMicroseconds / cullFrames << " us per frame)";
+        }
+        if (meshLoader.getNumPending() > 0) std::cout << " (" << meshLoader.getNumPending() << " meshes or terrains loading)";
+        if (terrainMode == TerrainMode::CDLOD && terrain.isResident()) {
+            std::cout << " (CDLOD: " << terrain.getNumQuadsPerSide() << "^2 quads, " << terrain.getNumLevels() << " levels, "
+                      << terrain.getNumSelectedNodes() << " nodes selected)";
+        }
+        if (terrainMode == TerrainMode::STREAMED) {
+            const TerrainStreamer::Stats& streamed = terrainStreamer.getStats();
+            std::cout << " (streaming: " << streamed.uploadedTiles << " tiles uploaded (" << streamed.uploadedBytes / 1024 << " KB), "
+                      << streamed.evictedTiles << " evicted, " << streamed.droppedTiles << " dropped, " << terrainStreamer.getNumResidentTiles()
+                      << " resident (" << terrainStreamer.getResidentMemory() / 1024 << " KB), " << terrainStreamer.getNumPending() << " pending)";
+        }
+        std::cout << std::endl;
         frameCounter = 0;
+        cullFrames = 0;
+        bvhBuilds = 0;
+        cullNodesVisited = 0;
+        cullBoxesTested = 0;
+        cullPlaneTests = 0;
+        cullMicroseconds = 0.0;
+        occlusionMicroseconds = 0.0;
+        terrainStreamer.resetStats();
     }
 }
 
@@ -373,15 +623,29 @@ void MainWindow::setDefaults() {
 
     outputFPS = true;
     gridSize = 3;
+    sceneChanged = true;
+    sceneMoved = false;
+    cullFrames = 0;
+    bvhBuilds = 0;
+    cullNodesVisited = 0;
+    cullBoxesTested = 0;
+    cullPlaneTests = 0;
+    cullMicroseconds = 0.0;
+    occlusionMicroseconds = 0.0;
+    useOcclusionCulling = true;
+    terrainMode = TerrainMode::CDLOD;
     // last run: 0 objects and 0 triangles
     objectsLastRun = 0;
     trianglesLastRun = 0;
 }
 
 MainWindow::~MainWindow() {
+    meshLoader.waitForLoads();
     makeCurrent();
     sphereMesh.clear();
     for (auto& mesh : meshes) mesh.clear();
+    terrain.cleanupGPU();
+    terrainStreamer.clear();
     // Clear coordinate system VBOs
     f->glDeleteBuffers(2, csVBOs);
     f->glDeleteVertexArrays(1, &csVAO);
@@ -13,6 +13,11 @@
 
 #include "Vec3.h"
 #include "TriangleMesh.h"
+#include "CdlodTerrain.h"
+#include "TerrainStreamer.h"
+#include "SceneBvh.h"
+#include "OcclusionCuller.h"
+#include "AsyncMeshLoader.h"
 #include "RenderState.h"
 
 class MainWindow : public QOpenGLWindow {
@@ -36,6 +41,37 @@ class MainWindow : public QOpenGLWindow {
     std::vector<TriangleMesh> meshes;
     TriangleMesh sphereMesh; // sun
     TriangleMesh bumpSphereMesh;
+    //terrain drawn in place of the chunked terrain mesh meshes[1]
+    enum class TerrainMode { MESH, CDLOD, STREAMED };
+    TerrainMode terrainMode;
+    CdlodTerrain terrain;
+    //endless terrain around the camera, only updated while it is drawn
+    TerrainStreamer terrainStreamer;
+    AsyncMeshLoader meshLoader;
+    //objects drawn with a model matrix: meshes[1] and a grid of (2 * gridSize + 1)^2 copies of meshes[0].
+    //culled hierarchically by sceneBvh over their bounding boxes in world coordinates.
+    struct SceneObject {
+        TriangleMesh* mesh;
+        QMatrix4x4 model;
+        //level of detail drawn last, the instances of a mesh choose their levels independently
+        unsigned int lod;
+    };
+    std::vector<SceneObject> sceneObjects;
+    std::vector<Vec3f> sceneBoxMin, sceneBoxMax;
+    std::vector<unsigned int> visibleObjects;
+    SceneBvh sceneBvh;
+    //hides the scene objects behind the terrain, rasterized on the CPU (O)
+    OcclusionCuller occlusionCuller;
+    bool useOcclusionCulling;
+    //the objects have to be created again (sceneChanged) or were moved (sceneMoved)
+    bool sceneChanged, sceneMoved;
+    //culling statistics summed up for the FPS output
+    unsigned int cullFrames, bvhBuilds;
+    unsigned long long cullNodesVisited, cullBoxesTested, cullPlaneTests;
+    double cullMicroseconds, occlusionMicroseconds;
+    //camera position and direction of every frame while recording (P), saved for SceneBvh::benchmark
+    std::vector<std::pair<QVector3D, QVector3D>> cameraPath;
+    bool recordingCameraPath{false};
 
     static GLuint csVAO, csVBOs[2];
     int gridSize;
@@ -51,6 +87,7 @@ class MainWindow : public QOpenGLWindow {
     GLuint currentProgramID;
     std::vector<GLuint> programIDs;
     GLuint bumpProgramID;
+    GLuint terrainProgramID;
 
     //RenderState with matrix stack
     RenderState state;
@@ -61,6 +98,10 @@ class MainWindow : public QOpenGLWindow {
     void drawCS();
     void drawLight();
     void setDefaults();
+    //creates the scene objects or updates their model matrices and the BVH
+    void updateScene();
+    //time drawing all meshes with separate and interleaved vertex layout
+    void benchmarkVertexLayouts();
 
 protected:
     void initializeGL() override;
@@ -0,0 +1,507 @@
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
+#include <numeric>
+
+#include "MeshOptimizer.h"
+
+namespace {
+
+// parameters of Forsyth's scoring function
+const unsigned int CacheSize = 32;
+const float CacheDecayPower = 1.5f;
+const float LastTriangleScore = 0.75f;
+const float ValenceBoostScale = 2.0f;
+const float ValenceBoostPower = 0.5f;
+const unsigned int MaxValence = 32;  // larger valences are scored on the fly
+const unsigned int NoTriangle = UINT_MAX;
+
+struct ScoreTables {
+    float cache[CacheSize];
+    float valence[MaxValence];
+
+    ScoreTables() {
+        for (unsigned int i = 0; i < CacheSize; ++i) {
+            // the vertices of the last triangle get a fixed score, so it does not matter in which order they were used
+            if (i < 3) cache[i] = LastTriangleScore;
+            else cache[i] = std::pow(1.0f - float(i - 3) / float(CacheSize - 3), CacheDecayPower);
+        }
+        valence[0] = 0.0f;
+        for (unsigned int i = 1; i < MaxValence; ++i) valence[i] = ValenceBoostScale * std::pow(float(i), -ValenceBoostPower);
+    }
+
+    float score(int cachePosition, unsigned int remainingTriangles) const {
+        // vertices without remaining triangles are never looked at again
+        if (remainingTriangles == 0) return -1.0f;
+        float result = cachePosition < 0 ? 0.0f : cache[cachePosition];
+        if (remainingTriangles < MaxValence) result += valence[remainingTriangles];
+        else result += ValenceBoostScale * std::pow(float(remainingTriangles), -ValenceBoostPower);
+        return result;
+    }
+};
+
+// FIFO cache update for one triangle, returns the number of misses. see analyzeVertexCache.
+unsigned int updateCache(const Vec3ui& t, unsigned int cacheSize, std::vector<unsigned int>& loadTime, unsigned int& time) {
+    unsigned int misses = 0;
+    for (unsigned int k = 0; k < 3; ++k) {
+        if (time - loadTime[t[k]] > cacheSize) {
+            loadTime[t[k]] = time++;
+            ++misses;
+        }
+    }
+    return misses;
+}
+
+const unsigned int OverdrawCacheSize = 16;
+
+// first triangles of the clusters: a triangle whose three vertices all miss usually starts a new patch of the mesh
+std::vector<size_t> hardClusterBoundaries(const std::vector<Vec3ui>& triangles, size_t vertexCount) {
+    std::vector<unsigned int> loadTime(vertexCount, 0);
+    unsigned int time = OverdrawCacheSize + 1;
+    std::vector<size_t> boundaries;
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        if (updateCache(triangles[i], OverdrawCacheSize, loadTime, time) == 3 || i == 0) boundaries.push_back(i);
+    }
+    return boundaries;
+}
+
+// splits every hard cluster into smaller ones as soon as their ACMR reaches threshold times the cluster ACMR
+std::vector<size_t> softClusterBoundaries(const std::vector<Vec3ui>& triangles, size_t vertexCount, const std::vector<size_t>& hard, float threshold) {
+    std::vector<unsigned int> loadTime(vertexCount, 0);
+    unsigned int time = 0;
+    std::vector<size_t> boundaries;
+    for (size_t c = 0; c < hard.size(); ++c) {
+        const size_t begin = hard[c];
+        const size_t end = c + 1 < hard.size() ? hard[c + 1] : triangles.size();
+        // a jump of the time by more than the cache size empties the cache
+        time += OverdrawCacheSize + 1;
+        unsigned int clusterMisses = 0;
+        for (size_t i = begin; i < end; ++i) clusterMisses += updateCache(triangles[i], OverdrawCacheSize, loadTime, time);
+        const float clusterThreshold = threshold * float(clusterMisses) / float(end - begin);
+
+        boundaries.push_back(begin);
+        time += OverdrawCacheSize + 1;
+        unsigned int misses = 0, faces = 0;
+        for (size_t i = begin; i < end; ++i) {
+            misses += updateCache(triangles[i], OverdrawCacheSize, loadTime, time);
+            ++faces;
+            if (float(misses) <= clusterThreshold * float(faces)) {
+                boundaries.push_back(i + 1);
+                time += OverdrawCacheSize + 1;
+                misses = 0;
+                faces = 0;
+            }
+        }
+        // the remainder after the last split is usually a few triangles with a bad ACMR, so it is merged
+        // into the cluster before it. this also removes a boundary at end.
+        if (boundaries.back() != begin) boundaries.pop_back();
+    }
+    return boundaries;
+}
+
+// sum of squared distances to a set of planes: symmetric 4x4 matrix, stored as its upper triangle
+struct Quadric {
+    double a2{0}, ab{0}, ac{0}, ad{0}, b2{0}, bc{0}, bd{0}, c2{0}, cd{0}, d2{0};
+
+    void addPlane(double a, double b, double c, double d) {
+        a2 += a * a; ab += a * b; ac += a * c; ad += a * d;
+        b2 += b * b; bc += b * c; bd += b * d;
+        c2 += c * c; cd += c * d;
+        d2 += d * d;
+    }
+
+    void add(const Quadric& q) {
+        a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+        b2 += q.b2; bc += q.bc; bd += q.bd;
+        c2 += q.c2; cd += q.cd;
+        d2 += q.d2;
+    }
+
+    double error(const Vec3f& p) const {
+        const double x = p[0], y = p[1], z = p[2];
+        const double e = a2 * x * x + 2 * ab * x * y + 2 * ac * x * z + 2 * ad * x
+                       + b2 * y * y + 2 * bc * y * z + 2 * bd * y
+                       + c2 * z * z + 2 * cd * z
+                       + d2;
+        return std::max(0.0, e);
+    }
+};
+
+// collapses with a larger normal change count as flipped
+const float MinCollapseNormalCosine = 0.25f;
+
+} // namespace
+
+VertexCacheStatistics analyzeVertexCache(const std::vector<Vec3ui>& triangles, size_t vertexCount, unsigned int cacheSize) {
+    VertexCacheStatistics statistics;
+    if (triangles.empty()) return statistics;
+    // a vertex is in the FIFO as long as less than cacheSize other vertices have been loaded since its own load
+    std::vector<unsigned int> loadTime(vertexCount, 0);
+    std::vector<char> used(vertexCount, 0);
+    unsigned int time = cacheSize + 1;
+    size_t misses = 0, usedVertices = 0;
+    for (const Vec3ui& t : triangles) {
+        for (unsigned int k = 0; k < 3; ++k) {
+            const unsigned int v = t[k];
+            if (time - loadTime[v] > cacheSize) {
+                loadTime[v] = time++;
+                ++misses;
+            }
+            if (!used[v]) {
+                used[v] = 1;
+                ++usedVertices;
+            }
+        }
+    }
+    statistics.acmr = float(misses) / float(triangles.size());
+    statistics.atvr = float(misses) / float(usedVertices);
+    return statistics;
+}
+
+void optimizeVertexCache(std::vector<Vec3ui>& triangles, size_t vertexCount) {
+    const size_t triangleCount = triangles.size();
+    if (triangleCount == 0) return;
+    static const ScoreTables tables;
+
+    // vertex -> triangle adjacency (CSR). the remaining triangles of v are the first remaining[v] entries of its list.
+    std::vector<unsigned int> offsets(vertexCount + 1, 0);
+    for (const Vec3ui& t : triangles) {
+        for (unsigned int k = 0; k < 3; ++k) ++offsets[t[k] + 1];
+    }
+    for (size_t v = 0; v < vertexCount; ++v) offsets[v + 1] += offsets[v];
+    std::vector<unsigned int> adjacency(offsets[vertexCount]);
+    std::vector<unsigned int> remaining(vertexCount, 0);
+    for (size_t i = 0; i < triangleCount; ++i) {
+        for (unsigned int k = 0; k < 3; ++k) {
+            const unsigned int v = triangles[i][k];
+            adjacency[offsets[v] + remaining[v]++] = static_cast<unsigned int>(i);
+        }
+    }
+
+    std::vector<int> cachePosition(vertexCount, -1);
+    std::vector<float> vertexScores(vertexCount);
+    for (size_t v = 0; v < vertexCount; ++v) vertexScores[v] = tables.score(-1, remaining[v]);
+    std::vector<float> triangleScores(triangleCount);
+    std::vector<char> emitted(triangleCount, 0);
+    unsigned int best = 0;
+    for (size_t i = 0; i < triangleCount; ++i) {
+        const Vec3ui& t = triangles[i];
+        triangleScores[i] = vertexScores[t[0]] + vertexScores[t[1]] + vertexScores[t[2]];
+        if (triangleScores[i] > triangleScores[best]) best = static_cast<unsigned int>(i);
+    }
+
+    std::vector<Vec3ui> result;
+    result.reserve(triangleCount);
+    std::vector<unsigned int> cache, newCache;
+    cache.reserve(CacheSize + 3);
+    newCache.reserve(CacheSize + 3);
+    size_t deadEndCursor = 0;
+    while (result.size() < triangleCount) {
+        if (best == NoTriangle) {
+            // no remaining triangle touches the cache, continue with the next one in input order
+            while (emitted[deadEndCursor]) ++deadEndCursor;
+            best = static_cast<unsigned int>(deadEndCursor);
+        }
+        const Vec3ui t = triangles[best];
+        emitted[best] = 1;
+        result.push_back(t);
+
+        for (unsigned int k = 0; k < 3; ++k) {
+            const unsigned int v = t[k];
+            unsigned int* list = &adjacency[offsets[v]];
+            for (unsigned int j = 0; j < remaining[v]; ++j) {
+                if (list[j] == best) {
+                    list[j] = list[--remaining[v]];
+                    break;
+                }
+            }
+        }
+
+        // LRU: the vertices of the emitted triangle move to the front
+        newCache.clear();
+        for (unsigned int k = 0; k < 3; ++k) {
+            if (std::find(newCache.begin(), newCache.end(), t[k]) == newCache.end()) newCache.push_back(t[k]);
+        }
+        for (unsigned int v : cache) {
+            if (v != t[0] && v != t[1] && v != t[2]) newCache.push_back(v);
+        }
+        for (size_t i = 0; i < newCache.size(); ++i) {
+            const unsigned int v = newCache[i];
+            cachePosition[v] = i < CacheSize ? static_cast<int>(i) : -1;
+            vertexScores[v] = tables.score(cachePosition[v], remaining[v]);
+        }
+        if (newCache.size() > CacheSize) newCache.resize(CacheSize);
+
+        // only triangles around the cached vertices changed their score
+        best = NoTriangle;
+        float bestScore = -1.0f;
+        for (unsigned int v : newCache) {
+            const unsigned int* list = &adjacency[offsets[v]];
+            for (unsigned int j = 0; j < remaining[v]; ++j) {
+                const unsigned int i = list[j];
+                const Vec3ui& candidate = triangles[i];
+                triangleScores[i] = vertexScores[candidate[0]] + vertexScores[candidate[1]] + vertexScores[candidate[2]];
+                if (triangleScores[i] > bestScore) {
+                    bestScore = triangleScores[i];
+                    best = i;
+                }
+            }
+        }
+        cache.swap(newCache);
+    }
+    triangles.swap(result);
+}
+
+std::vector<unsigned int> optimizeVertexFetch(std::vector<Vec3ui>& triangles, size_t vertexCount) {
+    std::vector<unsigned int> newIndex(vertexCount, UINT_MAX);
+    std::vector<unsigned int> order;
+    order.reserve(vertexCount);
+    for (Vec3ui& t : triangles) {
+        for (unsigned int k = 0; k < 3; ++k) {
+            const unsigned int v = t[k];
+            if (newIndex[v] == UINT_MAX) {
+                newIndex[v] = static_cast<unsigned int>(order.size());
+                order.push_back(v);
+            }
+            t[k] = newIndex[v];
+        }
+    }
+    for (size_t v = 0; v < vertexCount; ++v) {
+        if (newIndex[v] == UINT_MAX) order.push_back(static_cast<unsigned int>(v));
+    }
+    return order;
+}
+
+void optimizeOverdraw(std::vector<Vec3ui>& triangles, const std::vector<Vec3f>& vertices, float threshold) {
+    if (triangles.empty()) return;
+    const std::vector<size_t> hard = hardClusterBoundaries(triangles, vertices.size());
+    const std::vector<size_t> clusters = softClusterBoundaries(triangles, vertices.size(), hard, threshold);
+
+    Vec3f meshCentroid(0.0f, 0.0f, 0.0f);
+    for (const Vec3ui& t : triangles) meshCentroid += vertices[t[0]] + vertices[t[1]] + vertices[t[2]];
+    meshCentroid /= float(3 * triangles.size());
+
+    // occlusion potential of a cluster: distance of its centroid from the mesh centroid along the average cluster normal
+    std::vector<float> sortKeys(clusters.size());
+    for (size_t cluster = 0; cluster < clusters.size(); ++cluster) {
+        const size_t begin = clusters[cluster];
+        const size_t end = cluster + 1 < clusters.size() ? clusters[cluster + 1] : triangles.size();
+        Vec3f centroid(0.0f, 0.0f, 0.0f), normal(0.0f, 0.0f, 0.0f);
+        for (size_t i = begin; i < end; ++i) {
+            const Vec3f& a = vertices[triangles[i][0]];
+            const Vec3f& b = vertices[triangles[i][1]];
+            const Vec3f& c = vertices[triangles[i][2]];
+            centroid += a + b + c;
+            // area weighted
+            normal += cross(b - a, c - a);
+        }
+        centroid /= float(3 * (end - begin));
+        normal.normalize();
+        sortKeys[cluster] = (centroid - meshCentroid) * normal;
+    }
+
+    std::vector<size_t> order(clusters.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&sortKeys](size_t a, size_t b) { return sortKeys[a] > sortKeys[b]; });
+    std::vector<Vec3ui> result;
+    result.reserve(triangles.size());
+    for (size_t cluster : order) {
+        const size_t end = cluster + 1 < clusters.size() ? clusters[cluster + 1] : triangles.size();
+        result.insert(result.end(), triangles.begin() + clusters[cluster], triangles.begin() + end);
+    }
+    triangles.swap(result);
+}
+
+OverdrawStatistics analyzeOverdraw(const std::vector<Vec3ui>& triangles, const std::vector<Vec3f>& vertices, unsigned int resolution) {
+    OverdrawStatistics statistics;
+    if (triangles.empty() || resolution == 0) return statistics;
+    // fit the mesh into the unit cube, keeping its proportions
+    Vec3f low(FLT_MAX, FLT_MAX, FLT_MAX), high(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (const Vec3f& v : vertices) {
+        for (unsigned int k = 0; k < 3; ++k) {
+            low[k] = std::min(low[k], v[k]);
+            high[k] = std::max(high[k], v[k]);
+        }
+    }
+    const float extent = std::max(high[0] - low[0], std::max(high[1] - low[1], high[2] - low[2]));
+    const float scale = extent > 0.0f ? 1.0f / extent : 0.0f;
+
+    std::vector<float> depth(size_t(resolution) * resolution);
+    for (unsigned int view = 0; view < 6; ++view) {
+        // look along +axis or -axis, the other two coordinates are the pixel position
+        const unsigned int axis = view / 2;
+        const float direction = view % 2 ? -1.0f : 1.0f;
+        std::fill(depth.begin(), depth.end(), FLT_MAX);
+        for (const Vec3ui& t : triangles) {
+            float x[3], y[3], z[3];
+            for (unsigned int k = 0; k < 3; ++k) {
+                const Vec3f& v = vertices[t[k]];
+                x[k] = (v[(axis + 1) % 3] - low[(axis + 1) % 3]) * scale * resolution;
+                y[k] = (v[(axis + 2) % 3] - low[(axis + 2) % 3]) * scale * resolution;
+                z[k] = direction * (v[axis] - low[axis]) * scale;
+            }
+            float area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+            if (area == 0.0f) continue;
+            if (area < 0.0f) {
+                // back face, rasterized as well
+                std::swap(x[1], x[2]);
+                std::swap(y[1], y[2]);
+                std::swap(z[1], z[2]);
+                area = -area;
+            }
+            const int minX = std::max(0, int(std::floor(std::min(x[0], std::min(x[1], x[2])))));
+            const int maxX = std::min(int(resolution) - 1, int(std::ceil(std::max(x[0], std::max(x[1], x[2])))));
+            const int minY = std::max(0, int(std::floor(std::min(y[0], std::min(y[1], y[2])))));
+            const int maxY = std::min(int(resolution) - 1, int(std::ceil(std::max(y[0], std::max(y[1], y[2])))));
+            for (int py = minY; py <= maxY; ++py) {
+                const float cy = py + 0.5f;
+                for (int px = minX; px <= maxX; ++px) {
+                    const float cx = px + 0.5f;
+                    // barycentric weights of the pixel center, scaled by area
+                    const float w0 = (x[2] - x[1]) * (cy - y[1]) - (y[2] - y[1]) * (cx - x[1]);
+                    const float w1 = (x[0] - x[2]) * (cy - y[2]) - (y[0] - y[2]) * (cx - x[2]);
+                    const float w2 = (x[1] - x[0]) * (cy - y[0]) - (y[1] - y[0]) * (cx - x[0]);
+                    if (w0 < 0.0f || w1 < 0.0f || w2 < 0.0f) continue;
+                    const float d = (w0 * z[0] + w1 * z[1] + w2 * z[2]) / area;
+                    float& stored = depth[size_t(py) * resolution + px];
+                    if (d < stored) {
+                        stored = d;
+                        ++statistics.pixelsShaded;
+                    }
+                }
+            }
+        }
+        for (float d : depth) statistics.pixelsCovered += d != FLT_MAX;
+    }
+    statistics.overdraw = statistics.pixelsCovered ? float(statistics.pixelsShaded) / float(statistics.pixelsCovered) : 0.0f;
+    return statistics;
+}
+
+std::vector<SimplifiedLevel> simplifyMesh(const std::vector<Vec3ui>& triangles, const std::vector<Vec3f>& vertices,
+                                          const std::vector<size_t>& targetTriangleCounts) {
+    const size_t vertexCount = vertices.size();
+    std::vector<SimplifiedLevel> levels;
+    std::vector<Vec3ui> current = triangles;
+
+    // every vertex starts with the planes of its triangles
+    std::vector<Quadric> quadrics(vertexCount);
+    for (const Vec3ui& t : current) {
+        Vec3f normal = cross(vertices[t[1]] - vertices[t[0]], vertices[t[2]] - vertices[t[0]]);
+        if (!normal.normalize()) continue;
+        const float d = -(normal * vertices[t[0]]);
+        for (unsigned int k = 0; k < 3; ++k) quadrics[t[k]].addPlane(normal[0], normal[1], normal[2], d);
+    }
+
+    // vertices on an edge that is not shared by exactly two triangles are locked
+    std::vector<char> locked(vertexCount, 0);
+    {
+        std::vector<std::pair<unsigned int, unsigned int>> edges;
+        edges.reserve(3 * current.size());
+        for (const Vec3ui& t : current) {
+            for (unsigned int k = 0; k < 3; ++k) {
+                const unsigned int a = t[k], b = t[(k + 1) % 3];
+                edges.emplace_back(std::min(a, b), std::max(a, b));
+            }
+        }
+        std::sort(edges.begin(), edges.end());
+        for (size_t i = 0; i < edges.size();) {
+            size_t j = i;
+            while (j < edges.size() && edges[j] == edges[i]) ++j;
+            if (j - i != 2) locked[edges[i].first] = locked[edges[i].second] = 1;
+            i = j;
+        }
+    }
+
+    struct Collapse {
+        unsigned int from, to;
+        double cost;
+    };
+    std::vector<Collapse> collapses;
+    std::vector<unsigned int> offsets, adjacency, remap(vertexCount);
+    std::vector<char> touched(vertexCount);
+    double maxCost = 0.0;
+    bool stuck = false;
+    for (size_t target : targetTriangleCounts) {
+        // every pass collapses an independent set of the cheapest edges, then the triangles are rebuilt
+        while (current.size() > target && !stuck) {
+            offsets.assign(vertexCount + 1, 0);
+            for (const Vec3ui& t : current) {
+                for (unsigned int k = 0; k < 3; ++k) ++offsets[t[k] + 1];
+            }
+            for (size_t v = 0; v < vertexCount; ++v) offsets[v + 1] += offsets[v];
+            adjacency.resize(offsets[vertexCount]);
+            {
+                std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+                for (size_t i = 0; i < current.size(); ++i) {
+                    for (unsigned int k = 0; k < 3; ++k) adjacency[fill[current[i][k]]++] = static_cast<unsigned int>(i);
+                }
+            }
+
+            collapses.clear();
+            for (const Vec3ui& t : current) {
+                for (unsigned int k = 0; k < 3; ++k) {
+                    const unsigned int a = t[k], b = t[(k + 1) % 3];
+                    Quadric q = quadrics[a];
+                    q.add(quadrics[b]);
+                    if (!locked[a]) collapses.push_back({ a, b, q.error(vertices[b]) });
+                    if (!locked[b]) collapses.push_back({ b, a, q.error(vertices[a]) });
+                }
+            }
+            std::sort(collapses.begin(), collapses.end(), [](const Collapse& x, const Collapse& y) { return x.cost < y.cost; });
+
+            // moving from onto to must not turn any remaining triangle around from upside down
+            auto flips = [&](unsigned int from, unsigned int to) {
+                for (unsigned int j = offsets[from]; j < offsets[from + 1]; ++j) {
+                    const Vec3ui& t = current[adjacency[j]];
+                    if (t[0] == to || t[1] == to || t[2] == to) continue;
+                    Vec3f p[3] = { vertices[t[0]], vertices[t[1]], vertices[t[2]] };
+                    const Vec3f before = cross(p[1] - p[0], p[2] - p[0]);
+                    for (unsigned int k = 0; k < 3; ++k) if (t[k] == from) p[k] = vertices[to];
+                    const Vec3f after = cross(p[1] - p[0], p[2] - p[0]);
+                    if (before * after <= MinCollapseNormalCosine * before.length() * after.length()) return true;
+                }
+                return false;
+            };
+
+            const size_t excess = current.size() - target;
+            size_t removed = 0, collapsed = 0;
+            std::fill(touched.begin(), touched.end(), 0);
+            for (size_t v = 0; v < vertexCount; ++v) remap[v] = static_cast<unsigned int>(v);
+            for (const Collapse& c : collapses) {
+                if (touched[c.from] || touched[c.to] || flips(c.from, c.to)) continue;
+                remap[c.from] = c.to;
+                quadrics[c.to].add(quadrics[c.from]);
+                maxCost = std::max(maxCost, c.cost);
+                // the neighbourhood changed, so later collapses of this pass must not rely on it
+                for (unsigned int j = offsets[c.from]; j < offsets[c.from + 1]; ++j) {
+                    const Vec3ui& t = current[adjacency[j]];
+                    for (unsigned int k = 0; k < 3; ++k) touched[t[k]] = 1;
+                    removed += t[0] == c.to || t[1] == c.to || t[2] == c.to;
+                }
+                ++collapsed;
+                if (removed >= excess) break;
+            }
+            if (collapsed == 0) {
+                stuck = true;
+                break;
+            }
+
+            size_t kept = 0;
+            for (const Vec3ui& t : current) {
+                const Vec3ui collapsedTriangle(remap[t[0]], remap[t[1]], remap[t[2]]);
+                if (collapsedTriangle[0] == collapsedTriangle[1] || collapsedTriangle[1] == collapsedTriangle[2]
+                    || collapsedTriangle[2] == collapsedTriangle[0]) continue;
+                current[kept++] = collapsedTriangle;
+            }
+            current.resize(kept);
+        }
+        if (!levels.empty() && levels.back().triangles.size() == current.size()) break;
+        SimplifiedLevel level;
+        level.triangles = current;
+        level.error = static_cast<float>(std::sqrt(maxCost));
+        levels.push_back(std::move(level));
+        if (stuck) break;
+    }
+    return levels;
+}
@@ -0,0 +1,58 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include <vector>
+
+#include "Vec3.h"
+
+// Reordering of indexed triangle lists for the GPU. All functions work on plain index triangles
+// and leave the geometry alone, so any per vertex attribute can be remapped by the caller.
+
+struct VertexCacheStatistics {
+    float acmr{0.0f};  // average cache miss ratio: transformed vertices per triangle, 0.5 - 3
+    float atvr{0.0f};  // average transform to vertex ratio: transformed vertices per used vertex, >= 1
+};
+
+// simulates a FIFO post-transform cache with cacheSize entries
+VertexCacheStatistics analyzeVertexCache(const std::vector<Vec3ui>& triangles, size_t vertexCount, unsigned int cacheSize = 16);
+
+// reorders the triangles for post-transform cache reuse (Tom Forsyth, "Linear-Speed Vertex Cache
+// Optimisation"). greedy: always emits the triangle with the best score of its vertices, which prefers
+// vertices in the simulated LRU cache and vertices with few remaining triangles.
+void optimizeVertexCache(std::vector<Vec3ui>& triangles, size_t vertexCount);
+
+// renumbers the vertices in the order the triangles first use them, so the vertex fetch is sequential.
+// returns the old index of every new vertex, vertices used by no triangle are moved to the end.
+std::vector<unsigned int> optimizeVertexFetch(std::vector<Vec3ui>& triangles, size_t vertexCount);
+
+// reorders the triangles of a cache optimized mesh to reduce overdraw (the overdraw optimizer of meshoptimizer,
+// based on Sander et al., "Fast Triangle Reordering for Vertex Locality and Reduced Overdraw"). the triangles are
+// split into clusters wherever the cache would be cold, clusters are split further as long as their ACMR stays
+// within threshold times the ACMR of the whole cluster. the clusters are then sorted view-independently: the
+// further a cluster faces away from the mesh center, the more it can occlude and the earlier it is drawn.
+void optimizeOverdraw(std::vector<Vec3ui>& triangles, const std::vector<Vec3f>& vertices, float threshold = 1.05f);
+
+struct OverdrawStatistics {
+    size_t pixelsCovered{0};
+    size_t pixelsShaded{0};
+    float overdraw{0.0f};  // shaded / covered, >= 1
+};
+
+// CPU estimate of the overdraw: rasterizes the mesh with a depth test from the six axis directions into a
+// resolution^2 grid and counts every fragment that passes the depth test. no back-face culling, like the renderer.
+OverdrawStatistics analyzeOverdraw(const std::vector<Vec3ui>& triangles, const std::vector<Vec3f>& vertices, unsigned int resolution = 256);
+
+struct SimplifiedLevel {
+    std::vector<Vec3ui> triangles;
+    float error{0.0f};  // geometric error in object units: square root of the largest quadric error of a collapse so far
+};
+
+// quadric error metric edge collapse (Garland and Heckbert, "Surface Simplification Using Quadric Error Metrics")
+// restricted to collapsing a vertex onto one of its neighbours, so every level indexes the original vertex array.
+// returns one level per entry of the descending targetTriangleCounts, each level continues from the previous one.
+// boundary and non-manifold vertices never move, collapses that flip a triangle are skipped. the levels stop
+// early when no collapse is possible anymore.
+std::vector<SimplifiedLevel> simplifyMesh(const std::vector<Vec3ui>& triangles, const std::vector<Vec3f>& vertices,
+                                          const std::vector<size_t>& targetTriangleCounts);
+
+#endif //MESHOPTIMIZER_H
@@ -0,0 +1,313 @@
+#ifndef NOISEKERNELS_H
+#define NOISEKERNELS_H
+
+// Fractal Brownian motion over 2D Perlin gradient noise, evaluated along rows of samples.
+// The lattice gradients come from an integer hash instead of a permutation table, so the SIMD kernels need
+// no gathers. All kernels perform the same floating point operations in the same order as the scalar code,
+// so the results are bit-identical.
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <immintrin.h>
+#define NOISEKERNELS_SSE
+#if defined(__GNUC__) || defined(__clang__)
+#define NOISEKERNELS_AVX2
+#define NOISEKERNELS_TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER)
+#include <intrin.h>
+#define NOISEKERNELS_AVX2
+#define NOISEKERNELS_TARGET_AVX2
+#endif
+#endif
+
+enum class NoiseKernel {
+    SCALAR,
+    SSE,
+    AVX2,
+};
+
+inline const char* noiseKernelName(NoiseKernel kernel) {
+    switch (kernel) {
+        case NoiseKernel::SSE: return "SSE";
+        case NoiseKernel::AVX2: return "AVX2";
+        default: return "scalar";
+    }
+}
+
+inline bool noiseKernelSupported(NoiseKernel kernel) {
+    switch (kernel) {
+        case NoiseKernel::SCALAR:
+            return true;
+        case NoiseKernel::SSE:
+#ifdef NOISEKERNELS_SSE
+            return true;
+#else
+            return false;
+#endif
+        case NoiseKernel::AVX2:
+#if defined(NOISEKERNELS_AVX2) && defined(_MSC_VER) && !defined(__clang__)
+            {
+                int info[4];
+                __cpuidex(info, 7, 0);
+                return (info[1] & (1 << 5)) != 0;
+            }
+#elif defined(NOISEKERNELS_AVX2)
+            return __builtin_cpu_supports("avx2");
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+// fastest kernel the CPU supports
+inline NoiseKernel bestNoiseKernel() {
+    if (noiseKernelSupported(NoiseKernel::AVX2)) return NoiseKernel::AVX2;
+    if (noiseKernelSupported(NoiseKernel::SSE)) return NoiseKernel::SSE;
+    return NoiseKernel::SCALAR;
+}
+
+struct NoiseSettings {
+    unsigned int octaves{6};
+    float frequency{4.0f};   // lattice cells per unit of the first octave
+    float lacunarity{2.0f};  // frequency factor from one octave to the next
+    float gain{0.5f};        // amplitude factor from one octave to the next
+    unsigned int seed{1337}; // octave k uses seed + k
+};
+
+// the Perlin noise with the 8 gradients below stays within [-1.5, 1.5] with a standard deviation of about 0.5.
+// the fBm sum is scaled so that its standard deviation is about 0.15 and the heights hardly ever clip at 0 or 1.
+constexpr float NoiseContrast = 0.5f;
+
+// factor from the fBm sum to [-0.5, 0.5]
+inline float fbmScale(const NoiseSettings& settings) {
+    float amplitudeSum = 0.0f, amplitude = 1.0f;
+    for (unsigned int octave = 0; octave < settings.octaves; ++octave) {
+        amplitudeSum += amplitude;
+        amplitude *= settings.gain;
+    }
+    return amplitudeSum > 0.0f ? NoiseContrast / amplitudeSum : 0.0f;
+}
+
+// ==============
+// === SCALAR ===
+// ==============
+
+inline unsigned int noiseHashScalar(int x, int y, unsigned int seed) {
+    unsigned int h = seed ^ (static_cast<unsigned int>(x) * 0x27d4eb2du) ^ (static_cast<unsigned int>(y) * 0x165667b1u);
+    h ^= h >> 15;
+    h *= 0x2c1b3c6du;
+    h ^= h >> 12;
+    return h;
+}
+
+// dot product with one of 8 gradients (Gustavson): bit 2 swaps x and y, bits 0 and 1 flip the signs
+inline float noiseGradientScalar(unsigned int h, float x, float y) {
+    const float u = (h & 4) ? y : x;
+    const float v = (h & 4) ? x : y;
+    return ((h & 1) ? -u : u) + ((h & 2) ? -(2.0f * v) : 2.0f * v);
+}
+
+inline float noiseFadeScalar(float t) {
+    return t * t * t * (t * (t * 6.0f - 15.0f) + 10.0f);
+}
+
+inline float perlinScalar(float x, float y, unsigned int seed) {
+    const float fx = std::floor(x), fy = std::floor(y);
+    const int ix = static_cast<int>(fx), iy = static_cast<int>(fy);
+    x -= fx;
+    y -= fy;
+    const float n00 = noiseGradientScalar(noiseHashScalar(ix, iy, seed), x, y);
+    const float n10 = noiseGradientScalar(noiseHashScalar(ix + 1, iy, seed), x - 1.0f, y);
+    const float n01 = noiseGradientScalar(noiseHashScalar(ix, iy + 1, seed), x, y - 1.0f);
+    const float n11 = noiseGradientScalar(noiseHashScalar(ix + 1, iy + 1, seed), x - 1.0f, y - 1.0f);
+    const float u = noiseFadeScalar(x), v = noiseFadeScalar(y);
+    const float a = n00 + u * (n10 - n00);
+    const float b = n01 + u * (n11 - n01);
+    return a + v * (b - a);
+}
+
+inline void fbmRowScalar(const NoiseSettings& settings, float x0, float dx, float y, size_t begin, size_t end, float* out) {
+    const float scale = fbmScale(settings);
+    for (size_t i = begin; i < end; ++i) {
+        const float x = x0 + static_cast<float>(i) * dx;
+        float sum = 0.0f, frequency = settings.frequency, amplitude = 1.0f;
+        for (unsigned int octave = 0; octave < settings.octaves; ++octave) {
+            sum = sum + amplitude * perlinScalar(x * frequency, y * frequency, settings.seed + octave);
+            frequency *= settings.lacunarity;
+            amplitude *= settings.gain;
+        }
+        out[i] = std::min(std::max(0.5f + sum * scale, 0.0f), 1.0f);
+    }
+}
+
+// ===========
+// === SSE ===
+// ===========
+
+#ifdef NOISEKERNELS_SSE
+// SSE2 has no 32 bit multiplication, so the even and odd lanes are multiplied to 64 bit and merged
+inline __m128i noiseMulSSE(__m128i a, __m128i b) {
+    const __m128i even = _mm_mul_epu32(a, b);
+    const __m128i odd = _mm_mul_epu32(_mm_srli_epi64(a, 32), _mm_srli_epi64(b, 32));
+    return _mm_unpacklo_epi32(_mm_shuffle_epi32(even, _MM_SHUFFLE(0, 0, 2, 0)), _mm_shuffle_epi32(odd, _MM_SHUFFLE(0, 0, 2, 0)));
+}
+
+inline __m128i noiseHashSSE(__m128i x, __m128i y, __m128i seed) {
+    __m128i h = _mm_xor_si128(seed, _mm_xor_si128(noiseMulSSE(x, _mm_set1_epi32(0x27d4eb2d)), noiseMulSSE(y, _mm_set1_epi32(0x165667b1))));
+    h = _mm_xor_si128(h, _mm_srli_epi32(h, 15));
+    h = noiseMulSSE(h, _mm_set1_epi32(0x2c1b3c6d));
+    return _mm_xor_si128(h, _mm_srli_epi32(h, 12));
+}
+
+inline __m128 noiseGradientSSE(__m128i h, __m128 x, __m128 y) {
+    const __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(h, _mm_set1_epi32(4)), _mm_set1_epi32(4)));
+    const __m128 u = _mm_or_ps(_mm_and_ps(swap, y), _mm_andnot_ps(swap, x));
+    const __m128 v = _mm_or_ps(_mm_and_ps(swap, x), _mm_andnot_ps(swap, y));
+    // flipping the sign bit is an exact negation
+    const __m128 signU = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(1)), 31));
+    const __m128 signV = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(2)), 30));
+    return _mm_add_ps(_mm_xor_ps(u, signU), _mm_xor_ps(_mm_mul_ps(_mm_set1_ps(2.0f), v), signV));
+}
+
+inline __m128 noiseFadeSSE(__m128 t) {
+    const __m128 inner = _mm_add_ps(_mm_mul_ps(t, _mm_sub_ps(_mm_mul_ps(t, _mm_set1_ps(6.0f)), _mm_set1_ps(15.0f))), _mm_set1_ps(10.0f));
+    return _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(t, t), t), inner);
+}
+
+// SSE2 has no floor: truncate and correct the negative values
+inline __m128 noiseFloorSSE(__m128 x) {
+    const __m128 truncated = _mm_cvtepi32_ps(_mm_cvttps_epi32(x));
+    return _mm_sub_ps(truncated, _mm_and_ps(_mm_cmpgt_ps(truncated, x), _mm_set1_ps(1.0f)));
+}
+
+inline __m128 perlinSSE(__m128 x, __m128 y, __m128i seed) {
+    const __m128 fx = noiseFloorSSE(x), fy = noiseFloorSSE(y);
+    const __m128i ix = _mm_cvttps_epi32(fx), iy = _mm_cvttps_epi32(fy);
+    const __m128i ix1 = _mm_add_epi32(ix, _mm_set1_epi32(1)), iy1 = _mm_add_epi32(iy, _mm_set1_epi32(1));
+    x = _mm_sub_ps(x, fx);
+    y = _mm_sub_ps(y, fy);
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 x1 = _mm_sub_ps(x, one), y1 = _mm_sub_ps(y, one);
+    const __m128 n00 = noiseGradientSSE(noiseHashSSE(ix, iy, seed), x, y);
+    const __m128 n10 = noiseGradientSSE(noiseHashSSE(ix1, iy, seed), x1, y);
+    const __m128 n01 = noiseGradientSSE(noiseHashSSE(ix, iy1, seed), x, y1);
+    const __m128 n11 = noiseGradientSSE(noiseHashSSE(ix1, iy1, seed), x1, y1);
+    const __m128 u = noiseFadeSSE(x), v = noiseFadeSSE(y);
+    const __m128 a = _mm_add_ps(n00, _mm_mul_ps(u, _mm_sub_ps(n10, n00)));
+    const __m128 b = _mm_add_ps(n01, _mm_mul_ps(u, _mm_sub_ps(n11, n01)));
+    return _mm_add_ps(a, _mm_mul_ps(v, _mm_sub_ps(b, a)));
+}
+
+inline void fbmRowSSE(const NoiseSettings& settings, float x0, float dx, float y, size_t begin, size_t end, float* out) {
+    const __m128 scale = _mm_set1_ps(fbmScale(settings));
+    size_t i = begin;
+    for (; i + 4 <= end; i += 4) {
+        const __m128 index = _mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(static_cast<int>(i)), _mm_setr_epi32(0, 1, 2, 3)));
+        const __m128 x = _mm_add_ps(_mm_set1_ps(x0), _mm_mul_ps(index, _mm_set1_ps(dx)));
+        __m128 sum = _mm_setzero_ps();
+        float frequency = settings.frequency, amplitude = 1.0f;
+        for (unsigned int octave = 0; octave < settings.octaves; ++octave) {
+            const __m128 f = _mm_set1_ps(frequency);
+            const __m128 noise = perlinSSE(_mm_mul_ps(x, f), _mm_mul_ps(_mm_set1_ps(y), f), _mm_set1_epi32(static_cast<int>(settings.seed + octave)));
+            sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(amplitude), noise));
+            frequency *= settings.lacunarity;
+            amplitude *= settings.gain;
+        }
+        const __m128 height = _mm_add_ps(_mm_set1_ps(0.5f), _mm_mul_ps(sum, scale));
+        _mm_storeu_ps(out + i, _mm_min_ps(_mm_max_ps(height, _mm_setzero_ps()), _mm_set1_ps(1.0f)));
+    }
+    fbmRowScalar(settings, x0, dx, y, i, end, out);
+}
+#endif
+
+// ============
+// === AVX2 ===
+// ============
+
+#ifdef NOISEKERNELS_AVX2
+NOISEKERNELS_TARGET_AVX2
+inline __m256i noiseHashAVX2(__m256i x, __m256i y, __m256i seed) {
+    __m256i h = _mm256_xor_si256(seed, _mm256_xor_si256(_mm256_mullo_epi32(x, _mm256_set1_epi32(0x27d4eb2d)), _mm256_mullo_epi32(y, _mm256_set1_epi32(0x165667b1))));
+    h = _mm256_xor_si256(h, _mm256_srli_epi32(h, 15));
+    h = _mm256_mullo_epi32(h, _mm256_set1_epi32(0x2c1b3c6d));
+    return _mm256_xor_si256(h, _mm256_srli_epi32(h, 12));
+}
+
+NOISEKERNELS_TARGET_AVX2
+inline __m256 noiseGradientAVX2(__m256i h, __m256 x, __m256 y) {
+    const __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(h, _mm256_set1_epi32(4)), _mm256_set1_epi32(4)));
+    const __m256 u = _mm256_blendv_ps(x, y, swap);
+    const __m256 v = _mm256_blendv_ps(y, x, swap);
+    const __m256 signU = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(1)), 31));
+    const __m256 signV = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(h, _mm256_set1_epi32(2)), 30));
+    return _mm256_add_ps(_mm256_xor_ps(u, signU), _mm256_xor_ps(_mm256_mul_ps(_mm256_set1_ps(2.0f), v), signV));
+}
+
+NOISEKERNELS_TARGET_AVX2
+inline __m256 noiseFadeAVX2(__m256 t) {
+    const __m256 inner = _mm256_add_ps(_mm256_mul_ps(t, _mm256_sub_ps(_mm256_mul_ps(t, _mm256_set1_ps(6.0f)), _mm256_set1_ps(15.0f))), _mm256_set1_ps(10.0f));
+    return _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(t, t), t), inner);
+}
+
+NOISEKERNELS_TARGET_AVX2
+inline __m256 perlinAVX2(__m256 x, __m256 y, __m256i seed) {
+    const __m256 fx = _mm256_floor_ps(x), fy = _mm256_floor_ps(y);
+    const __m256i ix = _mm256_cvttps_epi32(fx), iy = _mm256_cvttps_epi32(fy);
+    const __m256i ix1 = _mm256_add_epi32(ix, _mm256_set1_epi32(1)), iy1 = _mm256_add_epi32(iy, _mm256_set1_epi32(1));
+    x = _mm256_sub_ps(x, fx);
+    y = _mm256_sub_ps(y, fy);
+    const __m256 one = _mm256_set1_ps(1.0f);
+    const __m256 x1 = _mm256_sub_ps(x, one), y1 = _mm256_sub_ps(y, one);
+    const __m256 n00 = noiseGradientAVX2(noiseHashAVX2(ix, iy, seed), x, y);
+    const __m256 n10 = noiseGradientAVX2(noiseHashAVX2(ix1, iy, seed), x1, y);
+    const __m256 n01 = noiseGradientAVX2(noiseHashAVX2(ix, iy1, seed), x, y1);
+    const __m256 n11 = noiseGradientAVX2(noiseHashAVX2(ix1, iy1, seed), x1, y1);
+    const __m256 u = noiseFadeAVX2(x), v = noiseFadeAVX2(y);
+    const __m256 a = _mm256_add_ps(n00, _mm256_mul_ps(u, _mm256_sub_ps(n10, n00)));
+    const __m256 b = _mm256_add_ps(n01, _mm256_mul_ps(u, _mm256_sub_ps(n11, n01)));
+    return _mm256_add_ps(a, _mm256_mul_ps(v, _mm256_sub_ps(b, a)));
+}
+
+NOISEKERNELS_TARGET_AVX2
+inline void fbmRowAVX2(const NoiseSettings& settings, float x0, float dx, float y, size_t begin, size_t end, float* out) {
+    const __m256 scale = _mm256_set1_ps(fbmScale(settings));
+    size_t i = begin;
+    for (; i + 8 <= end; i += 8) {
+        const __m256 index = _mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(static_cast<int>(i)), _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)));
+        const __m256 x = _mm256_add_ps(_mm256_set1_ps(x0), _mm256_mul_ps(index, _mm256_set1_ps(dx)));
+        __m256 sum = _mm256_setzero_ps();
+        float frequency = settings.frequency, amplitude = 1.0f;
+        for (unsigned int octave = 0; octave < settings.octaves; ++octave) {
+            const __m256 f = _mm256_set1_ps(frequency);
+            const __m256 noise = perlinAVX2(_mm256_mul_ps(x, f), _mm256_mul_ps(_mm256_set1_ps(y), f), _mm256_set1_epi32(static_cast<int>(settings.seed + octave)));
+            sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(amplitude), noise));
+            frequency *= settings.lacunarity;
+            amplitude *= settings.gain;
+        }
+        const __m256 height = _mm256_add_ps(_mm256_set1_ps(0.5f), _mm256_mul_ps(sum, scale));
+        _mm256_storeu_ps(out + i, _mm256_min_ps(_mm256_max_ps(height, _mm256_setzero_ps()), _mm256_set1_ps(1.0f)));
+    }
+    fbmRowScalar(settings, x0, dx, y, i, end, out);
+}
+#endif
+
+// ================
+// === DISPATCH ===
+// ================
+
+// writes the fBm heights in [0, 1] at (x0 + i * dx, y) to out[i] for i in [0, count)
+inline void fbmRow(NoiseKernel kernel, const NoiseSettings& settings, float x0, float dx, float y, size_t count, float* out) {
+#ifdef NOISEKERNELS_AVX2
+    if (kernel == NoiseKernel::AVX2) return fbmRowAVX2(settings, x0, dx, y, 0, count, out);
+#endif
+#ifdef NOISEKERNELS_SSE
+    if (kernel != NoiseKernel::SCALAR) return fbmRowSSE(settings, x0, dx, y, 0, count, out);
+#endif
+    fbmRowScalar(settings, x0, dx, y, 0, count, out);
+}
+
+#endif //NOISEKERNELS_H
@@ -0,0 +1,542 @@
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unordered_map>
+
+#include "OcclusionCuller.h"
+#include "ThreadPool.h"
+#include "TriangleMesh.h"
+
+namespace {
+
+typedef std::chrono::steady_clock Clock;
+
+double microsecondsSince(Clock::time_point begin) {
+    return std::chrono::duration<double, std::micro>(Clock::now() - begin).count();
+}
+
+// slope of the pixels crossed by the outline of the occluders, pushes them behind the far plane
+const float OutlineSlope = 2.0f;
+
+// size of a hi-Z level, rounded up so that the last texel also covers a trailing odd row or column. pixel p of
+// the depth buffer lies in texel p >> level.
+unsigned int levelSize(unsigned int size, size_t level) {
+    return ((size - 1) >> level) + 1;
+}
+
+}
+
+// ==============
+// === SCALAR ===
+// ==============
+
+// the kernels rasterize the rows [y0, y1] of a triangle from x0 to x1 (exclusive), both multiples of 8 within one
+// tile. pixel x, y is covered if all edge functions are >= 0 at its center, its depth is the minimum of all depths.
+// the triangle touches the pixel if all edge functions are >= -r, then its slope (or OutlineSlope if an outline
+// edge crosses the pixel, |e| <= border) raises the slope of the pixel. every kernel evaluates a * x + (b * y + c)
+// for the same pixels, so the results are identical.
+static void rasterizeRowsScalar(const OcclusionCuller::RasterTriangle& t, float* depth, float* slope, unsigned int stride, int x0, int x1, int y0, int y1) {
+    for (int y = y0; y <= y1; ++y) {
+        const float py = float(y) + 0.5f;
+        const float row0 = t.b[0] * py + t.c[0], row1 = t.b[1] * py + t.c[1], row2 = t.b[2] * py + t.c[2];
+        const float rowZ = t.zb * py + t.zc;
+        float* out = depth + size_t(y) * stride;
+        float* outSlope = slope + size_t(y) * stride;
+        for (int x = x0; x < x1; ++x) {
+            const float px = float(x) + 0.5f;
+            const float e0 = t.a[0] * px + row0, e1 = t.a[1] * px + row1, e2 = t.a[2] * px + row2;
+            const float z = t.za * px + rowZ;
+            if (e0 >= 0.0f && e1 >= 0.0f && e2 >= 0.0f && z < out[x]) out[x] = z;
+            if (e0 >= -t.r[0] && e1 >= -t.r[1] && e2 >= -t.r[2]) {
+                const bool outline = std::fabs(e0) <= t.border[0] || std::fabs(e1) <= t.border[1] || std::fabs(e2) <= t.border[2];
+                outSlope[x] = std::max(outSlope[x], outline ? OutlineSlope : t.slope);
+            }
+        }
+    }
+}
+
+// ===========
+// === SSE ===
+// ===========
+
+#ifdef CULLINGKERNELS_SSE
+static void rasterizeRowsSSE(const OcclusionCuller::RasterTriangle& t, float* depth, float* slope, unsigned int stride, int x0, int x1, int y0, int y1) {
+    const __m128 a0 = _mm_set1_ps(t.a[0]), a1 = _mm_set1_ps(t.a[1]), a2 = _mm_set1_ps(t.a[2]), za = _mm_set1_ps(t.za);
+    const __m128 b0 = _mm_set1_ps(t.b[0]), b1 = _mm_set1_ps(t.b[1]), b2 = _mm_set1_ps(t.b[2]), zb = _mm_set1_ps(t.zb);
+    const __m128 c0 = _mm_set1_ps(t.c[0]), c1 = _mm_set1_ps(t.c[1]), c2 = _mm_set1_ps(t.c[2]), zc = _mm_set1_ps(t.zc);
+    const __m128 r0 = _mm_set1_ps(-t.r[0]), r1 = _mm_set1_ps(-t.r[1]), r2 = _mm_set1_ps(-t.r[2]);
+    const __m128 border0 = _mm_set1_ps(t.border[0]), border1 = _mm_set1_ps(t.border[1]), border2 = _mm_set1_ps(t.border[2]);
+    const __m128 triangleSlope = _mm_set1_ps(t.slope), outlineSlope = _mm_set1_ps(OutlineSlope), sign = _mm_set1_ps(-0.0f);
+    const __m128 laneCenters = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f), zero = _mm_setzero_ps();
+    for (int y = y0; y <= y1; ++y) {
+        const __m128 py = _mm_set1_ps(float(y) + 0.5f);
+        const __m128 row0 = _mm_add_ps(_mm_mul_ps(b0, py), c0), row1 = _mm_add_ps(_mm_mul_ps(b1, py), c1);
+        const __m128 row2 = _mm_add_ps(_mm_mul_ps(b2, py), c2), rowZ = _mm_add_ps(_mm_mul_ps(zb, py), zc);
+        float* out = depth + size_t(y) * stride;
+        float* outSlope = slope + size_t(y) * stride;
+        for (int x = x0; x < x1; x += 4) {
+            const __m128 px = _mm_add_ps(_mm_set1_ps(float(x)), laneCenters);
+            const __m128 e0 = _mm_add_ps(_mm_mul_ps(a0, px), row0), e1 = _mm_add_ps(_mm_mul_ps(a1, px), row1);
+            const __m128 e2 = _mm_add_ps(_mm_mul_ps(a2, px), row2);
+            const __m128 z = _mm_add_ps(_mm_mul_ps(za, px), rowZ);
+            const __m128 old = _mm_loadu_ps(out + x);
+            const __m128 write = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)),
+                                            _mm_and_ps(_mm_cmpge_ps(e2, zero), _mm_cmplt_ps(z, old)));
+            _mm_storeu_ps(out + x, _mm_or_ps(_mm_and_ps(write, z), _mm_andnot_ps(write, old)));
+            const __m128 touch = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, r0), _mm_cmpge_ps(e1, r1)), _mm_cmpge_ps(e2, r2));
+            const __m128 outline = _mm_or_ps(_mm_or_ps(_mm_cmple_ps(_mm_andnot_ps(sign, e0), border0), _mm_cmple_ps(_mm_andnot_ps(sign, e1), border1)),
+                                             _mm_cmple_ps(_mm_andnot_ps(sign, e2), border2));
+            const __m128 candidate = _mm_or_ps(_mm_and_ps(outline, outlineSlope), _mm_andnot_ps(outline, triangleSlope));
+            _mm_storeu_ps(outSlope + x, _mm_max_ps(_mm_loadu_ps(outSlope + x), _mm_and_ps(touch, candidate)));
+        }
+    }
+}
+#endif
+
+// ===========
+// === AVX ===
+// ===========
+
+#ifdef CULLINGKERNELS_AVX
+CULLINGKERNELS_TARGET_AVX
+static void rasterizeRowsAVX(const OcclusionCuller::RasterTriangle& t, float* depth, float* slope, unsigned int stride, int x0, int x1, int y0, int y1) {
+    const __m256 a0 = _mm256_set1_ps(t.a[0]), a1 = _mm256_set1_ps(t.a[1]), a2 = _mm256_set1_ps(t.a[2]), za = _mm256_set1_ps(t.za);
+    const __m256 b0 = _mm256_set1_ps(t.b[0]), b1 = _mm256_set1_ps(t.b[1]), b2 = _mm256_set1_ps(t.b[2]), zb = _mm256_set1_ps(t.zb);
+    const __m256 c0 = _mm256_set1_ps(t.c[0]), c1 = _mm256_set1_ps(t.c[1]), c2 = _mm256_set1_ps(t.c[2]), zc = _mm256_set1_ps(t.zc);
+    const __m256 r0 = _mm256_set1_ps(-t.r[0]), r1 = _mm256_set1_ps(-t.r[1]), r2 = _mm256_set1_ps(-t.r[2]);
+    const __m256 border0 = _mm256_set1_ps(t.border[0]), border1 = _mm256_set1_ps(t.border[1]), border2 = _mm256_set1_ps(t.border[2]);
+    const __m256 triangleSlope = _mm256_set1_ps(t.slope), outlineSlope = _mm256_set1_ps(OutlineSlope), sign = _mm256_set1_ps(-0.0f);
+    const __m256 laneCenters = _mm256_setr_ps(0.5f, 1.5f, 2.5f, 3.5f, 4.5f, 5.5f, 6.5f, 7.5f), zero = _mm256_setzero_ps();
+    for (int y = y0; y <= y1; ++y) {
+        const __m256 py = _mm256_set1_ps(float(y) + 0.5f);
+        const __m256 row0 = _mm256_add_ps(_mm256_mul_ps(b0, py), c0), row1 = _mm256_add_ps(_mm256_mul_ps(b1, py), c1);
+        const __m256 row2 = _mm256_add_ps(_mm256_mul_ps(b2, py), c2), rowZ = _mm256_add_ps(_mm256_mul_ps(zb, py), zc);
+        float* out = depth + size_t(y) * stride;
+        float* outSlope = slope + size_t(y) * stride;
+        for (int x = x0; x < x1; x += 8) {
+            const __m256 px = _mm256_add_ps(_mm256_set1_ps(float(x)), laneCenters);
+            const __m256 e0 = _mm256_add_ps(_mm256_mul_ps(a0, px), row0), e1 = _mm256_add_ps(_mm256_mul_ps(a1, px), row1);
+            const __m256 e2 = _mm256_add_ps(_mm256_mul_ps(a2, px), row2);
+            const __m256 z = _mm256_add_ps(_mm256_mul_ps(za, px), rowZ);
+            const __m256 old = _mm256_loadu_ps(out + x);
+            const __m256 write = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, zero, _CMP_GE_OQ), _mm256_cmp_ps(e1, zero, _CMP_GE_OQ)),
+                                               _mm256_and_ps(_mm256_cmp_ps(e2, zero, _CMP_GE_OQ), _mm256_cmp_ps(z, old, _CMP_LT_OQ)));
+            _mm256_storeu_ps(out + x, _mm256_or_ps(_mm256_and_ps(write, z), _mm256_andnot_ps(write, old)));
+            const __m256 touch = _mm256_and_ps(_mm256_and_ps(_mm256_cmp_ps(e0, r0, _CMP_GE_OQ), _mm256_cmp_ps(e1, r1, _CMP_GE_OQ)),
+                                               _mm256_cmp_ps(e2, r2, _CMP_GE_OQ));
+            const __m256 outline = _mm256_or_ps(_mm256_or_ps(_mm256_cmp_ps(_mm256_andnot_ps(sign, e0), border0, _CMP_LE_OQ),
+                                                             _mm256_cmp_ps(_mm256_andnot_ps(sign, e1), border1, _CMP_LE_OQ)),
+                                                _mm256_cmp_ps(_mm256_andnot_ps(sign, e2), border2, _CMP_LE_OQ));
+            const __m256 candidate = _mm256_or_ps(_mm256_and_ps(outline, outlineSlope), _mm256_andnot_ps(outline, triangleSlope));
+            _mm256_storeu_ps(outSlope + x, _mm256_max_ps(_mm256_loadu_ps(outSlope + x), _mm256_and_ps(touch, candidate)));
+        }
+    }
+}
+#endif
+
+// ========================
+// === OCCLUSION CULLER ===
+// ========================
+
+OcclusionCuller::OcclusionCuller(unsigned int bufferWidth, unsigned int bufferHeight)
+    : width(std::max(1u, (bufferWidth + TileWidth - 1) / TileWidth) * TileWidth),
+      height(std::max(1u, (bufferHeight + TileHeight - 1) / TileHeight) * TileHeight),
+      tilesX(width / TileWidth), tilesY(height / TileHeight),
+      kernel(bestCullingKernel()),
+      bins(size_t(tilesX) * tilesY),
+      slopes(size_t(width) * height, 0.0f)
+{
+    // halve the resolution down to a single row or column
+    for (unsigned int level = 0;; ++level) {
+        hiZ.emplace_back(size_t(levelSize(width, level)) * levelSize(height, level), 1.0f);
+        if (levelSize(width, level) == 1 || levelSize(height, level) == 1) break;
+    }
+}
+
+void OcclusionCuller::setKernel(CullingKernel newKernel) {
+    kernel = cullingKernelSupported(newKernel) ? newKernel : CullingKernel::SCALAR;
+}
+
+void OcclusionCuller::beginFrame(const QMatrix4x4& matrix) {
+    viewProjection = matrix;
+    triangles.clear();
+    stats = Stats();
+}
+
+void OcclusionCuller::addOccluder(const Occluder& occluder, const QMatrix4x4& model) {
+    if (occluder.empty()) return;
+    const QMatrix4x4 m = viewProjection * model;
+    clipVertices.resize(4 * occluder.vertices.size());
+    for (size_t v = 0; v < occluder.vertices.size(); ++v) {
+        const Vec3f& p = occluder.vertices[v];
+        for (int row = 0; row < 4; ++row) clipVertices[4 * v + row] = m(row, 0) * p[0] + m(row, 1) * p[1] + m(row, 2) * p[2] + m(row, 3);
+    }
+    // screen coordinates of a clip space vertex in front of the near plane
+    auto project = [this](const float* clip, float* screen) {
+        const float invW = 1.0f / clip[3];
+        screen[0] = (clip[0] * invW * 0.5f + 0.5f) * width;
+        screen[1] = (clip[1] * invW * 0.5f + 0.5f) * height;
+        screen[2] = clip[2] * invW * 0.5f + 0.5f;
+    };
+    const size_t count = occluder.indices.size() / 3;
+    polygons.resize(count);
+    for (size_t i = 0; i < count; ++i) {
+        Polygon& polygon = polygons[i];
+        polygon.orientation = 0;
+        const float* v[3] = { &clipVertices[4 * occluder.indices[3 * i]], &clipVertices[4 * occluder.indices[3 * i + 1]], &clipVertices[4 * occluder.indices[3 * i + 2]] };
+        // completely outside one of the frustum planes except the near plane
+        bool outside = false;
+        for (int axis = 0; axis < 3 && !outside; ++axis) {
+            outside = (v[0][axis] > v[0][3] && v[1][axis] > v[1][3] && v[2][axis] > v[2][3]) ||
+                      (axis < 2 && v[0][axis] < -v[0][3] && v[1][axis] < -v[1][3] && v[2][axis] < -v[2][3]);
+        }
+        if (outside) continue;
+        // clip against the near plane z >= -w, which leaves a triangle or a quad
+        float clipped[4][4];
+        int corners = 0;
+        for (int k = 0; k < 3; ++k) {
+            const float* a = v[k];
+            const float* b = v[(k + 1) % 3];
+            const float da = a[2] + a[3], db = b[2] + b[3];
+            if (da >= 0.0f) {
+                polygon.edges[corners] = k;
+                std::copy(a, a + 4, clipped[corners++]);
+            }
+            if ((da >= 0.0f) != (db >= 0.0f)) {
+                const float t = da / (da - db);
+                for (int c = 0; c < 4; ++c) clipped[corners][c] = a[c] + t * (b[c] - a[c]);
+                // leaving the half space the polygon continues along the near plane
+                polygon.edges[corners++] = da >= 0.0f ? 3 : k;
+            }
+        }
+        if (corners < 3) continue;
+        bool behind = false;
+        for (int k = 0; k < corners; ++k) {
+            behind = behind || clipped[k][3] <= 0.0f;
+            project(clipped[k], polygon.screen[k]);
+        }
+        if (behind) continue;
+        const float* s = polygon.screen[0];
+        const float area = (polygon.screen[1][0] - s[0]) * (polygon.screen[2][1] - s[1]) - (polygon.screen[2][0] - s[0]) * (polygon.screen[1][1] - s[1]);
+        if (!(std::fabs(area) > 1e-8f) || !std::isfinite(area)) continue;
+        polygon.corners = corners;
+        polygon.orientation = area > 0.0f ? 1 : -1;
+    }
+    // an edge is part of the outline unless the triangle on the other side is drawn and faces the same way, i.e.
+    // continues the surface on the other side of the edge on screen. that covers the border of the occluder, the
+    // silhouettes and the edges of triangles that are not drawn.
+    const bool linked = occluder.neighbours.size() == occluder.indices.size();
+    for (size_t i = 0; i < count; ++i) {
+        const Polygon& polygon = polygons[i];
+        if (polygon.orientation == 0) continue;
+        unsigned int outline = 0;
+        for (int k = 0; k < polygon.corners; ++k) {
+            const int edge = polygon.edges[k];
+            const bool inside = edge < 3 && linked && occluder.neighbours[3 * i + edge] != Occluder::NoNeighbour &&
+                                polygons[occluder.neighbours[3 * i + edge]].orientation == polygon.orientation;
+            if (!inside) outline |= 1u << k;
+        }
+        // a quad is drawn as two triangles, the diagonal between them is inside
+        if (polygon.corners == 3) {
+            setupTriangle(polygon.screen[0], polygon.screen[1], polygon.screen[2], outline);
+        } else {
+            setupTriangle(polygon.screen[0], polygon.screen[1], polygon.screen[2], outline & 3u);
+            setupTriangle(polygon.screen[0], polygon.screen[2], polygon.screen[3], (outline >> 1) & 6u);
+        }
+    }
+}
+
+void OcclusionCuller::setupTriangle(const float* v0, const float* v1, const float* v2, unsigned int outline) {
+    float area = (v1[0] - v0[0]) * (v2[1] - v0[1]) - (v2[0] - v0[0]) * (v1[1] - v0[1]);
+    if (!(std::fabs(area) > 1e-8f) || !std::isfinite(area)) return;
+    // edge k lies opposite of vertex k, which is the edge from vertex k + 1 to vertex k + 2
+    bool onOutline[3] = { (outline & 2u) != 0, (outline & 4u) != 0, (outline & 1u) != 0 };
+    // counterclockwise, so the edge functions are positive inside
+    if (area < 0.0f) {
+        std::swap(v1, v2);
+        std::swap(onOutline[1], onOutline[2]);
+        area = -area;
+    }
+    const float minX = std::min(v0[0], std::min(v1[0], v2[0])), maxX = std::max(v0[0], std::max(v1[0], v2[0]));
+    const float minY = std::min(v0[1], std::min(v1[1], v2[1])), maxY = std::max(v0[1], std::max(v1[1], v2[1]));
+    if (maxX < 0.0f || maxY < 0.0f || minX >= float(width) || minY >= float(height)) return;
+
+    RasterTriangle t;
+    // edge k lies opposite of vertex k, from a to b
+    const float* from[3] = { v1, v2, v0 };
+    const float* to[3] = { v2, v0, v1 };
+    for (int k = 0; k < 3; ++k) {
+        t.a[k] = from[k][1] - to[k][1];
+        t.b[k] = to[k][0] - from[k][0];
+        t.c[k] = from[k][0] * to[k][1] - from[k][1] * to[k][0];
+        t.r[k] = 0.5f * (std::fabs(t.a[k]) + std::fabs(t.b[k]));
+        t.border[k] = onOutline[k] ? t.r[k] : -1.0f;
+    }
+    // the edge functions divided by the area are the barycentric coordinates of the depth plane. relative to v0,
+    // since far away the depths only differ in the last digits and c * z would cancel out most of them.
+    const float invArea = 1.0f / area;
+    const float dz1 = v1[2] - v0[2], dz2 = v2[2] - v0[2];
+    t.za = (t.a[1] * dz1 + t.a[2] * dz2) * invArea;
+    t.zb = (t.b[1] * dz1 + t.b[2] * dz2) * invArea;
+    t.zc = v0[2] - t.za * v0[0] - t.zb * v0[1];
+    // half a pixel in x and half in y away from the center of a pixel the depth changed by at most the largest
+    // slope of the triangles on the way, as long as no outline crosses the pixel
+    t.slope = std::max(std::fabs(t.za), std::fabs(t.zb));
+    t.minX = static_cast<int>(std::max(0.0f, std::floor(minX)));
+    t.minY = static_cast<int>(std::max(0.0f, std::floor(minY)));
+    t.maxX = static_cast<int>(std::min(float(width - 1), std::floor(maxX)));
+    t.maxY = static_cast<int>(std::min(float(height - 1), std::floor(maxY)));
+    triangles.push_back(t);
+}
+
+void OcclusionCuller::rasterize() {
+    const auto begin = Clock::now();
+    for (auto& bin : bins) bin.clear();
+    for (unsigned int i = 0; i < triangles.size(); ++i) {
+        const RasterTriangle& t = triangles[i];
+        for (int ty = t.minY / int(TileHeight); ty <= t.maxY / int(TileHeight); ++ty) {
+            for (int tx = t.minX / int(TileWidth); tx <= t.maxX / int(TileWidth); ++tx) bins[size_t(ty) * tilesX + tx].push_back(i);
+        }
+    }
+    stats.triangles = static_cast<unsigned int>(triangles.size());
+    for (const auto& bin : bins) stats.binnedTriangles += static_cast<unsigned int>(bin.size());
+    // every tile only writes its own pixels
+    ThreadPool::global().parallelFor(tilesX * tilesY, [this](unsigned int tile) { rasterizeTile(tile); });
+    buildHiZ();
+    stats.rasterMicroseconds = microsecondsSince(begin);
+}
+
+void OcclusionCuller::rasterizeTile(unsigned int tile) {
+    const int tileX0 = int(tile % tilesX * TileWidth), tileY0 = int(tile / tilesX * TileHeight);
+    const int tileX1 = tileX0 + int(TileWidth) - 1, tileY1 = tileY0 + int(TileHeight) - 1;
+    float* depth = hiZ[0].data();
+    float* slope = slopes.data();
+    for (int y = tileY0; y <= tileY1; ++y) {
+        std::fill_n(depth + size_t(y) * width + tileX0, TileWidth, 1.0f);
+        std::fill_n(slope + size_t(y) * width + tileX0, TileWidth, 0.0f);
+    }
+    for (unsigned int index : bins[tile]) {
+        const RasterTriangle& t = triangles[index];
+        // whole groups of 8 pixels, the tiles are multiples of 8 wide
+        const int x0 = std::max(t.minX, tileX0) & ~7, x1 = (std::min(t.maxX, tileX1) & ~7) + 8;
+        const int y0 = std::max(t.minY, tileY0), y1 = std::min(t.maxY, tileY1);
+        switch (kernel) {
+#ifdef CULLINGKERNELS_AVX
+            case CullingKernel::AVX:
+                rasterizeRowsAVX(t, depth, slope, width, x0, x1, y0, y1);
+                break;
+#endif
+#ifdef CULLINGKERNELS_SSE
+            case CullingKernel::SSE:
+                rasterizeRowsSSE(t, depth, slope, width, x0, x1, y0, y1);
+                break;
+#endif
+            default:
+                rasterizeRowsScalar(t, depth, slope, width, x0, x1, y0, y1);
+        }
+    }
+    // the farthest depth of the occluders over each pixel, pixels on the outline end up at 1
+    for (int y = tileY0; y <= tileY1; ++y) {
+        for (int x = tileX0; x <= tileX1; ++x) {
+            const size_t pixel = size_t(y) * width + x;
+            depth[pixel] = std::min(1.0f, depth[pixel] + slope[pixel]);
+        }
+    }
+}
+
+void OcclusionCuller::buildHiZ() {
+    for (size_t level = 1; level < hiZ.size(); ++level) {
+        const unsigned int levelWidth = levelSize(width, level), levelHeight = levelSize(height, level);
+        const unsigned int fineWidth = levelSize(width, level - 1), fineHeight = levelSize(height, level - 1);
+        const std::vector<float>& fine = hiZ[level - 1];
+        std::vector<float>& coarse = hiZ[level];
+        for (unsigned int y = 0; y < levelHeight; ++y) {
+            // an odd last row or column of the finer level is taken twice instead of being dropped
+            const float* row0 = &fine[size_t(2 * y) * fineWidth];
+            const float* row1 = 2 * y + 1 < fineHeight ? row0 + fineWidth : row0;
+            for (unsigned int x = 0; x < levelWidth; ++x) {
+                const unsigned int left = 2 * x, right = std::min(2 * x + 1, fineWidth - 1);
+                coarse[size_t(y) * levelWidth + x] = std::max(std::max(row0[left], row0[right]), std::max(row1[left], row1[right]));
+            }
+        }
+    }
+}
+
+bool OcclusionCuller::isOccluded(const Vec3f& boxMin, const Vec3f& boxMax) const {
+    if (boxMin[0] > boxMax[0] || boxMin[1] > boxMax[1] || boxMin[2] > boxMax[2]) return false;
+    // screen rectangle and nearest depth of the eight corners
+    float minX = FLT_MAX, minY = FLT_MAX, maxX = -FLT_MAX, maxY = -FLT_MAX, minDepth = FLT_MAX;
+    for (int corner = 0; corner < 8; ++corner) {
+        const float p[3] = { corner & 1 ? boxMax[0] : boxMin[0], corner & 2 ? boxMax[1] : boxMin[1], corner & 4 ? boxMax[2] : boxMin[2] };
+        float clip[4];
+        for (int row = 0; row < 4; ++row) {
+            clip[row] = viewProjection(row, 0) * p[0] + viewProjection(row, 1) * p[1] + viewProjection(row, 2) * p[2] + viewProjection(row, 3);
+        }
+        // in front of the near plane: the box may cover the whole screen
+        if (clip[2] < -clip[3] || clip[3] <= 0.0f) return false;
+        const float invW = 1.0f / clip[3];
+        const float x = (clip[0] * invW * 0.5f + 0.5f) * width, y = (clip[1] * invW * 0.5f + 0.5f) * height;
+        minX = std::min(minX, x);
+        maxX = std::max(maxX, x);
+        minY = std::min(minY, y);
+        maxY = std::max(maxY, y);
+        minDepth = std::min(minDepth, clip[2] * invW * 0.5f + 0.5f);
+    }
+    if (maxX < 0.0f || maxY < 0.0f || minX >= float(width) || minY >= float(height)) return false;
+    const unsigned int x0 = static_cast<unsigned int>(std::max(0.0f, std::floor(minX)));
+    const unsigned int y0 = static_cast<unsigned int>(std::max(0.0f, std::floor(minY)));
+    const unsigned int x1 = static_cast<unsigned int>(std::min(float(width - 1), std::floor(maxX)));
+    const unsigned int y1 = static_cast<unsigned int>(std::min(float(height - 1), std::floor(maxY)));
+    // the finest level at which the rectangle covers at most 4 x 4 texels
+    size_t level = 0;
+    while (level + 1 < hiZ.size() && ((x1 >> level) - (x0 >> level) >= 4 || (y1 >> level) - (y0 >> level) >= 4)) level++;
+    // x1 >> level < levelWidth and y1 >> level < levelHeight, since the levels are rounded up
+    const unsigned int levelWidth = levelSize(width, level);
+    for (unsigned int y = y0 >> level; y <= y1 >> level; ++y) {
+        for (unsigned int x = x0 >> level; x <= x1 >> level; ++x) {
+            if (hiZ[level][size_t(y) * levelWidth + x] >= minDepth) return false;
+        }
+    }
+    return true;
+}
+
+void OcclusionCuller::cull(std::vector<unsigned int>& objects, const std::vector<Vec3f>& boxMin, const std::vector<Vec3f>& boxMax) {
+    const auto begin = Clock::now();
+    const unsigned int count = static_cast<unsigned int>(objects.size());
+    occluded.resize(count);
+    // blocks of 256 objects, the hi-Z pyramid is only read
+    const unsigned int blockSize = 256, blocks = (count + blockSize - 1) / blockSize;
+    ThreadPool::global().parallelFor(blocks, [&](unsigned int block) {
+        for (unsigned int i = block * blockSize; i < std::min(count, (block + 1) * blockSize); ++i) {
+            occluded[i] = isOccluded(boxMin[objects[i]], boxMax[objects[i]]);
+        }
+    });
+    unsigned int kept = 0;
+    for (unsigned int i = 0; i < count; ++i) {
+        if (!occluded[i]) objects[kept++] = objects[i];
+    }
+    objects.resize(kept);
+    stats.objectsTested += count;
+    stats.objectsOccluded += count - kept;
+    stats.testMicroseconds += microsecondsSince(begin);
+}
+
+const unsigned int Occluder::NoNeighbour;
+
+void Occluder::buildNeighbours() {
+    neighbours.assign(indices.size(), NoNeighbour);
+    // directed edge from corner k to corner k + 1 -> index of the corner, Ambiguous if several triangles use it
+    const unsigned int Ambiguous = ~0u;
+    std::unordered_map<uint64_t, unsigned int> edges;
+    edges.reserve(neighbours.size());
+    auto key = [](unsigned int from, unsigned int to) { return uint64_t(from) << 32 | to; };
+    for (size_t corner = 0; corner < neighbours.size(); ++corner) {
+        const size_t next = corner % 3 == 2 ? corner - 2 : corner + 1;
+        const auto inserted = edges.emplace(key(indices[corner], indices[next]), static_cast<unsigned int>(corner));
+        if (!inserted.second) inserted.first->second = Ambiguous;
+    }
+    for (size_t corner = 0; corner < neighbours.size(); ++corner) {
+        const size_t next = corner % 3 == 2 ? corner - 2 : corner + 1;
+        const auto opposite = edges.find(key(indices[next], indices[corner]));
+        if (opposite == edges.end() || opposite->second == Ambiguous || edges[key(indices[corner], indices[next])] == Ambiguous) continue;
+        neighbours[corner] = opposite->second / 3;
+    }
+}
+
+void OcclusionCuller::buildHeightfieldOccluder(const float* heights, size_t rowStride, unsigned int resolution, float originX,
+                                               float originZ, float spacing, unsigned int cells, Occluder& occluder) {
+    occluder.clear();
+    if (resolution < 2 || cells == 0) return;
+    const unsigned int quads = resolution - 1;
+    const unsigned int cellSize = std::max(1u, (quads + cells - 1) / cells);
+    const unsigned int coarse = (quads + cellSize - 1) / cellSize;
+    // lowest height of the grid vertices of every coarse cell. the terrain over a cell never gets below it,
+    // it is interpolated between these vertices.
+    std::vector<float> cellMin(size_t(coarse) * coarse, FLT_MAX);
+    for (unsigned int cj = 0; cj < coarse; ++cj) {
+        for (unsigned int ci = 0; ci < coarse; ++ci) {
+            float& low = cellMin[size_t(cj) * coarse + ci];
+            for (unsigned int j = cj * cellSize; j <= std::min((cj + 1) * cellSize, quads); ++j) {
+                const float* row = heights + j * rowStride;
+                low = std::min(low, *std::min_element(row + ci * cellSize, row + std::min((ci + 1) * cellSize, quads) + 1));
+            }
+        }
+    }
+    // a coarse vertex below all cells around it keeps every coarse triangle below the terrain
+    const unsigned int side = coarse + 1;
+    occluder.vertices.reserve(size_t(side) * side);
+    for (unsigned int j = 0; j < side; ++j) {
+        for (unsigned int i = 0; i < side; ++i) {
+            float low = FLT_MAX;
+            for (unsigned int cj = j > 0 ? j - 1 : 0; cj <= std::min(j, coarse - 1); ++cj) {
+                for (unsigned int ci = i > 0 ? i - 1 : 0; ci <= std::min(i, coarse - 1); ++ci) low = std::min(low, cellMin[size_t(cj) * coarse + ci]);
+            }
+            occluder.vertices.emplace_back(originX + std::min(i * cellSize, quads) * spacing, low, originZ + std::min(j * cellSize, quads) * spacing);
+        }
+    }
+    occluder.indices.reserve(6 * size_t(coarse) * coarse);
+    for (unsigned int j = 0; j < coarse; ++j) {
+        for (unsigned int i = 0; i < coarse; ++i) {
+            const unsigned int v00 = j * side + i, v10 = v00 + 1, v01 = v00 + side, v11 = v01 + 1;
+            for (unsigned int v : { v00, v01, v10, v10, v01, v11 }) occluder.indices.push_back(v);
+        }
+    }
+    occluder.buildNeighbours();
+}
+
+void OcclusionCuller::benchmark(unsigned int count, int runs) {
+    // the terrain of generateTerrain seen from just above its edge, boxes of up to 5 units scattered over it
+    TriangleMesh terrain;
+    terrain.generateTerrain(TriangleMesh::TerrainSettings(), NoiseSettings(), false);
+    const Occluder& occluder = terrain.getOccluder();
+    QMatrix4x4 projection, view, model;
+    projection.perspective(65.0f, 2.0f, 0.5f, 10000.0f);
+    view.lookAt(QVector3D(0.0f, 15.0f, 110.0f), QVector3D(0.0f, 8.0f, 0.0f), QVector3D(0.0f, 1.0f, 0.0f));
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f), height(0.0f, 25.0f), size(0.5f, 5.0f);
+    std::vector<Vec3f> boxMin(count), boxMax(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        boxMin[i] = Vec3f(position(random), height(random), position(random));
+        boxMax[i] = boxMin[i] + Vec3f(size(random), size(random), size(random));
+    }
+    OcclusionCuller culler;
+    std::cout << "OcclusionCuller::benchmark: " << culler.getWidth() << " x " << culler.getHeight() << " pixels, "
+              << occluder.indices.size() / 3 << " occluder triangles, " << count << " boxes, "
+              << ThreadPool::global().getNumThreads() << " threads" << std::endl;
+    std::vector<float> reference;
+    std::vector<unsigned int> visible, referenceVisible;
+    double firstMicroseconds = 0.0;
+    for (CullingKernel kernel : { CullingKernel::SCALAR, CullingKernel::SSE, CullingKernel::AVX }) {
+        if (!cullingKernelSupported(kernel)) {
+            std::cout << "  " << cullingKernelName(kernel) << ": not supported" << std::endl;
+            continue;
+        }
+        culler.setKernel(kernel);
+        double rasterMicroseconds = 0.0, testMicroseconds = 0.0;
+        for (int run = 0; run < runs; ++run) {
+            culler.beginFrame(projection * view);
+            culler.addOccluder(occluder, model);
+            culler.rasterize();
+            visible.resize(count);
+            for (unsigned int i = 0; i < count; ++i) visible[i] = i;
+            culler.cull(visible, boxMin, boxMax);
+            rasterMicroseconds += culler.getStats().rasterMicroseconds;
+            testMicroseconds += culler.getStats().testMicroseconds;
+        }
+        if (reference.empty()) {
+            reference = culler.getDepthBuffer();
+            referenceVisible = visible;
+            firstMicroseconds = rasterMicroseconds;
+        }
+        const bool identical = reference == culler.getDepthBuffer() && referenceVisible == visible;
+        std::cout << "  " << std::setw(8) << std::left << (std::string(cullingKernelName(kernel)) + ":") << std::right
+                  << rasterMicroseconds / runs << " us rasterization (" << firstMicroseconds / rasterMicroseconds << "x), "
+                  << 1000.0 * testMicroseconds / runs / std::max(1u, count) << " ns per box, " << count - visible.size()
+                  << " of " << count << " boxes occluded" << (identical ? "" : ", WARNING: differs") << std::endl;
+    }
+}
@@ -0,0 +1,139 @@
+#ifndef OCCLUSIONCULLER_H
+#define OCCLUSIONCULLER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <QMatrix4x4>
+
+#include "Vec3.h"
+#include "CullingKernels.h"
+
+// simplified geometry rasterized by OcclusionCuller in place of a mesh. it has to lie completely inside the
+// solid the mesh bounds, otherwise it hides objects that are visible.
+struct Occluder {
+    static const unsigned int NoNeighbour = ~0u;
+
+    std::vector<Vec3f> vertices;
+    std::vector<unsigned int> indices;  // three per triangle
+    // three per triangle: the triangle across the edge from corner k to corner k + 1, NoNeighbour on the border.
+    // without them every edge counts as border, which culls less.
+    std::vector<unsigned int> neighbours;
+
+    bool empty() const { return indices.empty(); }
+    void clear() {
+        vertices.clear();
+        indices.clear();
+        neighbours.clear();
+    }
+    // links the triangles that share an edge in opposite directions, edges used more than twice are border
+    void buildNeighbours();
+};
+
+// Software occlusion culling on the CPU, no OpenGL needed. The occluders of a frame are rasterized into a small
+// depth buffer (256 x 128 by default) which is split into tiles of TileWidth x TileHeight pixels: the triangles
+// are binned into the tiles they overlap and the tiles are rasterized in parallel on the ThreadPool, 4 (SSE) or
+// 8 (AVX) pixels at a time. All kernels give identical depth buffers. A max-depth pyramid of the buffer (hi-Z)
+// then decides with a few lookups if an object's bounding box is behind the occluders everywhere it covers.
+// The result is conservative, an object is only culled if it is hidden everywhere, not just at pixel centers:
+// the depth of a pixel is the depth at its center plus the largest depth slope of the triangles touching it, so
+// it is at least the depth anywhere in the pixel, and pixels crossed by the outline of the occluders (their
+// border, silhouettes and the near plane) stay empty, since something may peek through the uncovered part.
+class OcclusionCuller {
+public:
+    static const unsigned int TileWidth = 64;
+    static const unsigned int TileHeight = 32;
+
+    // statistics of the last frame
+    struct Stats {
+        unsigned int triangles{0};        // occluder triangles after clipping and setup
+        unsigned int binnedTriangles{0};  // triangle tile pairs
+        unsigned int objectsTested{0};
+        unsigned int objectsOccluded{0};
+        double rasterMicroseconds{0.0};
+        double testMicroseconds{0.0};
+    };
+
+    // screen space triangle: edge functions a * x + b * y + c, positive inside, and depth z = za * x + zb * y + zc
+    struct RasterTriangle {
+        float a[3], b[3], c[3];
+        float za, zb, zc;
+        float r[3];       // half a pixel along the normal of edge k, the edge function is >= -r[k] where it touches
+        float border[3];  // r[k] if edge k is part of the outline of the occluders, -1 otherwise
+        float slope;      // largest depth change from the center of a pixel to its border
+        int minX, minY, maxX, maxY;  // pixels that may be covered, within the buffer
+    };
+
+private:
+    unsigned int width, height;
+    unsigned int tilesX, tilesY;
+    CullingKernel kernel;
+    QMatrix4x4 viewProjection;
+    // an occluder triangle clipped against the near plane and projected
+    struct Polygon {
+        float screen[4][3];
+        int edges[4];     // edge of the triangle from corner k to the next one, or 3 for the near plane
+        int corners;
+        int orientation;  // sign of the screen space area, 0 if it is not drawn
+    };
+
+    std::vector<RasterTriangle> triangles;
+    // clip coordinates of the occluder vertices, x, y, z, w per vertex
+    std::vector<float> clipVertices;
+    std::vector<Polygon> polygons;
+    // indices into triangles for every tile, row by row
+    std::vector<std::vector<unsigned int>> bins;
+    // hiZ[0] is the depth buffer with depths in [0, 1], hiZ[l] holds the maximum of 2 x 2 pixels of hiZ[l - 1].
+    // the sizes are rounded up, so every level covers all pixels for any multiple of the tile size.
+    std::vector<std::vector<float>> hiZ;
+    // largest slope of the triangles touching every pixel while rasterizing, added to the depth at the center
+    std::vector<float> slopes;
+    Stats stats;
+    // result of isOccluded for every object of cull
+    std::vector<uint8_t> occluded;
+
+    // adds a triangle in screen coordinates (x, y in pixels, z depth in [0, 1]). bit k of outline is set if the
+    // edge from vertex k to the next one is part of the outline of the occluders.
+    void setupTriangle(const float* v0, const float* v1, const float* v2, unsigned int outline);
+    void rasterizeTile(unsigned int tile);
+    void buildHiZ();
+
+public:
+    // width and height are rounded up to whole tiles, they need not be powers of two
+    explicit OcclusionCuller(unsigned int width = 256, unsigned int height = 128);
+
+    // rasterizer implementation, unsupported kernels fall back to SCALAR
+    void setKernel(CullingKernel kernel);
+    CullingKernel getKernel() const { return kernel; }
+
+    // starts a frame: forgets the occluders of the last frame
+    void beginFrame(const QMatrix4x4& viewProjection);
+    // clips the occluder (in the coordinates of model) against the near plane and sets up its triangles
+    void addOccluder(const Occluder& occluder, const QMatrix4x4& model);
+    // rasterizes all occluders added since beginFrame and builds the hi-Z pyramid
+    void rasterize();
+
+    // true if the box (in world coordinates) is hidden behind the occluders. boxes crossing the near plane or
+    // outside the screen are never occluded, the view frustum test takes care of the latter.
+    bool isOccluded(const Vec3f& boxMin, const Vec3f& boxMax) const;
+    // removes the occluded ones from objects, which are indices into boxMin and boxMax. the order is kept.
+    void cull(std::vector<unsigned int>& objects, const std::vector<Vec3f>& boxMin, const std::vector<Vec3f>& boxMax);
+
+    const Stats& getStats() const { return stats; }
+    unsigned int getWidth() const { return width; }
+    unsigned int getHeight() const { return height; }
+    const std::vector<float>& getDepthBuffer() const { return hiZ[0]; }
+
+    // occluder of a height grid of resolution^2 heights (row j starts at heights + j * rowStride, vertex i, j is at
+    // originX + i * spacing, originZ + j * spacing) with about cells^2 quads. every vertex of the coarse grid takes
+    // the lowest height of the quads around it, so the occluder stays below the terrain.
+    static void buildHeightfieldOccluder(const float* heights, size_t rowStride, unsigned int resolution, float originX,
+                                         float originZ, float spacing, unsigned int cells, Occluder& occluder);
+
+    // rasterizes a terrain occluder and tests count random boxes behind and above it, with every supported kernel.
+    // checks that all kernels give the same depth buffer and the same occluded boxes. no OpenGL context needed.
+    static void benchmark(unsigned int count = 100000, int runs = 20);
+};
+
+#endif //OCCLUSIONCULLER_H
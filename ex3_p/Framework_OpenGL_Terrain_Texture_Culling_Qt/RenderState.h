@@ -6,11 +6,14 @@
 #define UEBUNG_03_RENDERSTATE_H
 
 #include <stack>
+#include <vector>
 #include <QMatrix3x3>
 #include <QMatrix4x4>
 #include <QOpenGLFunctions_3_3_Core>
 
 #include "Vec3.h"
+#include "ClipPlane.h"
+#include "CullingKernels.h"
 
 class RenderState {
     Vec3f lightPos;
@@ -18,11 +21,25 @@ class RenderState {
     std::stack<QMatrix4x4> modelViewMatrixStack;
     std::stack<QMatrix4x4> projectionMatrixStack;
     QOpenGLFunctions_3_3_Core* f;
+    int viewportWidth{1}, viewportHeight{1};
     GLint modelViewMatrixUniformStandard{-1}, projectionMatrixUniformStandard{-1}, normalMatrixUniformStandard{-1}, lightPositionUniformStandard{-1},
             cameraPositionUniformStandard{-1}, textureUniformStandard{-1}, normalMapUniformStandard{-1}, useTextureUniformStandard{-1};
     GLint modelViewMatrixUniform{-1}, projectionMatrixUniform{-1}, normalMatrixUniform{-1}, lightPositionUniform{-1},
         cameraPositionUniform{-1}, textureUniform{-1}, normalMapUniform{-1}, useTextureUniform{-1};
 
+    // view frustum of frustumMatrix = projection * modelView, see getFrustumPlanes
+    mutable QMatrix4x4 frustumMatrix;
+    mutable std::vector<ClipPlane> frustumPlanes;
+    mutable std::vector<CullingPlane> frustumCullingPlanes;
+
+    void updateFrustum() const {
+        const QMatrix4x4 m = getCurrentProjectionMatrix() * getCurrentModelViewMatrix();
+        if (!frustumPlanes.empty() && m == frustumMatrix) return;
+        frustumMatrix = m;
+        frustumPlanes = extractFrustumPlanes(m);
+        frustumCullingPlanes = cullingPlanes(frustumPlanes);
+    }
+
     static void loadIdentity(std::stack<QMatrix4x4>& stack) {
         if (!stack.empty()) {
             stack.top().setToIdentity();
@@ -75,6 +92,37 @@ public:
     QMatrix4x4& getCurrentProjectionMatrix() { return projectionMatrixStack.top(); }
     const QMatrix4x4& getCurrentModelViewMatrix() const { return modelViewMatrixStack.top(); }
     const QMatrix4x4& getCurrentProjectionMatrix() const { return projectionMatrixStack.top(); }
+    void setViewportSize(int width, int height) {
+        viewportWidth = width;
+        viewportHeight = height;
+    }
+    int getViewportWidth() const { return viewportWidth; }
+    int getViewportHeight() const { return viewportHeight; }
+
+    // the six planes of the view frustum in the coordinates of the current modelView matrix, normals pointing inside.
+    // they are only extracted again if projection * modelView changed, so all meshes drawn with the same matrices
+    // in a frame share them.
+    const std::vector<ClipPlane>& getFrustumPlanes() const {
+        updateFrustum();
+        return frustumPlanes;
+    }
+    // the same planes prepared for cullBoxes
+    const std::vector<CullingPlane>& getFrustumCullingPlanes() const {
+        updateFrustum();
+        return frustumCullingPlanes;
+    }
+    // Gribb and Hartmann: a point p is inside if -w <= x, y, z <= w in clip coordinates, with (x, y, z, w) = m * p.
+    // every inequality is a plane in the coordinates p is given in, formed by two rows of m.
+    static std::vector<ClipPlane> extractFrustumPlanes(const QMatrix4x4& m) {
+        std::vector<ClipPlane> planes;
+        planes.reserve(6);
+        for (int row = 0; row < 3; ++row) {
+            planes.emplace_back(m(3, 0) + m(row, 0), m(3, 1) + m(row, 1), m(3, 2) + m(row, 2), m(3, 3) + m(row, 3));
+            planes.emplace_back(m(3, 0) - m(row, 0), m(3, 1) - m(row, 1), m(3, 2) - m(row, 2), m(3, 3) - m(row, 3));
+        }
+        return planes;
+    }
+
     QMatrix3x3 calculateNormalMatrix() const { return modelViewMatrixStack.top().normalMatrix(); }
     GLuint getCurrentProgram() const { return activeProgram; }
     GLuint getStandardProgram() const { return standardProgram; }
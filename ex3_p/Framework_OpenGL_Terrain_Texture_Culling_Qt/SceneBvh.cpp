@@ -0,0 +1,356 @@
+#include <algorithm>
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <utility>
+
+#include "SceneBvh.h"
+#include "RenderState.h"
+
+const float SceneBvh::RebuildThreshold = 1.5f;
+
+namespace {
+
+const unsigned int NumBins = 16;
+// relative cost of visiting a node compared to testing an object
+const float TraversalCost = 1.0f;
+
+bool isEmpty(const Vec3f& boxMin, const Vec3f& boxMax) {
+    return boxMin[0] > boxMax[0] || boxMin[1] > boxMax[1] || boxMin[2] > boxMax[2];
+}
+
+float surfaceArea(const Vec3f& boxMin, const Vec3f& boxMax) {
+    if (isEmpty(boxMin, boxMax)) return 0.0f;
+    const Vec3f size = boxMax - boxMin;
+    return 2.0f * (size[0] * size[1] + size[1] * size[2] + size[2] * size[0]);
+}
+
+void grow(Vec3f& boxMin, Vec3f& boxMax, const Vec3f& otherMin, const Vec3f& otherMax) {
+    for (int i = 0; i < 3; ++i) {
+        boxMin[i] = std::min(boxMin[i], otherMin[i]);
+        boxMax[i] = std::max(boxMax[i], otherMax[i]);
+    }
+}
+
+}
+
+void SceneBvh::build(const std::vector<Vec3f>& boxMin, const std::vector<Vec3f>& boxMax) {
+    const unsigned int count = static_cast<unsigned int>(boxMin.size());
+    nodes.clear();
+    nodes.reserve(count > 0 ? 2 * ((count + MaxLeafSize - 1) / MaxLeafSize) : 0);
+    objectOrder.resize(count);
+    std::vector<Vec3f> centers(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        objectOrder[i] = i;
+        centers[i] = 0.5f * (boxMin[i] + boxMax[i]);
+    }
+    // the boxes are needed in input order while building
+    objectMin = boxMin;
+    objectMax = boxMax;
+    if (count > 0) buildNode(0, count, centers);
+    // from now on they are kept in tree order
+    for (unsigned int i = 0; i < count; ++i) {
+        objectMin[i] = boxMin[objectOrder[i]];
+        objectMax[i] = boxMax[objectOrder[i]];
+    }
+    for (unsigned int i = static_cast<unsigned int>(nodes.size()); i-- > 0;) updateBox(i);
+    builtCost = cost();
+    nodeRejectingPlane.assign(nodes.size(), 0);
+    objectRejectingPlane.assign(count, 0);
+}
+
+unsigned int SceneBvh::buildNode(unsigned int first, unsigned int count, const std::vector<Vec3f>& centers) {
+    const unsigned int index = static_cast<unsigned int>(nodes.size());
+    nodes.emplace_back();
+    nodes[index].first = first;
+    nodes[index].count = count;
+    if (count <= MaxLeafSize) return index;
+
+    Vec3f nodeMin(FLT_MAX, FLT_MAX, FLT_MAX), nodeMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    Vec3f centerMin(FLT_MAX, FLT_MAX, FLT_MAX), centerMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (unsigned int i = first; i < first + count; ++i) {
+        const unsigned int object = objectOrder[i];
+        grow(nodeMin, nodeMax, objectMin[object], objectMax[object]);
+        grow(centerMin, centerMax, centers[object], centers[object]);
+    }
+    const Vec3f centerSize = centerMax - centerMin;
+    const int axis = centerSize[0] >= centerSize[1] && centerSize[0] >= centerSize[2] ? 0 : (centerSize[1] >= centerSize[2] ? 1 : 2);
+
+    unsigned int leftCount = 0;
+    if (centerSize[axis] > 0.0f) {
+        // sort the objects into bins along the axis and take the plane between two bins with the lowest SAH cost
+        struct Bin {
+            Vec3f boxMin{FLT_MAX, FLT_MAX, FLT_MAX}, boxMax{-FLT_MAX, -FLT_MAX, -FLT_MAX};
+            unsigned int count{0};
+        } bins[NumBins];
+        const float binScale = NumBins / centerSize[axis];
+        auto binOf = [&](unsigned int object) {
+            return std::min(NumBins - 1, static_cast<unsigned int>((centers[object][axis] - centerMin[axis]) * binScale));
+        };
+        for (unsigned int i = first; i < first + count; ++i) {
+            const unsigned int object = objectOrder[i];
+            Bin& bin = bins[binOf(object)];
+            grow(bin.boxMin, bin.boxMax, objectMin[object], objectMax[object]);
+            bin.count++;
+        }
+        // rightArea[b] and rightCount[b]: everything in bins b .. NumBins - 1
+        float rightArea[NumBins];
+        unsigned int rightCount[NumBins];
+        Vec3f sweepMin(FLT_MAX, FLT_MAX, FLT_MAX), sweepMax(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        unsigned int sweepCount = 0;
+        for (unsigned int b = NumBins; b-- > 1;) {
+            grow(sweepMin, sweepMax, bins[b].boxMin, bins[b].boxMax);
+            sweepCount += bins[b].count;
+            rightArea[b] = surfaceArea(sweepMin, sweepMax);
+            rightCount[b] = sweepCount;
+        }
+        float bestCost = FLT_MAX;
+        unsigned int bestSplit = 0;
+        sweepMin = Vec3f(FLT_MAX, FLT_MAX, FLT_MAX);
+        sweepMax = Vec3f(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+        sweepCount = 0;
+        for (unsigned int b = 1; b < NumBins; ++b) {
+            grow(sweepMin, sweepMax, bins[b - 1].boxMin, bins[b - 1].boxMax);
+            sweepCount += bins[b - 1].count;
+            if (sweepCount == 0 || rightCount[b] == 0) continue;
+            const float splitCost = surfaceArea(sweepMin, sweepMax) * sweepCount + rightArea[b] * rightCount[b];
+            if (splitCost < bestCost) {
+                bestCost = splitCost;
+                bestSplit = b;
+            }
+        }
+        // a split only pays off if its children are cheaper than testing all objects of the node
+        const float nodeArea = surfaceArea(nodeMin, nodeMax);
+        if (bestSplit == 0) return index;
+        if (nodeArea > 0.0f && TraversalCost + bestCost / nodeArea >= float(count) && count <= 4 * MaxLeafSize) return index;
+        const auto middle = std::partition(objectOrder.begin() + first, objectOrder.begin() + first + count,
+                                           [&](unsigned int object) { return binOf(object) < bestSplit; });
+        leftCount = static_cast<unsigned int>(middle - (objectOrder.begin() + first));
+    }
+    if (leftCount == 0 || leftCount == count) {
+        // all centers at the same position: split by count
+        leftCount = count / 2;
+        std::nth_element(objectOrder.begin() + first, objectOrder.begin() + first + leftCount, objectOrder.begin() + first + count,
+                         [&](unsigned int a, unsigned int b) { return centers[a][axis] < centers[b][axis]; });
+    }
+    buildNode(first, leftCount, centers);
+    const unsigned int secondChild = buildNode(first + leftCount, count - leftCount, centers);
+    nodes[index].secondChild = secondChild;
+    return index;
+}
+
+void SceneBvh::updateBox(unsigned int index) {
+    Node& node = nodes[index];
+    node.boundingBoxMin = Vec3f(FLT_MAX, FLT_MAX, FLT_MAX);
+    node.boundingBoxMax = Vec3f(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    if (node.secondChild == 0) {
+        for (unsigned int i = node.first; i < node.first + node.count; ++i) grow(node.boundingBoxMin, node.boundingBoxMax, objectMin[i], objectMax[i]);
+    } else {
+        for (unsigned int child : { index + 1, node.secondChild }) grow(node.boundingBoxMin, node.boundingBoxMax, nodes[child].boundingBoxMin, nodes[child].boundingBoxMax);
+    }
+}
+
+bool SceneBvh::refit(const std::vector<Vec3f>& boxMin, const std::vector<Vec3f>& boxMax) {
+    if (boxMin.size() != objectOrder.size()) {
+        build(boxMin, boxMax);
+        return true;
+    }
+    for (size_t i = 0; i < objectOrder.size(); ++i) {
+        objectMin[i] = boxMin[objectOrder[i]];
+        objectMax[i] = boxMax[objectOrder[i]];
+    }
+    // the children come after their parent
+    for (unsigned int i = static_cast<unsigned int>(nodes.size()); i-- > 0;) updateBox(i);
+    if (cost() > RebuildThreshold * builtCost) {
+        build(boxMin, boxMax);
+        return true;
+    }
+    return false;
+}
+
+float SceneBvh::cost() const {
+    if (nodes.empty()) return 0.0f;
+    const float rootArea = surfaceArea(nodes[0].boundingBoxMin, nodes[0].boundingBoxMax);
+    if (rootArea <= 0.0f) return 0.0f;
+    float result = 0.0f;
+    for (const Node& node : nodes) {
+        const float probability = surfaceArea(node.boundingBoxMin, node.boundingBoxMax) / rootArea;
+        result += probability * (node.secondChild == 0 ? float(node.count) : TraversalCost);
+    }
+    return result;
+}
+
+void SceneBvh::cull(const std::vector<CullingPlane>& planes, std::vector<unsigned int>& visible) {
+    const auto begin = std::chrono::steady_clock::now();
+    stats = Stats();
+    const size_t visibleBefore = visible.size();
+    // bit p of a mask is set if the box still has to be tested against plane p. returns false if the box is
+    // completely outside a plane and remembers that plane in rejectingPlane, clears the bits of the planes the box
+    // is completely inside of.
+    const unsigned int numPlanes = static_cast<unsigned int>(planes.size());
+    const bool coherence = temporalCoherence, masking = planeMasking;
+    Stats& counters = stats;
+    auto test = [&planes, numPlanes, coherence, masking, &counters](const Vec3f& boxMin, const Vec3f& boxMax, unsigned int& mask, uint8_t& rejectingPlane) -> bool {
+        if (isEmpty(boxMin, boxMax)) return false;
+        counters.boxesTested++;
+        const Vec3f center = 0.5f * (boxMin + boxMax), extent = 0.5f * (boxMax - boxMin);
+        const unsigned int testsBefore = counters.planeTests;
+        // returns true if the box is completely outside plane p
+        auto outside = [&](unsigned int p) -> bool {
+            const CullingPlane& plane = planes[p];
+            counters.planeTests++;
+            const float distance = plane.nx * center[0] + plane.ny * center[1] + plane.nz * center[2] + plane.d;
+            const float radius = plane.ax * extent[0] + plane.ay * extent[1] + plane.az * extent[2];
+            if (distance + radius < 0.0f) return true;
+            if (masking && distance - radius >= 0.0f) mask &= ~(1u << p);
+            return false;
+        };
+        // the plane that rejected the box last frame most likely rejects it again, so it goes first
+        const unsigned int cached = coherence && rejectingPlane < numPlanes && (mask & (1u << rejectingPlane)) ? rejectingPlane : numPlanes;
+        if (cached < numPlanes && outside(cached)) {
+            counters.boxesRejected++;
+            counters.rejectionTests++;
+            return false;
+        }
+        for (unsigned int p = 0; p < numPlanes; ++p) {
+            if (p == cached || !(mask & (1u << p))) continue;
+            if (outside(p)) {
+                rejectingPlane = static_cast<uint8_t>(p);
+                counters.boxesRejected++;
+                counters.rejectionTests += counters.planeTests - testsBefore;
+                return false;
+            }
+        }
+        return true;
+    };
+    const unsigned int allPlanes = planes.size() >= 32 ? ~0u : (1u << planes.size()) - 1;
+    std::vector<std::pair<unsigned int, unsigned int>> stack;
+    if (!nodes.empty()) stack.emplace_back(0, allPlanes);
+    while (!stack.empty()) {
+        const unsigned int index = stack.back().first;
+        unsigned int mask = stack.back().second;
+        stack.pop_back();
+        const Node& node = nodes[index];
+        stats.nodesVisited++;
+        if (!test(node.boundingBoxMin, node.boundingBoxMax, mask, nodeRejectingPlane[index])) continue;
+        if (mask == 0) {
+            // completely inside the frustum: all objects below are visible
+            stats.nodesInside++;
+            for (unsigned int i = node.first; i < node.first + node.count; ++i) {
+                if (!isEmpty(objectMin[i], objectMax[i])) visible.push_back(objectOrder[i]);
+            }
+        } else if (node.secondChild == 0) {
+            for (unsigned int i = node.first; i < node.first + node.count; ++i) {
+                unsigned int objectMask = mask;
+                if (test(objectMin[i], objectMax[i], objectMask, objectRejectingPlane[i])) visible.push_back(objectOrder[i]);
+            }
+        } else {
+            stack.emplace_back(node.secondChild, mask);
+            stack.emplace_back(index + 1, mask);
+        }
+    }
+    stats.objectsVisible = static_cast<unsigned int>(visible.size() - visibleBefore);
+    stats.microseconds = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - begin).count();
+}
+
+void SceneBvh::benchmark(const char* cameraPath, unsigned int count, int runs) {
+    // camera positions and directions per frame
+    std::vector<std::pair<QVector3D, QVector3D>> path;
+    if (cameraPath) {
+        std::ifstream file(cameraPath);
+        if (!file) {
+            std::cout << "SceneBvh::benchmark: could not open " << cameraPath << std::endl;
+            return;
+        }
+        float x, y, z, dirX, dirY, dirZ;
+        while (file >> x >> y >> z >> dirX >> dirY >> dirZ) path.emplace_back(QVector3D(x, y, z), QVector3D(dirX, dirY, dirZ));
+    } else {
+        // a quarter of a degree per frame, as with slow mouse look, while flying forward a little
+        for (int frame = 0; frame < 1440; ++frame) {
+            const float angle = 0.25f * frame * 3.14159265f / 180.0f;
+            path.emplace_back(QVector3D(0.0f, 20.0f, -0.1f * frame), QVector3D(std::sin(angle), -0.1f, -std::cos(angle)));
+        }
+    }
+    if (path.empty()) return;
+
+    // objects of up to 20 units scattered above a 2000 x 2000 ground around the origin
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-1000.0f, 1000.0f), height(0.0f, 50.0f), size(1.0f, 20.0f);
+    std::vector<Vec3f> boxMin(count), boxMax(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        boxMin[i] = Vec3f(position(random), height(random), position(random));
+        boxMax[i] = boxMin[i] + Vec3f(size(random), size(random), size(random));
+    }
+    SceneBvh bvh;
+    bvh.build(boxMin, boxMax);
+    std::cout << "SceneBvh::benchmark: " << count << " objects, " << bvh.getNumNodes() << " nodes, " << path.size() << " frames" << std::endl;
+
+    // the planes of every frame, with the projection of MainWindow
+    std::vector<std::vector<CullingPlane>> planes;
+    planes.reserve(path.size());
+    for (const auto& camera : path) {
+        QMatrix4x4 matrix;
+        matrix.perspective(65.0f, 1.5f, 0.5f, 10000.0f);
+        matrix.lookAt(camera.first, camera.first + camera.second, QVector3D(0.0f, 1.0f, 0.0f));
+        planes.push_back(cullingPlanes(RenderState::extractFrustumPlanes(matrix)));
+    }
+
+    std::vector<unsigned int> visible;
+    std::vector<size_t> reference;
+    const struct Variant {
+        const char* name;
+        bool masking, coherence;
+    } variants[] = { { "plain:", false, false }, { "temporal coherence:", false, true }, { "plane masking:", true, false },
+                     { "both:", true, true } };
+    for (const Variant& variant : variants) {
+        bvh.setPlaneMasking(variant.masking);
+        bvh.setTemporalCoherence(variant.coherence);
+        unsigned long long boxesTested = 0, boxesRejected = 0, planeTests = 0, rejectionTests = 0, objectsVisible = 0;
+        double microseconds = 0.0;
+        bool identical = true;
+        for (int run = 0; run < runs; ++run) {
+            for (size_t frame = 0; frame < planes.size(); ++frame) {
+                visible.clear();
+                bvh.cull(planes[frame], visible);
+                const Stats& frameStats = bvh.getStats();
+                boxesTested += frameStats.boxesTested;
+                boxesRejected += frameStats.boxesRejected;
+                planeTests += frameStats.planeTests;
+                rejectionTests += frameStats.rejectionTests;
+                objectsVisible += frameStats.objectsVisible;
+                microseconds += frameStats.microseconds;
+                // the objects are always appended in tree order, so the lists have to be equal
+                size_t checksum = visible.size();
+                for (unsigned int object : visible) checksum = checksum * 31 + object;
+                if (reference.size() < planes.size()) reference.push_back(checksum);
+                else identical = identical && reference[frame] == checksum;
+            }
+        }
+        const double frames = double(runs) * planes.size();
+        std::cout << "  " << std::setw(22) << std::left << variant.name << std::right << double(planeTests) / std::max(1ull, boxesTested)
+                  << " plane tests per box (" << double(rejectionTests) / std::max(1ull, boxesRejected) << " per rejected box), "
+                  << boxesTested / frames << " boxes tested, " << objectsVisible / frames << " visible, "
+                  << microseconds / frames << " us per frame" << (identical ? "" : ", WARNING: differs") << std::endl;
+    }
+}
+
+void SceneBvh::transformBox(const QMatrix4x4& matrix, const Vec3f& boxMin, const Vec3f& boxMax, Vec3f& resultMin, Vec3f& resultMax) {
+    if (isEmpty(boxMin, boxMax)) {
+        resultMin = boxMin;
+        resultMax = boxMax;
+        return;
+    }
+    // every row of the matrix contributes its smaller product to the minimum and its larger one to the maximum
+    for (int row = 0; row < 3; ++row) {
+        resultMin[row] = resultMax[row] = matrix(row, 3);
+        for (int column = 0; column < 3; ++column) {
+            const float a = matrix(row, column) * boxMin[column], b = matrix(row, column) * boxMax[column];
+            resultMin[row] += std::min(a, b);
+            resultMax[row] += std::max(a, b);
+        }
+    }
+}
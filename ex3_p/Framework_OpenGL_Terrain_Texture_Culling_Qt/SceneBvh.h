@@ -0,0 +1,92 @@
+#ifndef SCENEBVH_H
+#define SCENEBVH_H
+
+#include <cstdint>
+#include <vector>
+
+#include <QMatrix4x4>
+
+#include "Vec3.h"
+#include "CullingKernels.h"
+
+// Bounding volume hierarchy over the world space bounding boxes of the scene objects, for hierarchical view
+// frustum culling. Built top down with the surface area heuristic over binned box centers. The nodes are stored
+// depth first, so the objects of every subtree are a consecutive range of objectOrder and a node whose box is
+// completely inside the frustum hands out its whole range without testing the nodes below.
+// Moved objects only refit the boxes of the existing tree, the tree is rebuilt once its SAH cost has grown by
+// more than RebuildThreshold.
+// Culling exploits temporal coherence: every node and object remembers the plane that rejected it last and tests
+// it first, so while the camera moves slowly most invisible boxes are rejected by a single plane test. Planes a
+// parent is completely inside of are masked out for its children.
+class SceneBvh {
+public:
+    // statistics of the last cull
+    struct Stats {
+        unsigned int nodesVisited{0};
+        unsigned int nodesInside{0};     // nodes accepted with all objects below, without further plane tests
+        unsigned int objectsVisible{0};
+        unsigned int boxesTested{0};     // nodes and objects tested against the planes
+        unsigned int boxesRejected{0};   // tested boxes completely outside a plane
+        unsigned int planeTests{0};
+        unsigned int rejectionTests{0};  // plane tests of the rejected boxes
+        double microseconds{0.0};
+    };
+
+    static const unsigned int MaxLeafSize = 4;
+    static const float RebuildThreshold;
+
+private:
+    struct Node {
+        Vec3f boundingBoxMin, boundingBoxMax;
+        unsigned int first, count;    // objects of the subtree: objectOrder[first, first + count)
+        unsigned int secondChild{0};  // the first child follows its parent, 0 for leaves
+    };
+
+    std::vector<Node> nodes;
+    // object indices in tree order, with their boxes in the same order for the leaf tests
+    std::vector<unsigned int> objectOrder;
+    std::vector<Vec3f> objectMin, objectMax;
+    // plane that rejected a node or object (tree order) in the last cull, tested first in the next one
+    std::vector<uint8_t> nodeRejectingPlane, objectRejectingPlane;
+    bool temporalCoherence{true}, planeMasking{true};
+    float builtCost{0.0f};
+    Stats stats;
+
+    // builds the subtree of objectOrder[first, first + count) and returns its node index
+    unsigned int buildNode(unsigned int first, unsigned int count, const std::vector<Vec3f>& centers);
+    // sets the box of a node from its objects or children
+    void updateBox(unsigned int index);
+
+public:
+    // builds the tree over the boxes of all objects. empty boxes (min > max) are never visible.
+    void build(const std::vector<Vec3f>& boxMin, const std::vector<Vec3f>& boxMax);
+    // updates the boxes of the same objects after they moved, rebuilds if the tree got too bad.
+    // returns true if the tree was rebuilt.
+    bool refit(const std::vector<Vec3f>& boxMin, const std::vector<Vec3f>& boxMax);
+
+    // appends the objects whose boxes are not completely outside one of the planes to visible
+    void cull(const std::vector<CullingPlane>& planes, std::vector<unsigned int>& visible);
+
+    // test the plane that rejected a box last first. the visible objects are the same either way.
+    void setTemporalCoherence(bool enabled) { temporalCoherence = enabled; }
+    bool getTemporalCoherence() const { return temporalCoherence; }
+    // stop testing the planes a node is completely inside of for its children. a node inside all planes is
+    // accepted with its subtree. only switched off for comparison.
+    void setPlaneMasking(bool enabled) { planeMasking = enabled; }
+
+    // SAH cost of the current tree: expected number of node and object tests for a random ray, relative to the root
+    float cost() const;
+    const Stats& getStats() const { return stats; }
+    unsigned int getNumNodes() const { return static_cast<unsigned int>(nodes.size()); }
+    unsigned int getNumObjects() const { return static_cast<unsigned int>(objectOrder.size()); }
+
+    // replays a camera path over a scene of random boxes with and without plane masking and temporal coherence.
+    // the path file contains one "x y z dirX dirY dirZ" line per frame, as recorded by MainWindow. without a file
+    // the camera turns slowly like with mouse look.
+    static void benchmark(const char* cameraPath = nullptr, unsigned int count = 100000, int runs = 5);
+
+    // axis aligned box of the box [boxMin, boxMax] transformed by matrix (Arvo). empty boxes stay empty.
+    static void transformBox(const QMatrix4x4& matrix, const Vec3f& boxMin, const Vec3f& boxMax, Vec3f& resultMin, Vec3f& resultMax);
+};
+
+#endif //SCENEBVH_H
@@ -1,6 +1,6 @@
 #version 330 core
 
-layout(location = 0) in vec3 position; //Vertex position in object coordinates
+layout(location = 0) in vec3 position; //Vertex position in object coordinates. With the quantized vertex layout in [0,1]^3, the dequantization is part of modelView.
 layout(location = 1) in vec3 normal;   //Vertex normal
 layout(location = 2) in vec3 color;    //Per-vertex color (for coloring using color array). Note that the vertex array gets disabled when STATIC_COLOR is used. This means that a standard value is inserted here.
 layout(location = 3) in vec2 texCoord; //Texture coordinate (for using textures)
@@ -8,7 +8,7 @@ layout(location = 4) in vec3 tangent;
 
 uniform mat4 modelView;     //ModelView matrix
 uniform mat4 projection;    //Projection matrix
-uniform mat3 normalMatrix;  //The transpose inverse of the ModelView matrix, used for transformation of normals.
+uniform mat3 normalMatrix;  //The transpose inverse of the ModelView matrix (without dequantization), used for transformation of normals.
 
 uniform bool useDisplacement;
 
@@ -31,5 +31,7 @@ void main() {
 	vColor = color;
 	vNormal = normalMatrix * normal;
 	vTexCoord = texCoord;
-	vTangent = normalize(vec3(modelView * vec4(tangent, 0.0)));
+	//modelView may scale non-uniformly to dequantize the positions. normalMatrix does not, and equals the
+	//rotation of modelView up to a uniform scale for the rigid camera transformations used here.
+	vTangent = normalize(normalMatrix * tangent);
 }
@@ -4,14 +4,14 @@
 This vertex shader calculates a simple modelView and projection transformation according to the provided matrices. It will further passthrough several per-vertex attributes to the next shader stage. Please note that OpenGL automatically interpolates vertex outputs for the fragment shader.
 */
 
-layout(location = 0) in vec3 position; //Vertex position in model coordinates
+layout(location = 0) in vec3 position; //Vertex position in model coordinates. With the quantized vertex layout in [0,1]^3, the dequantization is part of modelView.
 layout(location = 1) in vec3 normal;   //Vertex normal
 layout(location = 2) in vec3 color;    //Per-vertex color (for coloring using color array). Note that the vertex array gets disabled when STATIC_COLOR is used. This means that a standard value is inserted here.
 layout(location = 3) in vec2 texCoord; //Texture coordinate (for using textures)
 
 uniform mat4 modelView;     //ModelView matrix
 uniform mat4 projection;    //Projection matrix
-uniform mat3 normalMatrix;  //The transpose inverse of the ModelView matrix, used for transformation of normals.
+uniform mat3 normalMatrix;  //The transpose inverse of the ModelView matrix (without dequantization), used for transformation of normals.
 
 out vec3 vColor;    //Per-vertex color
 out vec3 vNormal;   //Per-vertex normal, transformed
@@ -0,0 +1,64 @@
+#version 330 core
+
+/*
+This vertex shader draws one node of the CDLOD terrain (see CdlodTerrain.h). All nodes share the same patch of
+vertices in [0,1]^2, which is scaled to the node and displaced by the height texture. Towards the end of the range
+of its level, every odd vertex of the patch slides onto its even neighbour, so the node turns into the grid of the
+next coarser level before that level takes over. The outputs are the same as those of only_mvp.vert.
+*/
+
+layout(location = 0) in vec2 gridPosition; //Vertex of the shared patch in [0,1]^2
+
+uniform mat4 modelView;     //ModelView matrix
+uniform mat4 projection;    //Projection matrix
+uniform mat3 normalMatrix;  //The transpose inverse of the ModelView matrix, used for transformation of normals.
+
+uniform sampler2D heightTexture; //Heights in object coordinates, one texel per vertex of the finest grid
+uniform vec2 terrainOrigin;      //x and z of the first vertex of the finest grid
+uniform float gridSpacing;       //Distance between two vertices of the finest grid
+uniform float heightScale;       //Height of the highest possible vertex, for the colors
+uniform vec3 cameraPosition;     //Camera position in object coordinates
+
+uniform vec2 nodeOffset;         //x and z of the lower corner of the node
+uniform float nodeSize;          //Side length of the node
+uniform float patchResolution;   //Quads per side of the patch
+uniform vec2 morphRange;         //Camera distance where the morph into the next coarser level starts and ends
+
+out vec3 vColor;    //Per-vertex color
+out vec3 vNormal;   //Per-vertex normal, transformed
+out vec3 vPos;      //Position in camera coordinates
+out vec2 vTexCoord; //Texture coordinate of current vertex
+
+//Bilinearly filtered height at x and z, the texel centers are the grid vertices
+float heightAt(vec2 xz) {
+    vec2 texel = (xz - terrainOrigin) / gridSpacing;
+    return texture(heightTexture, (texel + 0.5) / vec2(textureSize(heightTexture, 0))).r;
+}
+
+void main() {
+    vec2 xz = nodeOffset + gridPosition * nodeSize;
+    //The morph factor only depends on the unmorphed position, so vertices shared by two nodes move the same way.
+    float distanceToCamera = distance(cameraPosition, vec3(xz.x, heightAt(xz), xz.y));
+    float morph = clamp((distanceToCamera - morphRange.x) / max(morphRange.y - morphRange.x, 0.0001), 0.0, 1.0);
+    //1 / patchResolution for odd, 0 for even vertices
+    vec2 odd = fract(gridPosition * patchResolution * 0.5) * 2.0 / patchResolution;
+    xz -= odd * nodeSize * morph;
+
+    float height = heightAt(xz);
+    vec3 position = vec3(xz.x, height, xz.y);
+    //Central differences like TriangleMesh::generateTerrain
+    float dx = heightAt(xz + vec2(gridSpacing, 0.0)) - heightAt(xz - vec2(gridSpacing, 0.0));
+    float dz = heightAt(xz + vec2(0.0, gridSpacing)) - heightAt(xz - vec2(0.0, gridSpacing));
+    vec3 normal = normalize(vec3(-dx, 2.0 * gridSpacing, -dz));
+
+    //Green valleys, brown slopes, white peaks
+    float t = clamp(height / max(heightScale, 0.0001), 0.0, 1.0);
+    vec3 valley = vec3(0.2, 0.5, 0.15), slope = vec3(0.45, 0.35, 0.2), peak = vec3(0.95, 0.95, 0.95);
+    vColor = t < 0.5 ? mix(valley, slope, 2.0 * t) : mix(slope, peak, 2.0 * t - 1.0);
+
+    vec4 tempPos = modelView * vec4(position, 1.0);
+    gl_Position = projection * tempPos;
+    vPos = tempPos.xyz / tempPos.w; //inhomogenous coordinates
+    vNormal = normalMatrix * normal;
+    vTexCoord = (xz - terrainOrigin) / (gridSpacing * (vec2(textureSize(heightTexture, 0)) - 1.0));
+}
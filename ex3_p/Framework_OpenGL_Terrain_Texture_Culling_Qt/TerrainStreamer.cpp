@@ -0,0 +1,162 @@
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+#include "TerrainStreamer.h"
+#include "ThreadPool.h"
+
+TerrainStreamer::Settings::Settings() {
+    // 64 x 64 quads of 1 x 1 on a 64 x 64 tile, drawn in four culled chunks
+    tile.resolution = 65;
+    tile.size = 64.0f;
+    tile.chunkSize = 32;
+    // many tiles are resident, so their occluders are kept small
+    tile.occluderCells = 4;
+    // about the feature size of the 200 x 200 terrain of generateTerrain with the default noise frequency of 4
+    noise.frequency = 1.25f;
+}
+
+TerrainStreamer::TerrainStreamer(const Settings& streamSettings)
+    : settings(streamSettings)
+{
+}
+
+TerrainStreamer::~TerrainStreamer() {
+    std::unique_lock<std::mutex> lock(mutex);
+    allGenerated.wait(lock, [this] { return generating == 0; });
+}
+
+float TerrainStreamer::squaredDistance(int64_t key, const QVector3D& cameraPos) const {
+    const float size = settings.tile.size;
+    const float x0 = tileX(key) * size, z0 = tileZ(key) * size;
+    const float dx = std::max(0.0f, std::max(x0 - cameraPos.x(), cameraPos.x() - (x0 + size)));
+    const float dz = std::max(0.0f, std::max(z0 - cameraPos.z(), cameraPos.z() - (z0 + size)));
+    return dx * dx + dz * dz;
+}
+
+void TerrainStreamer::requestTile(int64_t key) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.insert(key);
+        generating++;
+    }
+    const TriangleMesh::TerrainSettings tileSettings = settings.tile;
+    const NoiseSettings noise = settings.noise;
+    ThreadPool::global().enqueue([this, key, tileSettings, noise] {
+        std::unique_ptr<TriangleMesh> mesh(new TriangleMesh());
+        mesh->generateTerrainTile(tileSettings, noise, tileX(key), tileZ(key), false);
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.push_back(FinishedTile{ key, std::move(mesh) });
+        generating--;
+        allGenerated.notify_all();
+    });
+}
+
+bool TerrainStreamer::evictLeastRecentlyUsed() {
+    auto victim = tiles.end();
+    for (auto it = tiles.begin(); it != tiles.end(); ++it) {
+        if (it->second.lastUsed == frame) continue;
+        if (victim == tiles.end() || it->second.lastUsed < victim->second.lastUsed) victim = it;
+    }
+    if (victim == tiles.end()) return false;
+    residentMemory -= victim->second.mesh.getVertexMemory() + victim->second.mesh.getIndexMemory();
+    tiles.erase(victim);
+    return true;
+}
+
+void TerrainStreamer::update(const QVector3D& cameraPos) {
+    frame++;
+    const float radius2 = settings.loadRadius * settings.loadRadius;
+    for (auto& entry : tiles) {
+        if (squaredDistance(entry.first, cameraPos) <= radius2) entry.second.lastUsed = frame;
+    }
+
+    // upload the finished tiles up to the budget, the rest waits for the next frame
+    std::vector<FinishedTile> ready;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        ready.swap(finished);
+    }
+    size_t uploaded = 0;
+    unsigned int uploadedTiles = 0;
+    auto next = ready.begin();
+    for (; next != ready.end() && (uploadedTiles == 0 || uploaded < settings.uploadBudget); ++next) {
+        // the camera moved on while the tile was generated
+        if (squaredDistance(next->key, cameraPos) > radius2) {
+            stats.droppedTiles++;
+        } else {
+            if (tiles.size() >= settings.maxTiles) {
+                if (!evictLeastRecentlyUsed()) break;
+                stats.evictedTiles++;
+            }
+            Tile& tile = tiles[next->key];
+            tile.mesh.setColoringMode(TriangleMesh::ColoringType::COLOR_ARRAY);
+            tile.mesh.setVertexLayout(TriangleMesh::VertexLayout::QUANTIZED);
+            tile.mesh.takeGeometry(std::move(*next->mesh));
+            tile.mesh.uploadToGPU();
+            tile.lastUsed = frame;
+            const size_t bytes = tile.mesh.getVertexMemory() + tile.mesh.getIndexMemory();
+            residentMemory += bytes;
+            uploaded += bytes;
+            uploadedTiles++;
+        }
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.erase(next->key);
+    }
+    if (next != ready.end()) {
+        std::lock_guard<std::mutex> lock(mutex);
+        finished.insert(finished.begin(), std::make_move_iterator(next), std::make_move_iterator(ready.end()));
+    }
+
+    // request the missing tiles within the radius, nearest first
+    const float size = settings.tile.size;
+    const int cameraX = int(std::floor(cameraPos.x() / size)), cameraZ = int(std::floor(cameraPos.z() / size));
+    const int reach = int(std::ceil(settings.loadRadius / size));
+    std::vector<std::pair<float, int64_t>> missing;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (int z = cameraZ - reach; z <= cameraZ + reach; ++z) {
+            for (int x = cameraX - reach; x <= cameraX + reach; ++x) {
+                const int64_t key = tileKey(x, z);
+                const float distance2 = squaredDistance(key, cameraPos);
+                if (distance2 <= radius2 && tiles.find(key) == tiles.end() && pending.find(key) == pending.end()) {
+                    missing.emplace_back(distance2, key);
+                }
+            }
+        }
+    }
+    std::sort(missing.begin(), missing.end());
+    for (const auto& tile : missing) {
+        if (getNumPending() >= settings.maxPendingTiles) break;
+        requestTile(tile.second);
+    }
+    stats.uploadedTiles += uploadedTiles;
+    stats.uploadedBytes += uploaded;
+}
+
+unsigned int TerrainStreamer::draw(RenderState& state) {
+    unsigned int trianglesDrawn = 0;
+    for (auto& entry : tiles) trianglesDrawn += entry.second.mesh.draw(state);
+    return trianglesDrawn;
+}
+
+void TerrainStreamer::addOccluders(OcclusionCuller& culler) const {
+    const QMatrix4x4 identity;
+    for (const auto& entry : tiles) culler.addOccluder(entry.second.mesh.getOccluder(), identity);
+}
+
+void TerrainStreamer::clear() {
+    tiles.clear();
+    residentMemory = 0;
+}
+
+unsigned int TerrainStreamer::getNumTriangles() {
+    unsigned int triangles = 0;
+    for (auto& entry : tiles) triangles += entry.second.mesh.getNumTriangles();
+    return triangles;
+}
+
+unsigned int TerrainStreamer::getNumPending() {
+    std::lock_guard<std::mutex> lock(mutex);
+    return static_cast<unsigned int>(pending.size());
+}
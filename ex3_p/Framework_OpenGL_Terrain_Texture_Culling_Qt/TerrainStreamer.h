@@ -0,0 +1,111 @@
+#ifndef TERRAINSTREAMER_H
+#define TERRAINSTREAMER_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <QVector3D>
+
+#include "TriangleMesh.h"
+#include "NoiseKernels.h"
+
+class RenderState;
+
+// Endless fBm terrain made of tiles (TriangleMesh::generateTerrainTile) around the camera. Missing tiles within
+// loadRadius are generated on the worker threads of ThreadPool::global(), nearest first, and uploaded by update()
+// on the thread owning the OpenGL context, at most uploadBudget bytes per frame. The tiles are kept in a least
+// recently used cache of maxTiles tiles: a tile within loadRadius is never evicted, the tile that left the radius
+// first is evicted first. Together with at most maxPendingTiles tiles in generation the memory stays bounded no
+// matter how far the camera travels.
+class TerrainStreamer {
+public:
+    struct Settings {
+        // grid of one tile. 2^k + 1 vertices per side keep the border vertices of neighbouring tiles identical.
+        TriangleMesh::TerrainSettings tile;
+        NoiseSettings noise;
+        // tiles closer to the camera (in x and z) are generated and never evicted
+        float loadRadius{250.0f};
+        // tiles kept on the GPU, at least the number of tiles within loadRadius
+        unsigned int maxTiles{96};
+        // tiles generated or waiting for their upload at the same time
+        unsigned int maxPendingTiles{8};
+        // bytes of vertex and index data uploaded per frame, at least one tile is uploaded
+        size_t uploadBudget{1u << 20};
+
+        Settings();
+    };
+
+    // tile traffic of update() since the last resetStats
+    struct Stats {
+        unsigned int uploadedTiles{0};
+        size_t uploadedBytes{0};
+        unsigned int evictedTiles{0};
+        unsigned int droppedTiles{0};  // finished after the camera had moved on
+    };
+
+private:
+    struct Tile {
+        TriangleMesh mesh;
+        uint64_t lastUsed{0};  // frame in which the tile was within loadRadius the last time
+    };
+    struct FinishedTile {
+        int64_t key;
+        std::unique_ptr<TriangleMesh> mesh;
+    };
+
+    Settings settings;
+    std::unordered_map<int64_t, Tile> tiles;
+    uint64_t frame{0};
+    size_t residentMemory{0};
+    Stats stats;
+
+    std::mutex mutex;
+    std::condition_variable allGenerated;
+    // tiles requested but not yet uploaded, generating counts the ones still running on a worker
+    std::unordered_set<int64_t> pending;
+    std::vector<FinishedTile> finished;
+    unsigned int generating{0};
+
+    static int64_t tileKey(int x, int z) { return (int64_t(x) << 32) | uint32_t(z); }
+    static int tileX(int64_t key) { return int(key >> 32); }
+    static int tileZ(int64_t key) { return int(int32_t(uint32_t(key))); }
+    // squared distance in x and z from the camera to the tile
+    float squaredDistance(int64_t key, const QVector3D& cameraPos) const;
+    void requestTile(int64_t key);
+    // evicts the least recently used tile outside loadRadius. returns false if every tile is within the radius.
+    bool evictLeastRecentlyUsed();
+
+public:
+    explicit TerrainStreamer(const Settings& settings = Settings());
+    // waits for all running generations
+    ~TerrainStreamer();
+    TerrainStreamer(const TerrainStreamer& other) = delete;
+    TerrainStreamer& operator= (const TerrainStreamer& other) = delete;
+
+    // uploads finished tiles within the budget, evicts tiles if the cache is full and requests the missing tiles
+    // around the camera. call once per frame, requires a current OpenGL context.
+    void update(const QVector3D& cameraPos);
+    // draws the resident tiles with the current program of state, returns the number of triangles drawn
+    unsigned int draw(RenderState& state);
+    // adds the occluders of the resident tiles to the frame of culler
+    void addOccluders(OcclusionCuller& culler) const;
+    // deletes all tiles. requires a current OpenGL context.
+    void clear();
+
+    unsigned int getNumResidentTiles() const { return static_cast<unsigned int>(tiles.size()); }
+    // bytes of vertex and index data of the resident tiles on the GPU
+    size_t getResidentMemory() const { return residentMemory; }
+    // triangles of all resident tiles
+    unsigned int getNumTriangles();
+    // tiles generating or waiting for their upload
+    unsigned int getNumPending();
+    const Stats& getStats() const { return stats; }
+    void resetStats() { stats = Stats(); }
+};
+
+#endif //TERRAINSTREAMER_H
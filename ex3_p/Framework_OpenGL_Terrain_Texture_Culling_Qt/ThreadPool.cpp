@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
+
+#include "ThreadPool.h"
+
+ThreadPool::ThreadPool(unsigned int threadCount) {
+    if (threadCount == 0) threadCount = std::max(1u, std::thread::hardware_concurrency());
+    workers.reserve(threadCount);
+    for (unsigned int i = 0; i < threadCount; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this);
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    condition.notify_all();
+    for (auto& worker : workers) worker.join();
+}
+
+void ThreadPool::workerLoop() {
+    for (;;) {
+        std::function<void()> task;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            condition.wait(lock, [this] { return stopping || !tasks.empty(); });
+            if (stopping && tasks.empty()) return;
+            task = std::move(tasks.front());
+            tasks.pop();
+        }
+        task();
+    }
+}
+
+void ThreadPool::enqueue(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        tasks.push(std::move(task));
+    }
+    condition.notify_one();
+}
+
+void ThreadPool::parallelFor(unsigned int count, const std::function<void(unsigned int)>& task) {
+    if (count == 0) return;
+    if (count == 1 || workers.size() <= 1) {
+        for (unsigned int i = 0; i < count; ++i) task(i);
+        return;
+    }
+    // Shared between the caller and the helpers. Helpers that start after the caller returned only
+    // see an exhausted index counter, so they never touch the task again.
+    struct State {
+        std::function<void(unsigned int)> task;
+        unsigned int count;
+        std::atomic<unsigned int> next{0};
+        std::atomic<unsigned int> done{0};
+        std::mutex mutex;
+        std::condition_variable finished;
+    };
+    auto state = std::make_shared<State>();
+    state->task = task;
+    state->count = count;
+    auto work = [state] {
+        unsigned int i;
+        while ((i = state->next++) < state->count) {
+            state->task(i);
+            if (++state->done == state->count) {
+                std::lock_guard<std::mutex> lock(state->mutex);
+                state->finished.notify_all();
+            }
+        }
+    };
+    const unsigned int helpers = std::min<unsigned int>(count, getNumThreads()) - 1;
+    for (unsigned int i = 0; i < helpers; ++i) enqueue(work);
+    work();
+    std::unique_lock<std::mutex> lock(state->mutex);
+    state->finished.wait(lock, [&state] { return state->done == state->count; });
+}
+
+ThreadPool& ThreadPool::global() {
+    static ThreadPool pool;
+    return pool;
+}
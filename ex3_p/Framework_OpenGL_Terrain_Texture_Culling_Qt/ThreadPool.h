@@ -0,0 +1,42 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+// Fixed size pool of worker threads. Used for CPU side mesh processing (loading, normals, terrain).
+class ThreadPool {
+    std::vector<std::thread> workers;
+    std::queue<std::function<void()>> tasks;
+    std::mutex mutex;
+    std::condition_variable condition;
+    bool stopping{false};
+
+    void workerLoop();
+
+public:
+    // threadCount = 0 uses one thread per hardware thread
+    explicit ThreadPool(unsigned int threadCount = 0);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool& other) = delete;
+    ThreadPool& operator= (const ThreadPool& other) = delete;
+
+    // number of worker threads
+    unsigned int getNumThreads() const { return static_cast<unsigned int>(workers.size()); }
+
+    // runs task on one of the workers some time later
+    void enqueue(std::function<void()> task);
+
+    // calls task(i) for all i in [0, count) and returns when all calls have finished.
+    // the calling thread takes part in the work, so this may also be called from inside a worker.
+    void parallelFor(unsigned int count, const std::function<void(unsigned int)>& task);
+
+    // pool shared by all meshes
+    static ThreadPool& global();
+};
+
+#endif //THREADPOOL_H
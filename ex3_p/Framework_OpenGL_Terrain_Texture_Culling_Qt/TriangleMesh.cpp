@@ -6,14 +6,25 @@
 #include <cmath>
 #include <array>
 #include <cfloat>
+#include <climits>
 #include <algorithm>
 #include <random>
 #include <array>
 
+#include <chrono>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
+#include <functional>
 #include <iostream>
 #include <iomanip>
+#include <string>
+#include <unordered_map>
+#include <utility>
 
+#include <QDateTime>
+#include <QFile>
+#include <QFileInfo>
 #include <QOpenGLFunctions_3_3_Core>
 
 #include "TriangleMesh.h"
@@ -21,10 +32,109 @@
 #include "Utilities.h"
 #include "ClipPlane.h"
 #include "shader.h"
+#include "FastParse.h"
+#include "ThreadPool.h"
+#include "MeshOptimizer.h"
+#include "stb_image.h"
 
 using glVertexAttrib3fvPtr = void (*)(GLuint index, const GLfloat* v);
 using glVertexAttrib3fPtr = void (*)(GLuint index, GLfloat v1, GLfloat v2, GLfloat v3);
 
+// files below this size are not worth the thread synchronisation of the parallel OFF reader
+const qint64 ParallelLoadMinBytes = 1 << 20;
+// meshes below this size get their normals from the sequential scatter loop
+const size_t ParallelNormalsMinTriangles = 1 << 16;
+// 16 bit index ranges of large meshes need this many triangles on average, otherwise the draw call
+// overhead outweighs the saved bandwidth and the whole mesh is drawn with 32 bit indices
+const size_t MinShortIndexRangeTriangles = 1024;
+const size_t MaxShortIndexVertices = 1 << 16;
+// no level of detail gets less triangles
+const size_t LodMinTriangles = 256;
+// a coarser level of detail has to stay below this fraction of the pixel threshold before it is selected
+const float LodHysteresis = 0.75f;
+
+// binary mesh cache, written next to the OFF file as <file>.meshcache. The header is followed by the raw
+// vertex, normal, texCoord, tangent and triangle arrays and the triangles of the levels of detail. Increase MeshCacheVersion whenever the layout
+// or the post-processing of loaded meshes changes, so old caches get rebuilt.
+const char MeshCacheMagic[4] = { 'T', 'M', 'C', 'F' };
+const uint32_t MeshCacheVersion = 4;
+const unsigned int MeshCacheMaxLods = 8;
+const char* const MeshCacheExtension = ".meshcache";
+
+struct MeshCacheHeader {
+    char magic[4];
+    uint32_t version;
+    int64_t sourceModified;  // modification time of the OFF file in ms since epoch
+    int64_t sourceSize;      // size of the OFF file in bytes
+    uint32_t numVertices, numNormals, numTexCoords, numTangents, numTriangles;
+    uint32_t numLods;
+    uint32_t numLodTriangles[MeshCacheMaxLods];
+    float lodErrors[MeshCacheMaxLods];
+    float boundingBoxMin[3];
+    float boundingBoxMax[3];
+};
+
+// attribute[i] = old attribute[order[i]] for per vertex attributes, other attributes are left alone
+template<typename T>
+static void remapAttribute(std::vector<T>& attribute, const std::vector<unsigned int>& order, size_t vertexCount) {
+    if (attribute.size() != vertexCount) return;
+    std::vector<T> remapped(order.size());
+    for (size_t i = 0; i < order.size(); ++i) remapped[i] = attribute[order[i]];
+    attribute.swap(remapped);
+}
+
+// attribute encodings of VertexLayout::QUANTIZED
+
+// x, y, z as signed normalized 10 bit values (GL_INT_2_10_10_10_REV), w = 0. a GL 3.3 context decodes c as
+// (2c + 1) / 1023, not as max(c / 511, -1) like GL 4.2, so c is rounded for that rule. 0 is not representable,
+// it becomes +-1/1023, which the shaders normalize away.
+static uint32_t packSnorm10(const Vec3f& v) {
+    uint32_t packed = 0;
+    for (unsigned int i = 0; i < 3; ++i) {
+        const float clamped = std::max(-1.0f, std::min(1.0f, v[i]));
+        const int32_t q = std::max(-512, std::min(511, static_cast<int32_t>(std::lround((clamped * 1023.0f - 1.0f) * 0.5f))));
+        packed |= (static_cast<uint32_t>(q) & 0x3FFu) << (10 * i);
+    }
+    return packed;
+}
+
+// IEEE 754 binary16 (GL_HALF_FLOAT), rounded to nearest even
+static uint16_t floatToHalf(float value) {
+    uint32_t bits;
+    std::memcpy(&bits, &value, sizeof(bits));
+    const uint32_t sign = (bits >> 16) & 0x8000u;
+    const uint32_t floatExponent = (bits >> 23) & 0xFFu;
+    uint32_t mantissa = bits & 0x7FFFFFu;
+    if (floatExponent == 0xFFu) return static_cast<uint16_t>(sign | 0x7C00u | (mantissa ? 0x200u : 0u)); // inf, nan
+    const int exponent = static_cast<int>(floatExponent) - 127 + 15;
+    if (exponent >= 31) return static_cast<uint16_t>(sign | 0x7C00u); // overflow
+    uint32_t half, rest, halfway;
+    if (exponent <= 0) {
+        // subnormal half
+        if (exponent < -10) return static_cast<uint16_t>(sign);
+        mantissa |= 0x800000u;
+        const int shift = 14 - exponent;
+        half = mantissa >> shift;
+        rest = mantissa & ((1u << shift) - 1u);
+        halfway = 1u << (shift - 1);
+    } else {
+        half = (static_cast<uint32_t>(exponent) << 10) | (mantissa >> 13);
+        rest = mantissa & 0x1FFFu;
+        halfway = 0x1000u;
+    }
+    // a carry out of the mantissa correctly increments the exponent
+    if (rest > halfway || (rest == halfway && (half & 1u))) ++half;
+    return static_cast<uint16_t>(sign | half);
+}
+
+static uint16_t quantizeUnorm16(float value) {
+    return static_cast<uint16_t>(std::lround(std::max(0.0f, std::min(1.0f, value)) * 65535.0f));
+}
+
+static uint8_t quantizeUnorm8(float value) {
+    return static_cast<uint8_t>(std::lround(std::max(0.0f, std::min(1.0f, value)) * 255.0f));
+}
+
 TriangleMesh::TriangleMesh()
     : staticColor(1.f, 1.f, 1.f)
 {
@@ -43,6 +153,14 @@ void TriangleMesh::clear() {
     normals.clear();
     colors.clear();
     texCoords.clear();
+    tangents.clear();
+    lods.clear();
+    chunks.clear();
+    chunkBoxes.clear();
+    chunkVisible.clear();
+    occluder.clear();
+    trianglesChanged();
+    invalidateAdjacency();
     // clear bounding box data
     boundingBoxMin = Vec3f(FLT_MAX, FLT_MAX, FLT_MAX);
     boundingBoxMax = Vec3f(-FLT_MAX, -FLT_MAX, -FLT_MAX);
@@ -68,6 +186,19 @@ void TriangleMesh::coutData() {
     std::cout << "  BBMid: (" << boundingBoxMid << ")" << std::endl;
     std::cout << "  BBSize: (" << boundingBoxSize << ")" << std::endl;
     std::cout << "  VAO ID: " << VAO() << ", VBO IDs: f=" << VBOf() << ", v=" << VBOv() << ", n=" << VBOn() << ", c=" << VBOc() << ", t=" << VBOt() << std::endl;
+    std::cout << "vertex layout: ";
+    switch (vertexLayout) {
+        case VertexLayout::SEPARATE: std::cout << "separate"; break;
+        case VertexLayout::INTERLEAVED: std::cout << "interleaved"; break;
+        case VertexLayout::QUANTIZED: std::cout << "quantized"; break;
+    }
+    std::cout << ", " << vertexMemory(vertexLayout) / 1024 << " KB vertex data (" << vertexMemory(VertexLayout::SEPARATE) / 1024 << " KB as floats)" << std::endl;
+    const size_t shortRanges = std::count_if(indexRanges.begin(), indexRanges.end(), [](const IndexRange& range) { return range.type == GL_UNSIGNED_SHORT; });
+    std::cout << "index buffer: " << indexRanges.size() << " range(s), " << shortRanges << " with 16 bit indices, " << getIndexMemory() / 1024 << " KB ("
+              << triangles.size() * sizeof(Triangle) / 1024 << " KB as uint32)" << std::endl;
+    std::cout << "levels of detail: " << triangles.size();
+    for (const LodLevel& lod : lods) std::cout << ", " << lod.triangles.size() << " (error " << lod.error << ")";
+    std::cout << " triangles" << std::endl;
     std::cout << "coloring using: ";
     switch (coloringType) {
         case ColoringType::STATIC_COLOR:
@@ -93,12 +224,30 @@ void TriangleMesh::coutData() {
 void TriangleMesh::flipNormals(bool createVBOs) {
     for (auto& n : normals) n *= -1.0f;
     //correct VBO
-    if (createVBOs && VBOn() != 0) {
-        auto *f = getOpenGLFunctions<QOpenGLFunctions_3_3_Core>();
-        if (!f) return;
+    if (createVBOs) uploadNormals();
+}
+
+void TriangleMesh::uploadNormals() {
+    auto *f = getOpenGLFunctions<QOpenGLFunctions_3_3_Core>();
+    if (!f) return;
+    if (vertexLayout != VertexLayout::SEPARATE && VBOv() != 0) {
+        // the normals are spread over the whole buffer
+        const std::vector<unsigned char> data = interleaveVertices(interleavedFormat(vertexLayout == VertexLayout::QUANTIZED));
+        f->glBindBuffer(GL_ARRAY_BUFFER, VBOv());
+        f->glBufferSubData(GL_ARRAY_BUFFER, 0, data.size(), data.data());
+    } else if (VBOn() != 0) {
         f->glBindBuffer(GL_ARRAY_BUFFER, VBOn());
         f->glBufferSubData(GL_ARRAY_BUFFER, 0, normals.size() * sizeof(Normal), normals.data());
-        f->glBindBuffer(GL_ARRAY_BUFFER, 0);
+    }
+    f->glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void TriangleMesh::setVertexLayout(VertexLayout layout) {
+    if (layout == vertexLayout) return;
+    vertexLayout = layout;
+    if (isResident()) {
+        cleanupVBO();
+        createAllVBOs();
     }
 }
 
@@ -108,6 +257,11 @@ void TriangleMesh::translateToCenter(const Vec3f& newBBmid, bool createVBOs) {
     boundingBoxMin += trans;
     boundingBoxMax += trans;
     boundingBoxMid += trans;
+    for (Chunk& chunk : chunks) {
+        chunk.boundingBoxMin += trans;
+        chunk.boundingBoxMax += trans;
+    }
+    for (auto& vertex : occluder.vertices) vertex += trans;
     // data changed => delete VBOs and create new ones (not efficient but easy)
     if (createVBOs) {
         cleanupVBO();
@@ -123,6 +277,13 @@ void TriangleMesh::scaleToLength(const float newLength, bool createVBOs) {
     boundingBoxMax *= scale;
     boundingBoxMid *= scale;
     boundingBoxSize *= scale;
+    for (Chunk& chunk : chunks) {
+        chunk.boundingBoxMin *= scale;
+        chunk.boundingBoxMax *= scale;
+    }
+    for (auto& vertex : occluder.vertices) vertex *= scale;
+    // the errors are in object units
+    for (LodLevel& lod : lods) lod.error *= scale;
     // data changed => delete VBOs and create new ones (not efficient but easy)
     if (createVBOs) {
         cleanupVBO();
@@ -130,6 +291,149 @@ void TriangleMesh::scaleToLength(const float newLength, bool createVBOs) {
     }
 }
 
+void TriangleMesh::weldVertices(float epsilon, bool keepTexCoordSeams) {
+    if (vertices.empty()) return;
+    const bool compareNormals = normals.size() == vertices.size();
+    const bool compareTexCoords = keepTexCoordSeams && texCoords.size() == vertices.size();
+    auto near = [epsilon](float a, float b) { return std::fabs(a - b) <= epsilon; };
+    auto matches = [&](unsigned int a, unsigned int b) {
+        for (unsigned int k = 0; k < 3; ++k) {
+            if (!near(vertices[a][k], vertices[b][k])) return false;
+            if (compareNormals && !near(normals[a][k], normals[b][k])) return false;
+        }
+        return !compareTexCoords || (near(texCoords[a].u, texCoords[b].u) && near(texCoords[a].v, texCoords[b].v));
+    };
+
+    // grid cells of size epsilon, so every match lies in the 27 cells around a vertex. every cell keeps a
+    // linked list of the group representatives inside it (hash collisions only add candidates).
+    const float cellSize = std::max(epsilon, FLT_MIN);
+    auto cellKey = [](int64_t x, int64_t y, int64_t z) {
+        return uint64_t(x) * 73856093u ^ uint64_t(y) * 19349663u ^ uint64_t(z) * 83492791u;
+    };
+    const unsigned int none = UINT_MAX;
+    std::unordered_map<uint64_t, unsigned int> cells;
+    cells.reserve(vertices.size());
+    std::vector<unsigned int> order;      // old index of every representative
+    std::vector<unsigned int> nextInCell; // next representative in the same cell list
+    std::vector<unsigned int> newIndex(vertices.size());
+    order.reserve(vertices.size());
+    nextInCell.reserve(vertices.size());
+    for (unsigned int v = 0; v < vertices.size(); ++v) {
+        int64_t cell[3];
+        for (unsigned int k = 0; k < 3; ++k) cell[k] = static_cast<int64_t>(std::floor(vertices[v][k] / cellSize));
+        unsigned int found = none;
+        for (int dx = -1; dx <= 1 && found == none; ++dx) {
+            for (int dy = -1; dy <= 1 && found == none; ++dy) {
+                for (int dz = -1; dz <= 1 && found == none; ++dz) {
+                    auto it = cells.find(cellKey(cell[0] + dx, cell[1] + dy, cell[2] + dz));
+                    if (it == cells.end()) continue;
+                    for (unsigned int r = it->second; r != none; r = nextInCell[r]) {
+                        if (matches(order[r], v)) {
+                            found = r;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+        if (found == none) {
+            found = static_cast<unsigned int>(order.size());
+            order.push_back(v);
+            auto inserted = cells.insert(std::make_pair(cellKey(cell[0], cell[1], cell[2]), found));
+            nextInCell.push_back(inserted.second ? none : inserted.first->second);
+            inserted.first->second = found;
+        }
+        newIndex[v] = found;
+    }
+    if (order.size() == vertices.size()) return;
+
+    size_t kept = 0;
+    for (const Triangle& t : triangles) {
+        const Triangle welded(newIndex[t[0]], newIndex[t[1]], newIndex[t[2]]);
+        if (welded[0] == welded[1] || welded[1] == welded[2] || welded[2] == welded[0]) continue;
+        triangles[kept++] = welded;
+    }
+    triangles.resize(kept);
+    trianglesChanged();
+    remapVertices(order);
+    calculateBB();
+}
+
+void TriangleMesh::generateLods(unsigned int maxLevels) {
+    lods.clear();
+    std::vector<size_t> targets;
+    for (unsigned int level = 1; level <= maxLevels && (triangles.size() >> level) >= LodMinTriangles; ++level) {
+        targets.push_back(triangles.size() >> level);
+    }
+    if (targets.empty()) return;
+    std::vector<SimplifiedLevel> levels = simplifyMesh(triangles, vertices, targets);
+    size_t previous = triangles.size();
+    for (SimplifiedLevel& level : levels) {
+        // a level that hardly simplified is not worth its memory
+        if (4 * level.triangles.size() > 3 * previous) break;
+        previous = level.triangles.size();
+        optimizeVertexCache(level.triangles, vertices.size());
+        lods.push_back({ std::move(level.triangles), level.error });
+    }
+}
+
+void TriangleMesh::optimizeVertexOrder() {
+    if (triangles.empty()) return;
+    optimizeVertexCache(triangles, vertices.size());
+    trianglesChanged();
+    remapVertices(optimizeVertexFetch(triangles, vertices.size()));
+}
+
+void TriangleMesh::optimizeOverdraw(float threshold) {
+    if (triangles.empty()) return;
+    ::optimizeOverdraw(triangles, vertices, threshold);
+    trianglesChanged();
+    // the clusters are moved as a whole, so the vertex fetch order only has to be restored
+    remapVertices(optimizeVertexFetch(triangles, vertices.size()));
+}
+
+void TriangleMesh::remapVertices(const std::vector<unsigned int>& order) {
+    const size_t vertexCount = vertices.size();
+    remapAttribute(normals, order, vertexCount);
+    remapAttribute(colors, order, vertexCount);
+    remapAttribute(texCoords, order, vertexCount);
+    remapAttribute(tangents, order, vertexCount);
+    remapAttribute(vertices, order, vertexCount);
+    // the adjacency, the levels of detail and the chunks refer to the old vertex numbers and triangle order
+    invalidateAdjacency();
+    lods.clear();
+    chunks.clear();
+}
+
+void TriangleMesh::takeGeometry(TriangleMesh&& other) {
+    cleanupVBO();
+    vertices = std::move(other.vertices);
+    normals = std::move(other.normals);
+    triangles = std::move(other.triangles);
+    colors = std::move(other.colors);
+    texCoords = std::move(other.texCoords);
+    tangents = std::move(other.tangents);
+    // the adjacency of other stays valid for its triangles
+    const bool adjacencyValid = other.hasVertexFaceAdjacency();
+    vertexFaceOffsets = std::move(other.vertexFaceOffsets);
+    vertexFaces = std::move(other.vertexFaces);
+    trianglesChanged();
+    if (adjacencyValid) adjacencyGeneration = triangleGeneration;
+    else invalidateAdjacency();
+    lods = std::move(other.lods);
+    chunks = std::move(other.chunks);
+    occluder = std::move(other.occluder);
+    boundingBoxMin = other.boundingBoxMin;
+    boundingBoxMax = other.boundingBoxMax;
+    boundingBoxMid = other.boundingBoxMid;
+    boundingBoxSize = other.boundingBoxSize;
+    other.clear();
+}
+
+void TriangleMesh::uploadToGPU() {
+    if (isCPUReady()) createAllVBOs();
+}
+
 // =================
 // === LOAD MESH ===
 // =================
@@ -137,11 +441,326 @@ void TriangleMesh::scaleToLength(const float newLength, bool createVBOs) {
 void TriangleMesh::loadOFF(const char* filename, bool createVBOs) {
     // clear any existing mesh
     clear();
-    // load from off
+    // load from cache or off
+    if (!loadOFFData(filename, true)) return;
+    // createVBO
+    if (createVBOs) {
+        createAllVBOs();
+    }
+}
+
+bool TriangleMesh::loadOFFData(const char* filename, bool useCache) {
+    const std::string cacheFilename = std::string(filename) + MeshCacheExtension;
+    if (useCache && readMeshCache(filename, cacheFilename.c_str())) return true;
+    if (!readOFFMapped(filename, ThreadPool::global().getNumThreads())) return false;
+    // merge duplicated positions, they would split the normals
+    weldVertices();
+    // calculate normals if not given
+    if (normals.size() != vertices.size()) calculateNormalsByArea();
+    // calculate texture coordinates
+    calculateTexCoordsSphereMapping();
+    optimizeVertexOrder();
+    generateLods();
+    if (useCache && !writeMeshCache(filename, cacheFilename.c_str())) {
+        std::cout << "loadOFF: can not write cache " << cacheFilename << std::endl;
+    }
+    return true;
+}
+
+bool TriangleMesh::readMeshCache(const char* sourceFilename, const char* cacheFilename) {
+    QFileInfo sourceInfo(sourceFilename);
+    if (!sourceInfo.exists()) return false;
+    QFile file(cacheFilename);
+    if (!file.open(QFile::ReadOnly)) return false;
+    const qint64 fileSize = file.size();
+    if (fileSize < static_cast<qint64>(sizeof(MeshCacheHeader))) return false;
+    uchar* mapped = file.map(0, fileSize);
+    if (!mapped) return false;
+    MeshCacheHeader header;
+    std::memcpy(&header, mapped, sizeof(header));
+    const qint64 expectedSize = sizeof(MeshCacheHeader)
+        + static_cast<qint64>(header.numVertices) * sizeof(Vertex)
+        + static_cast<qint64>(header.numNormals) * sizeof(Normal)
+        + static_cast<qint64>(header.numTexCoords) * sizeof(TexCoord)
+        + static_cast<qint64>(header.numTangents) * sizeof(Tangent)
+        + static_cast<qint64>(header.numTriangles) * sizeof(Triangle);
+    qint64 lodSize = 0;
+    for (unsigned int i = 0; i < std::min<uint32_t>(header.numLods, MeshCacheMaxLods); ++i) {
+        lodSize += static_cast<qint64>(header.numLodTriangles[i]) * sizeof(Triangle);
+    }
+    if (std::memcmp(header.magic, MeshCacheMagic, sizeof(header.magic)) != 0
+        || header.version != MeshCacheVersion
+        || header.sourceModified != sourceInfo.lastModified().toMSecsSinceEpoch()
+        || header.sourceSize != sourceInfo.size()
+        || header.numLods > MeshCacheMaxLods
+        || expectedSize + lodSize != fileSize) {
+        file.unmap(mapped);
+        return false;
+    }
+    // the arrays follow the header without padding, copy them straight out of the mapping
+    const uchar* p = mapped + sizeof(MeshCacheHeader);
+    const Vertex* vertexData = reinterpret_cast<const Vertex*>(p);
+    vertices.assign(vertexData, vertexData + header.numVertices);
+    p += header.numVertices * sizeof(Vertex);
+    const Normal* normalData = reinterpret_cast<const Normal*>(p);
+    normals.assign(normalData, normalData + header.numNormals);
+    p += header.numNormals * sizeof(Normal);
+    const TexCoord* texCoordData = reinterpret_cast<const TexCoord*>(p);
+    texCoords.assign(texCoordData, texCoordData + header.numTexCoords);
+    p += header.numTexCoords * sizeof(TexCoord);
+    const Tangent* tangentData = reinterpret_cast<const Tangent*>(p);
+    tangents.assign(tangentData, tangentData + header.numTangents);
+    p += header.numTangents * sizeof(Tangent);
+    const Triangle* triangleData = reinterpret_cast<const Triangle*>(p);
+    triangles.assign(triangleData, triangleData + header.numTriangles);
+    trianglesChanged();
+    p += header.numTriangles * sizeof(Triangle);
+    lods.resize(header.numLods);
+    for (unsigned int i = 0; i < header.numLods; ++i) {
+        const Triangle* lodData = reinterpret_cast<const Triangle*>(p);
+        lods[i].triangles.assign(lodData, lodData + header.numLodTriangles[i]);
+        lods[i].error = header.lodErrors[i];
+        p += header.numLodTriangles[i] * sizeof(Triangle);
+    }
+    file.unmap(mapped);
+
+    boundingBoxMin = Vec3f(header.boundingBoxMin[0], header.boundingBoxMin[1], header.boundingBoxMin[2]);
+    boundingBoxMax = Vec3f(header.boundingBoxMax[0], header.boundingBoxMax[1], header.boundingBoxMax[2]);
+    boundingBoxMid = 0.5f*boundingBoxMin + 0.5f*boundingBoxMax;
+    boundingBoxSize = boundingBoxMax - boundingBoxMin;
+    return true;
+}
+
+bool TriangleMesh::writeMeshCache(const char* sourceFilename, const char* cacheFilename) const {
+    QFileInfo sourceInfo(sourceFilename);
+    MeshCacheHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, MeshCacheMagic, sizeof(header.magic));
+    header.version = MeshCacheVersion;
+    header.sourceModified = sourceInfo.lastModified().toMSecsSinceEpoch();
+    header.sourceSize = sourceInfo.size();
+    header.numVertices = vertices.size();
+    header.numNormals = normals.size();
+    header.numTexCoords = texCoords.size();
+    header.numTangents = tangents.size();
+    header.numTriangles = triangles.size();
+    header.numLods = std::min<size_t>(lods.size(), MeshCacheMaxLods);
+    for (unsigned int i = 0; i < header.numLods; ++i) {
+        header.numLodTriangles[i] = lods[i].triangles.size();
+        header.lodErrors[i] = lods[i].error;
+    }
+    for (int i = 0; i < 3; ++i) {
+        header.boundingBoxMin[i] = boundingBoxMin[i];
+        header.boundingBoxMax[i] = boundingBoxMax[i];
+    }
+    QFile file(cacheFilename);
+    if (!file.open(QFile::WriteOnly)) return false;
+    bool success = file.write(reinterpret_cast<const char*>(&header), sizeof(header)) == sizeof(header);
+    const std::pair<const void*, qint64> arrays[] = {
+        { vertices.data(), vertices.size() * sizeof(Vertex) },
+        { normals.data(), normals.size() * sizeof(Normal) },
+        { texCoords.data(), texCoords.size() * sizeof(TexCoord) },
+        { tangents.data(), tangents.size() * sizeof(Tangent) },
+        { triangles.data(), triangles.size() * sizeof(Triangle) },
+    };
+    for (const auto& array : arrays) {
+        if (success && array.second > 0) success = file.write(static_cast<const char*>(array.first), array.second) == array.second;
+    }
+    for (unsigned int i = 0; i < header.numLods; ++i) {
+        const qint64 size = lods[i].triangles.size() * sizeof(Triangle);
+        if (success && size > 0) success = file.write(reinterpret_cast<const char*>(lods[i].triangles.data()), size) == size;
+    }
+    file.close();
+    // never leave a truncated cache behind
+    if (!success) QFile::remove(cacheFilename);
+    return success;
+}
+
+bool TriangleMesh::readOFFMapped(const char* filename, unsigned int maxThreads) {
+    QFile file(filename);
+    if (!file.open(QFile::ReadOnly)) {
+        std::cout << "loadOFF: can not find " << filename << std::endl;
+        return false;
+    }
+    const qint64 fileSize = file.size();
+    uchar* mapped = fileSize > 0 ? file.map(0, fileSize) : nullptr;
+    if (!mapped) {
+        std::cout << "loadOFF: can not map " << filename << std::endl;
+        return false;
+    }
+    const char* p = reinterpret_cast<const char*>(mapped);
+    const char* end = p + fileSize;
+
+    // differentiate between OFF (vertices only) and NOFF (vertices and normals)
+    const int MAX = 256;
+    char s[MAX];
+    p = parseWord(p, end, s, MAX);
+    bool noff = false;
+    if (p && s[0] == 'O' && s[1] == 'F' && s[2] == 'F')
+        ;
+    else if (p && s[0] == 'N' && s[1] == 'O' && s[2] == 'F' && s[3] == 'F')
+        noff = true;
+    else
+        p = nullptr;
+    // get number of vertices nv, faces nf and edges ne
+    unsigned int nv = 0, nf = 0, ne = 0;
+    if (p) p = parseUInt(p, end, nv);
+    if (p) p = parseUInt(p, end, nf);
+    if (p) p = parseUInt(p, end, ne);
+    if (!p || nv == 0 || nf == 0) {
+        file.unmap(mapped);
+        return false;
+    }
+    vertices.resize(nv);
+    if (noff) normals.resize(nv);
+    triangles.resize(nf);
+    trianglesChanged();
+    // read vertices and triangles. files that do not have one element per line fall back to the sequential tokenizer.
+    bool success = false;
+    if (maxThreads > 1 && fileSize >= ParallelLoadMinBytes) {
+        success = readOFFBodyParallel(skipLine(p, end), end, noff, maxThreads);
+    }
+    if (!success) success = readOFFBody(p, end, noff);
+    file.unmap(mapped);
+    if (!success) {
+        std::cout << "loadOFF: " << filename << " is malformed" << std::endl;
+        clear();
+        return false;
+    }
+    boundingBoxMid = 0.5f*boundingBoxMin + 0.5f*boundingBoxMax;
+    boundingBoxSize = boundingBoxMax - boundingBoxMin;
+    return true;
+}
+
+bool TriangleMesh::readOFFBody(const char* p, const char* end, bool noff) {
+    const unsigned int nv = vertices.size(), nf = triangles.size();
+    boundingBoxMin = Vec3f(FLT_MAX, FLT_MAX, FLT_MAX);
+    boundingBoxMax = Vec3f(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    // read vertices
+    for (unsigned int i = 0; i < nv && p; ++i) {
+        Vertex& v = vertices[i];
+        p = parseFloat(p, end, v[0]);
+        if (p) p = parseFloat(p, end, v[1]);
+        if (p) p = parseFloat(p, end, v[2]);
+        if (!p) break;
+        boundingBoxMin[0] = std::min(v[0], boundingBoxMin[0]);
+        boundingBoxMin[1] = std::min(v[1], boundingBoxMin[1]);
+        boundingBoxMin[2] = std::min(v[2], boundingBoxMin[2]);
+        boundingBoxMax[0] = std::max(v[0], boundingBoxMax[0]);
+        boundingBoxMax[1] = std::max(v[1], boundingBoxMax[1]);
+        boundingBoxMax[2] = std::max(v[2], boundingBoxMax[2]);
+        if (noff) {
+            p = parseFloat(p, end, normals[i][0]);
+            if (p) p = parseFloat(p, end, normals[i][1]);
+            if (p) p = parseFloat(p, end, normals[i][2]);
+        }
+    }
+    // read triangles. everything behind the three indices (e.g. face colors) is skipped.
+    for (unsigned int i = 0; i < nf && p; ++i) {
+        unsigned int three;
+        Triangle& t = triangles[i];
+        p = parseUInt(p, end, three);
+        if (p) p = parseUInt(p, end, t[0]);
+        if (p) p = parseUInt(p, end, t[1]);
+        if (p) p = parseUInt(p, end, t[2]);
+        if (p && (t[0] >= nv || t[1] >= nv || t[2] >= nv)) p = nullptr;
+        if (p) p = skipLine(p, end);
+    }
+    return p != nullptr;
+}
+
+bool TriangleMesh::readOFFBodyParallel(const char* body, const char* end, bool noff, unsigned int maxThreads) {
+    const size_t nv = vertices.size(), nf = triangles.size();
+    // split into chunks that start at a line start. a few chunks per thread balance uneven line lengths.
+    const unsigned int numChunks = 4 * maxThreads;
+    const size_t bodySize = end - body;
+    std::vector<const char*> chunkBegin(numChunks + 1, end);
+    for (unsigned int c = 0; c < numChunks; ++c) {
+        const char* pos = body + bodySize * c / numChunks;
+        if (pos != body && pos[-1] != '\n') pos = skipLine(pos, end);
+        chunkBegin[c] = std::max(pos, c > 0 ? chunkBegin[c - 1] : body);
+    }
+    // pass 1: count lines per chunk to get the index of the first line of every chunk
+    std::vector<size_t> chunkFirstLine(numChunks + 1, 0);
+    ThreadPool::global().parallelFor(numChunks, [&](unsigned int c) {
+        const char* p = chunkBegin[c];
+        const char* chunkEnd = chunkBegin[c + 1];
+        size_t lines = 0;
+        while (p != chunkEnd) {
+            const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', chunkEnd - p));
+            ++lines;
+            p = lineEnd ? lineEnd + 1 : chunkEnd;
+        }
+        chunkFirstLine[c + 1] = lines;
+    });
+    for (unsigned int c = 0; c < numChunks; ++c) chunkFirstLine[c + 1] += chunkFirstLine[c];
+    if (chunkFirstLine[numChunks] < nv + nf) return false;
+
+    // pass 2: parse line i as vertex i (i < nv) or face i - nv. every chunk has its own bounding box.
+    std::vector<Vec3f> chunkMin(numChunks, Vec3f(FLT_MAX, FLT_MAX, FLT_MAX));
+    std::vector<Vec3f> chunkMax(numChunks, Vec3f(-FLT_MAX, -FLT_MAX, -FLT_MAX));
+    std::vector<char> chunkValid(numChunks, 1);
+    ThreadPool::global().parallelFor(numChunks, [&](unsigned int c) {
+        Vec3f bbMin = chunkMin[c], bbMax = chunkMax[c];
+        const char* p = chunkBegin[c];
+        const char* chunkEnd = chunkBegin[c + 1];
+        bool valid = true;
+        for (size_t line = chunkFirstLine[c]; p != chunkEnd && line < nv + nf && valid; ++line) {
+            const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', chunkEnd - p));
+            if (!lineEnd) lineEnd = chunkEnd;
+            const char* q = p;
+            if (line < nv) {
+                Vertex& v = vertices[line];
+                q = parseFloat(q, lineEnd, v[0]);
+                if (q) q = parseFloat(q, lineEnd, v[1]);
+                if (q) q = parseFloat(q, lineEnd, v[2]);
+                if (q && noff) {
+                    q = parseFloat(q, lineEnd, normals[line][0]);
+                    if (q) q = parseFloat(q, lineEnd, normals[line][1]);
+                    if (q) q = parseFloat(q, lineEnd, normals[line][2]);
+                }
+                if (q) {
+                    bbMin[0] = std::min(v[0], bbMin[0]);
+                    bbMin[1] = std::min(v[1], bbMin[1]);
+                    bbMin[2] = std::min(v[2], bbMin[2]);
+                    bbMax[0] = std::max(v[0], bbMax[0]);
+                    bbMax[1] = std::max(v[1], bbMax[1]);
+                    bbMax[2] = std::max(v[2], bbMax[2]);
+                }
+            } else {
+                unsigned int three;
+                Triangle& t = triangles[line - nv];
+                q = parseUInt(q, lineEnd, three);
+                if (q) q = parseUInt(q, lineEnd, t[0]);
+                if (q) q = parseUInt(q, lineEnd, t[1]);
+                if (q) q = parseUInt(q, lineEnd, t[2]);
+                if (q && (t[0] >= nv || t[1] >= nv || t[2] >= nv)) q = nullptr;
+            }
+            valid = q != nullptr;
+            p = lineEnd == chunkEnd ? chunkEnd : lineEnd + 1;
+        }
+        chunkMin[c] = bbMin;
+        chunkMax[c] = bbMax;
+        chunkValid[c] = valid;
+    });
+    // reduce bounding boxes of all chunks
+    boundingBoxMin = Vec3f(FLT_MAX, FLT_MAX, FLT_MAX);
+    boundingBoxMax = Vec3f(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+    for (unsigned int c = 0; c < numChunks; ++c) {
+        if (!chunkValid[c]) return false;
+        for (int i = 0; i < 3; ++i) {
+            boundingBoxMin[i] = std::min(chunkMin[c][i], boundingBoxMin[i]);
+            boundingBoxMax[i] = std::max(chunkMax[c][i], boundingBoxMax[i]);
+        }
+    }
+    return true;
+}
+
+bool TriangleMesh::readOFFStream(const char* filename) {
     std::ifstream in(filename);
     if (!in.is_open()) {
         std::cout << "loadOFF: can not find " << filename << std::endl;
-        return;
+        return false;
     }
     const int MAX = 256;
     char s[MAX];
@@ -153,15 +772,16 @@ void TriangleMesh::loadOFF(const char* filename, bool createVBOs) {
     else if (s[0] == 'N' && s[1] == 'O' && s[2] == 'F' && s[3] == 'F')
         noff = true;
     else
-        return;
+        return false;
     // get number of vertices nv, faces nf and edges ne
     int nv,nf,ne;
     in >> std::setw(MAX) >> nv;
     in >> std::setw(MAX) >> nf;
     in >> std::setw(MAX) >> ne;
-    if (nv <= 0 || nf <= 0) return;
+    if (nv <= 0 || nf <= 0) return false;
     // read vertices
     vertices.resize(nv);
+    if (noff) normals.resize(nv);
     for (int i = 0; i < nv; ++i) {
         in >> std::setw(MAX) >> vertices[i][0];
         in >> std::setw(MAX) >> vertices[i][1];
@@ -182,6 +802,7 @@ void TriangleMesh::loadOFF(const char* filename, bool createVBOs) {
     boundingBoxSize = boundingBoxMax - boundingBoxMin;
     // read triangles
     triangles.resize(nf);
+    trianglesChanged();
     for (int i = 0; i < nf; ++i) {
         int three;
         in >> std::setw(MAX) >> three;
@@ -191,14 +812,120 @@ void TriangleMesh::loadOFF(const char* filename, bool createVBOs) {
     }
     // close ifstream
     in.close();
-    // calculate normals if not given
-    if (!noff) calculateNormalsByArea();
-    // calculate texture coordinates
-    calculateTexCoordsSphereMapping();
-    // createVBO
-    if (createVBOs) {
-        createAllVBOs();
+    return true;
+}
+
+void TriangleMesh::benchmarkLoadOFF(const char* filename, int runs) {
+    typedef std::chrono::steady_clock Clock;
+    const unsigned int threads = ThreadPool::global().getNumThreads();
+    TriangleMesh streamMesh, mappedMesh, parallelMesh;
+    double streamSeconds = 0.0, mappedSeconds = 0.0, parallelSeconds = 0.0;
+    for (int run = 0; run < runs; ++run) {
+        streamMesh.clear();
+        auto begin = Clock::now();
+        if (!streamMesh.readOFFStream(filename)) return;
+        streamSeconds += std::chrono::duration<double>(Clock::now() - begin).count();
+
+        mappedMesh.clear();
+        begin = Clock::now();
+        if (!mappedMesh.readOFFMapped(filename, 1)) return;
+        mappedSeconds += std::chrono::duration<double>(Clock::now() - begin).count();
+
+        parallelMesh.clear();
+        begin = Clock::now();
+        if (!parallelMesh.readOFFMapped(filename, threads)) return;
+        parallelSeconds += std::chrono::duration<double>(Clock::now() - begin).count();
     }
+    // all readers have to produce the same mesh. the meshes are only compared element by element if their sizes
+    // agree, NaNs count as mismatches since they compare unequal to everything.
+    auto same = [](const Vec3f& a, const Vec3f& b) { return a[0] == b[0] && a[1] == b[1] && a[2] == b[2]; };
+    size_t mismatches = 0;
+    const bool sizesMatch = streamMesh.vertices.size() == mappedMesh.vertices.size() && streamMesh.vertices.size() == parallelMesh.vertices.size()
+        && streamMesh.triangles.size() == mappedMesh.triangles.size() && streamMesh.triangles.size() == parallelMesh.triangles.size();
+    if (sizesMatch) {
+        for (size_t i = 0; i < streamMesh.vertices.size(); ++i) {
+            if (!same(streamMesh.vertices[i], mappedMesh.vertices[i]) || !same(streamMesh.vertices[i], parallelMesh.vertices[i])) mismatches++;
+        }
+        for (size_t i = 0; i < streamMesh.triangles.size(); ++i) {
+            const Triangle& a = streamMesh.triangles[i];
+            const Triangle& b = mappedMesh.triangles[i];
+            const Triangle& c = parallelMesh.triangles[i];
+            if (a[0] != b[0] || a[1] != b[1] || a[2] != b[2] || a[0] != c[0] || a[1] != c[1] || a[2] != c[2]) mismatches++;
+        }
+        if (!same(streamMesh.boundingBoxMin, parallelMesh.boundingBoxMin) || !same(streamMesh.boundingBoxMax, parallelMesh.boundingBoxMax)) mismatches++;
+    }
+    std::cout << filename << ": " << mappedMesh.getNumVertices() << " vertices, " << mappedMesh.getNumTriangles() << " triangles" << std::endl;
+    std::cout << "  ifstream:          " << 1000.0 * streamSeconds / runs << " ms" << std::endl;
+    std::cout << "  mapped:            " << 1000.0 * mappedSeconds / runs << " ms (" << streamSeconds / mappedSeconds << "x)" << std::endl;
+    std::cout << "  mapped, " << threads << " threads: " << 1000.0 * parallelSeconds / runs << " ms (" << streamSeconds / parallelSeconds << "x)" << std::endl;
+    if (!sizesMatch) {
+        std::cout << "  WARNING: the readers disagree on the size: " << streamMesh.vertices.size() << "/" << mappedMesh.vertices.size() << "/"
+                  << parallelMesh.vertices.size() << " vertices, " << streamMesh.triangles.size() << "/" << mappedMesh.triangles.size() << "/"
+                  << parallelMesh.triangles.size() << " triangles (ifstream/mapped/parallel)" << std::endl;
+    }
+    if (mismatches > 0) std::cout << "  WARNING: " << mismatches << " elements differ between the readers" << std::endl;
+
+    // complete loadOFF with normal and texture coordinate computation, with and without binary cache
+    TriangleMesh parsedMesh, cachedMesh;
+    double uncachedSeconds = 0.0, cachedSeconds = 0.0;
+    if (!cachedMesh.loadOFFData(filename, true)) return;
+    for (int run = 0; run < runs; ++run) {
+        parsedMesh.clear();
+        auto begin = Clock::now();
+        parsedMesh.loadOFFData(filename, false);
+        uncachedSeconds += std::chrono::duration<double>(Clock::now() - begin).count();
+
+        cachedMesh.clear();
+        begin = Clock::now();
+        cachedMesh.loadOFFData(filename, true);
+        cachedSeconds += std::chrono::duration<double>(Clock::now() - begin).count();
+    }
+    const bool cacheMatches = parsedMesh.vertices.size() == cachedMesh.vertices.size()
+        && parsedMesh.triangles.size() == cachedMesh.triangles.size()
+        && parsedMesh.normals.size() == cachedMesh.normals.size()
+        && parsedMesh.texCoords.size() == cachedMesh.texCoords.size()
+        && std::memcmp(parsedMesh.vertices.data(), cachedMesh.vertices.data(), parsedMesh.vertices.size() * sizeof(Vertex)) == 0
+        && std::memcmp(parsedMesh.triangles.data(), cachedMesh.triangles.data(), parsedMesh.triangles.size() * sizeof(Triangle)) == 0
+        && std::memcmp(parsedMesh.normals.data(), cachedMesh.normals.data(), parsedMesh.normals.size() * sizeof(Normal)) == 0
+        && std::memcmp(parsedMesh.texCoords.data(), cachedMesh.texCoords.data(), parsedMesh.texCoords.size() * sizeof(TexCoord)) == 0;
+    std::cout << "  loadOFF, parsed:   " << 1000.0 * uncachedSeconds / runs << " ms" << std::endl;
+    std::cout << "  loadOFF, cached:   " << 1000.0 * cachedSeconds / runs << " ms (" << uncachedSeconds / cachedSeconds << "x)" << std::endl;
+    if (!cacheMatches) std::cout << "  WARNING: cached mesh differs from the parsed one" << std::endl;
+}
+
+void TriangleMesh::benchmarkMeshOptimizer(const char* filename) {
+    typedef std::chrono::steady_clock Clock;
+    TriangleMesh mesh;
+    if (!mesh.readOFFMapped(filename, ThreadPool::global().getNumThreads())) return;
+    std::cout << filename << ": " << mesh.getNumVertices() << " vertices, " << mesh.getNumTriangles() << " triangles" << std::endl;
+    const size_t vertexCount = mesh.vertices.size(), triangleCount = mesh.triangles.size();
+    auto begin = Clock::now();
+    mesh.weldVertices();
+    const double weldMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    std::cout << "  weldVertices:        " << vertexCount << " -> " << mesh.vertices.size() << " vertices, "
+              << triangleCount - mesh.triangles.size() << " degenerate triangles removed (" << weldMilliseconds << " ms)" << std::endl;
+    const VertexCacheStatistics before = analyzeVertexCache(mesh.triangles, mesh.vertices.size());
+    begin = Clock::now();
+    mesh.optimizeVertexOrder();
+    const double vertexOrderMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    const VertexCacheStatistics after = analyzeVertexCache(mesh.triangles, mesh.vertices.size());
+    std::cout << "  optimizeVertexOrder: ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr
+              << " (" << vertexOrderMilliseconds << " ms)" << std::endl;
+
+    const OverdrawStatistics overdrawBefore = analyzeOverdraw(mesh.triangles, mesh.vertices);
+    begin = Clock::now();
+    mesh.optimizeOverdraw();
+    const double overdrawMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    const OverdrawStatistics overdrawAfter = analyzeOverdraw(mesh.triangles, mesh.vertices);
+    std::cout << "  optimizeOverdraw:    overdraw " << overdrawBefore.overdraw << " -> " << overdrawAfter.overdraw
+              << ", ACMR " << analyzeVertexCache(mesh.triangles, mesh.vertices.size()).acmr << " (" << overdrawMilliseconds << " ms)" << std::endl;
+
+    begin = Clock::now();
+    mesh.generateLods();
+    const double lodMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    std::cout << "  generateLods:        " << mesh.triangles.size();
+    for (const LodLevel& lod : mesh.lods) std::cout << " -> " << lod.triangles.size() << " (error " << lod.error << ")";
+    std::cout << " triangles (" << lodMilliseconds << " ms)" << std::endl;
 }
 
 void TriangleMesh::loadOFF(const char* filename, const Vec3f& BBmid, const float BBlength) {
@@ -207,9 +934,76 @@ void TriangleMesh::loadOFF(const char* filename, const Vec3f& BBmid, const float
     scaleToLength(BBlength, true);
 }
 
+NormalKernel TriangleMesh::normalKernel = bestNormalKernel();
+
+void TriangleMesh::setNormalKernel(NormalKernel kernel) {
+    normalKernel = normalKernelSupported(kernel) ? kernel : NormalKernel::SCALAR;
+}
+
+void TriangleMesh::benchmarkNormals(const char* filename, int runs) {
+    typedef std::chrono::steady_clock Clock;
+    TriangleMesh mesh;
+    if (!mesh.readOFFMapped(filename, ThreadPool::global().getNumThreads())) return;
+    std::cout << filename << ": " << mesh.getNumVertices() << " vertices, " << mesh.getNumTriangles() << " triangles" << std::endl;
+    const NormalKernel previous = normalKernel;
+    Normals reference;
+    double scalarSeconds = 0.0;
+    // times one variant and compares its normals to the scalar scatter loop
+    auto measure = [&](const std::string& name, const std::function<void()>& calculate) {
+        double seconds = 0.0;
+        for (int run = 0; run < runs; ++run) {
+            mesh.normals.clear();
+            const auto begin = Clock::now();
+            calculate();
+            seconds += std::chrono::duration<double>(Clock::now() - begin).count();
+        }
+        if (reference.empty()) {
+            scalarSeconds = seconds;
+            reference = mesh.normals;
+        }
+        const bool identical = std::memcmp(reference.data(), mesh.normals.data(), reference.size() * sizeof(Normal)) == 0;
+        std::cout << "  " << std::setw(20) << std::left << name << std::right << 1000.0 * seconds / runs << " ms ("
+                  << scalarSeconds / seconds << "x)" << (identical ? "" : ", WARNING: differs from scalar") << std::endl;
+    };
+    for (NormalKernel kernel : { NormalKernel::SCALAR, NormalKernel::SSE, NormalKernel::AVX2 }) {
+        if (!normalKernelSupported(kernel)) {
+            std::cout << "  " << normalKernelName(kernel) << ": not supported" << std::endl;
+            continue;
+        }
+        normalKernel = kernel;
+        measure(std::string(normalKernelName(kernel)) + ":", [&mesh] { mesh.accumulateNormals(); });
+    }
+    normalKernel = previous;
+
+    // gather over the vertex -> face adjacency, which is built once per mesh
+    auto begin = Clock::now();
+    mesh.buildVertexFaceAdjacency();
+    std::cout << "  adjacency:          " << 1000.0 * std::chrono::duration<double>(Clock::now() - begin).count() << " ms, "
+              << (mesh.vertexFaceOffsets.size() + mesh.vertexFaces.size()) * sizeof(unsigned int) / 1024 << " KB" << std::endl;
+    const unsigned int threads = ThreadPool::global().getNumThreads();
+    measure("gather, 1 thread:", [&mesh] { mesh.calculateNormalsParallel(1); });
+    if (threads > 1) measure("gather, " + std::to_string(threads) + " threads:", [&mesh, threads] { mesh.calculateNormalsParallel(threads); });
+}
+
 void TriangleMesh::calculateNormalsByArea() {
+    const unsigned int threads = ThreadPool::global().getNumThreads();
+    if (threads > 1 && triangles.size() >= ParallelNormalsMinTriangles) calculateNormalsParallel(threads);
+    else accumulateNormals();
+}
+
+void TriangleMesh::accumulateNormals() {
     // sum up triangle normals in each vertex
-    normals.resize(vertices.size());
+    normals.assign(vertices.size(), Normal());
+    if (normalKernel != NormalKernel::SCALAR) {
+        // padded positions and sums, see NormalKernels.h
+        std::vector<float> padded(8 * vertices.size(), 0.f);
+        float* paddedPositions = padded.data();
+        float* paddedNormals = padded.data() + 4 * vertices.size();
+        padVertices(reinterpret_cast<const float*>(vertices.data()), 0, vertices.size(), paddedPositions);
+        accumulateFaceNormals(normalKernel, paddedPositions, reinterpret_cast<const unsigned int*>(triangles.data()), 0, triangles.size(), paddedNormals);
+        normalizeNormals(normalKernel, paddedNormals, 0, normals.size(), EPS, reinterpret_cast<float*>(normals.data()));
+        return;
+    }
     for (auto& triangle : triangles) {
         unsigned int
             id0 = triangle[0],
@@ -227,6 +1021,64 @@ void TriangleMesh::calculateNormalsByArea() {
     for (auto& normal : normals) normal.normalize();
 }
 
+void TriangleMesh::calculateNormalsParallel(unsigned int maxThreads) {
+    if (!hasVertexFaceAdjacency()) buildVertexFaceAdjacency();
+    const size_t numVertices = vertices.size();
+    const size_t numTriangles = triangles.size();
+    normals.resize(numVertices);
+    // padded positions, face normals and vertex sums, see NormalKernels.h
+    std::vector<float> padded(4 * (2 * numVertices + numTriangles));
+    float* paddedPositions = padded.data();
+    float* faceNormals = paddedPositions + 4 * numVertices;
+    float* sums = faceNormals + 4 * numTriangles;
+    const NormalKernel kernel = normalKernel;
+    // every chunk only writes its own range, so the chunking has no influence on the result
+    const unsigned int numChunks = 4 * maxThreads;
+    auto forChunks = [numChunks, maxThreads](size_t count, const std::function<void(size_t, size_t)>& task) {
+        if (maxThreads <= 1) return task(0, count);
+        ThreadPool::global().parallelFor(numChunks, [&](unsigned int i) { task(count * i / numChunks, count * (i + 1) / numChunks); });
+    };
+    forChunks(numVertices, [&](size_t begin, size_t end) {
+        padVertices(reinterpret_cast<const float*>(vertices.data()), begin, end, paddedPositions);
+    });
+    forChunks(numTriangles, [&](size_t begin, size_t end) {
+        computeFaceNormals(kernel, paddedPositions, reinterpret_cast<const unsigned int*>(triangles.data()), begin, end, faceNormals);
+    });
+    forChunks(numVertices, [&](size_t begin, size_t end) {
+        gatherFaceNormals(kernel, faceNormals, vertexFaceOffsets.data(), vertexFaces.data(), begin, end, sums);
+        normalizeNormals(kernel, sums, begin, end, EPS, reinterpret_cast<float*>(normals.data()));
+    });
+}
+
+void TriangleMesh::buildVertexFaceAdjacency() {
+    // counting sort of all triangle corners by vertex, keeps the faces of each vertex in ascending order
+    vertexFaceOffsets.assign(vertices.size() + 1, 0);
+    for (const auto& triangle : triangles) {
+        for (unsigned int corner = 0; corner < 3; ++corner) vertexFaceOffsets[triangle[corner] + 1]++;
+    }
+    for (size_t v = 0; v < vertices.size(); ++v) vertexFaceOffsets[v + 1] += vertexFaceOffsets[v];
+    vertexFaces.resize(3 * triangles.size());
+    std::vector<unsigned int> next(vertexFaceOffsets.begin(), vertexFaceOffsets.end() - 1);
+    for (unsigned int t = 0; t < triangles.size(); ++t) {
+        for (unsigned int corner = 0; corner < 3; ++corner) vertexFaces[next[triangles[t][corner]]++] = t;
+    }
+    adjacencyGeneration = triangleGeneration;
+}
+
+bool TriangleMesh::hasVertexFaceAdjacency() const {
+    return adjacencyGeneration == triangleGeneration && vertexFaceOffsets.size() == vertices.size() + 1 && vertexFaces.size() == 3 * triangles.size();
+}
+
+void TriangleMesh::invalidateAdjacency() {
+    vertexFaceOffsets.clear();
+    vertexFaces.clear();
+}
+
+void TriangleMesh::recalculateNormals(bool createVBOs) {
+    calculateNormalsByArea();
+    if (createVBOs) uploadNormals();
+}
+
 void TriangleMesh::calculateTexCoordsSphereMapping() {
     texCoords.clear();
     // texCoords by central projection on unit sphere
@@ -326,26 +1178,35 @@ void TriangleMesh::createAllVBOs() {
     // create VAOs
     f->glGenVertexArrays(1, &VAO.val);
 
-    // create VBOs
-    VBOf.val = createVBO(f, triangles.data(), triangles.size() * sizeof(Triangle), GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW);
+    // create VBOs and bind them to the VAO, which keeps the element buffer and the attribute pointers
+    const std::vector<unsigned char> indices = buildIndexBuffer();
+    VBOf.val = createVBO(f, indices.data(), indices.size(), GL_ELEMENT_ARRAY_BUFFER, GL_STATIC_DRAW);
+    f->glBindVertexArray(VAO.val);
+    f->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, VBOf.val);
+    if (vertexLayout == VertexLayout::SEPARATE) createSeparateVBOs(f);
+    else createInterleavedVBO(f);
+    f->glBindVertexArray(0);
+    f->glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+    createBBVAO(f);
+
+    createNormalVAO(f);
+}
+
+void TriangleMesh::createSeparateVBOs(QOpenGLFunctions_3_3_Core* f) {
     VBOv.val = createVBO(f, vertices.data(), vertices.size() * sizeof(Vertex), GL_ARRAY_BUFFER, GL_STATIC_DRAW);
     VBOn.val = createVBO(f, normals.data(), normals.size() * sizeof(Normal), GL_ARRAY_BUFFER, GL_STATIC_DRAW);
     if (colors.size() == vertices.size()) {
         VBOc.val = createVBO(f, colors.data(), colors.size() * sizeof(Color), GL_ARRAY_BUFFER, GL_STATIC_DRAW);
-        f->glEnableVertexAttribArray(COLOR_LOCATION);
     }
     if (texCoords.size() == vertices.size()) {
         VBOt.val = createVBO(f, texCoords.data(), texCoords.size() * sizeof(TexCoord), GL_ARRAY_BUFFER, GL_STATIC_DRAW);
-        f->glEnableVertexAttribArray(TEXCOORD_LOCATION);
     }
     if (tangents.size() == vertices.size()) {
         VBOtan.val = createVBO(f, tangents.data(), tangents.size() * sizeof(Tangent), GL_ARRAY_BUFFER, GL_STATIC_DRAW);
-        f->glEnableVertexAttribArray(TANGENT_LOCATION);   
     }
 
     // bind VBOs to VAO object
-    f->glBindVertexArray(VAO.val);
-    f->glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, VBOf.val);
     f->glBindBuffer(GL_ARRAY_BUFFER, VBOv.val);
     f->glVertexAttribPointer(POSITION_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
     f->glEnableVertexAttribArray(POSITION_LOCATION);
@@ -356,6 +1217,7 @@ void TriangleMesh::createAllVBOs() {
         f->glBindBuffer(GL_ARRAY_BUFFER, VBOc.val);
         f->glVertexAttribPointer(COLOR_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
         f->glEnableVertexAttribArray(COLOR_LOCATION);
+        hasColorAttribute = true;
     }
 
     if (VBOt.val) {
@@ -366,14 +1228,185 @@ void TriangleMesh::createAllVBOs() {
     if (VBOtan.val) {
         f->glBindBuffer(GL_ARRAY_BUFFER, VBOtan.val);
         f->glVertexAttribPointer(TANGENT_LOCATION, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
-        f->glEnableVertexAttribArray(TANGENT_LOCATION);   
+        f->glEnableVertexAttribArray(TANGENT_LOCATION);
     }
+}
 
-    f->glBindVertexArray(0);
+std::vector<unsigned char> TriangleMesh::buildIndexBuffer() {
+    // all levels one after another, starting at the full resolution
+    std::vector<unsigned char> data;
+    indexRanges.clear();
+    lodRangeOffsets.assign(1, 0);
+    if (chunks.empty()) appendIndexRanges(triangles.data(), triangles.size(), data);
+    // every chunk gets its own ranges, so it can be drawn on its own
+    chunkBoxes.clear();
+    for (Chunk& chunk : chunks) {
+        chunk.firstRange = indexRanges.size();
+        appendIndexRanges(&triangles[chunk.firstTriangle], chunk.triangleCount, data);
+        chunk.endRange = indexRanges.size();
+        chunkBoxes.push_back(chunk.boundingBoxMin, chunk.boundingBoxMax);
+    }
+    chunkVisible.resize(chunks.size());
+    lodRangeOffsets.push_back(indexRanges.size());
+    for (const LodLevel& lod : lods) {
+        appendIndexRanges(lod.triangles.data(), lod.triangles.size(), data);
+        lodRangeOffsets.push_back(indexRanges.size());
+    }
+    return data;
+}
 
-    createBBVAO(f);
+void TriangleMesh::appendIndexRanges(const Triangle* levelTriangles, size_t count, std::vector<unsigned char>& data) {
+    // greedily extend every range as long as its vertex indices span at most MaxShortIndexVertices vertices
+    size_t first = 0;
+    unsigned int low = UINT_MAX, high = 0;
+    bool shortIndices = true;
+    std::vector<std::pair<size_t, unsigned int>> ranges; // first triangle, base vertex
+    for (size_t i = 0; i < count; ++i) {
+        const Triangle& t = levelTriangles[i];
+        const unsigned int triangleLow = std::min(t[0], std::min(t[1], t[2]));
+        const unsigned int triangleHigh = std::max(t[0], std::max(t[1], t[2]));
+        // a single triangle spanning too many vertices needs 32 bit indices
+        if (triangleHigh - triangleLow >= MaxShortIndexVertices) shortIndices = false;
+        if (i > first && size_t(std::max(high, triangleHigh)) - std::min(low, triangleLow) >= MaxShortIndexVertices) {
+            ranges.emplace_back(first, low);
+            first = i;
+            low = UINT_MAX;
+            high = 0;
+        }
+        low = std::min(low, triangleLow);
+        high = std::max(high, triangleHigh);
+    }
+    if (count > 0) ranges.emplace_back(first, low);
+
+    // 32 bit indices have to be aligned
+    data.resize((data.size() + 3) & ~size_t(3));
+    const size_t offset = data.size();
+    if (!shortIndices || ranges.size() > 1 + count / MinShortIndexRangeTriangles) {
+        data.resize(offset + count * sizeof(Triangle));
+        std::memcpy(data.data() + offset, levelTriangles, count * sizeof(Triangle));
+        indexRanges.push_back({ GL_UNSIGNED_INT, GLsizei(3 * count), offset, 0 });
+        return;
+    }
+    data.resize(offset + count * 3 * sizeof(uint16_t));
+    uint16_t* out = reinterpret_cast<uint16_t*>(data.data() + offset);
+    for (size_t r = 0; r < ranges.size(); ++r) {
+        const size_t begin = ranges[r].first;
+        const size_t end = r + 1 < ranges.size() ? ranges[r + 1].first : count;
+        const unsigned int base = ranges[r].second;
+        indexRanges.push_back({ GL_UNSIGNED_SHORT, GLsizei(3 * (end - begin)), offset + 3 * begin * sizeof(uint16_t), GLint(base) });
+        for (size_t i = begin; i < end; ++i) {
+            for (unsigned int k = 0; k < 3; ++k) *out++ = static_cast<uint16_t>(levelTriangles[i][k] - base);
+        }
+    }
+}
 
-    createNormalVAO(f);
+size_t TriangleMesh::getIndexMemory() const {
+    size_t bytes = 0;
+    for (const IndexRange& range : indexRanges) bytes += range.count * (range.type == GL_UNSIGNED_SHORT ? sizeof(uint16_t) : sizeof(uint32_t));
+    return bytes;
+}
+
+TriangleMesh::InterleavedFormat TriangleMesh::interleavedFormat(bool quantized) const {
+    // position first, optional attributes only if every vertex has one.
+    // quantized: 3 x uint16 position padded to 8 bytes, 4 bytes for every other attribute.
+    InterleavedFormat format;
+    format.quantized = quantized;
+    auto add = [&format](int& offset, int bytes) { offset = format.stride; format.stride += bytes; };
+    int position = 0;
+    add(position, quantized ? 4 * sizeof(uint16_t) : sizeof(Vertex));
+    if (normals.size() == vertices.size()) add(format.normal, quantized ? sizeof(uint32_t) : sizeof(Normal));
+    if (texCoords.size() == vertices.size()) add(format.texCoord, quantized ? 2 * sizeof(uint16_t) : sizeof(TexCoord));
+    if (tangents.size() == vertices.size()) add(format.tangent, quantized ? sizeof(uint32_t) : sizeof(Tangent));
+    if (colors.size() == vertices.size()) add(format.color, quantized ? 4 * sizeof(uint8_t) : sizeof(Color));
+    return format;
+}
+
+std::vector<unsigned char> TriangleMesh::interleaveVertices(const InterleavedFormat& format) {
+    std::vector<unsigned char> data(vertices.size() * format.stride);
+    if (!format.quantized) {
+        auto copy = [&data, &format](int offset, const void* source, size_t size, size_t count) {
+            if (offset < 0) return;
+            for (size_t i = 0; i < count; ++i) {
+                std::memcpy(&data[i * format.stride + offset], static_cast<const unsigned char*>(source) + i * size, size);
+            }
+        };
+        copy(0, vertices.data(), sizeof(Vertex), vertices.size());
+        copy(format.normal, normals.data(), sizeof(Normal), vertices.size());
+        copy(format.texCoord, texCoords.data(), sizeof(TexCoord), vertices.size());
+        copy(format.tangent, tangents.data(), sizeof(Tangent), vertices.size());
+        copy(format.color, colors.data(), sizeof(Color), vertices.size());
+        quantizationOffset = Vec3f(0.0f, 0.0f, 0.0f);
+        quantizationScale = Vec3f(1.0f, 1.0f, 1.0f);
+        return data;
+    }
+
+    // positions relative to the bounding box, flat sides get a scale of 1 so they stay invertible
+    quantizationOffset = boundingBoxMin;
+    for (unsigned int k = 0; k < 3; ++k) quantizationScale[k] = boundingBoxSize[k] > 0.0f ? boundingBoxSize[k] : 1.0f;
+    for (size_t i = 0; i < vertices.size(); ++i) {
+        unsigned char* vertex = &data[i * format.stride];
+        uint16_t position[4] = { 0, 0, 0, 0 };
+        for (unsigned int k = 0; k < 3; ++k) position[k] = quantizeUnorm16((vertices[i][k] - quantizationOffset[k]) / quantizationScale[k]);
+        std::memcpy(vertex, position, sizeof(position));
+        if (format.normal >= 0) {
+            const uint32_t normal = packSnorm10(normals[i]);
+            std::memcpy(vertex + format.normal, &normal, sizeof(normal));
+        }
+        if (format.texCoord >= 0) {
+            const uint16_t texCoord[2] = { floatToHalf(texCoords[i].u), floatToHalf(texCoords[i].v) };
+            std::memcpy(vertex + format.texCoord, texCoord, sizeof(texCoord));
+        }
+        if (format.tangent >= 0) {
+            const uint32_t tangent = packSnorm10(tangents[i]);
+            std::memcpy(vertex + format.tangent, &tangent, sizeof(tangent));
+        }
+        if (format.color >= 0) {
+            const uint8_t color[4] = { quantizeUnorm8(colors[i][0]), quantizeUnorm8(colors[i][1]), quantizeUnorm8(colors[i][2]), 255 };
+            std::memcpy(vertex + format.color, color, sizeof(color));
+        }
+    }
+    return data;
+}
+
+size_t TriangleMesh::vertexMemory(VertexLayout layout) const {
+    if (layout == VertexLayout::SEPARATE) {
+        size_t bytes = vertices.size() * sizeof(Vertex) + normals.size() * sizeof(Normal);
+        if (colors.size() == vertices.size()) bytes += colors.size() * sizeof(Color);
+        if (texCoords.size() == vertices.size()) bytes += texCoords.size() * sizeof(TexCoord);
+        if (tangents.size() == vertices.size()) bytes += tangents.size() * sizeof(Tangent);
+        return bytes;
+    }
+    return vertices.size() * interleavedFormat(layout == VertexLayout::QUANTIZED).stride;
+}
+
+void TriangleMesh::createInterleavedVBO(QOpenGLFunctions_3_3_Core* f) {
+    const InterleavedFormat format = interleavedFormat(vertexLayout == VertexLayout::QUANTIZED);
+    const std::vector<unsigned char> data = interleaveVertices(format);
+    VBOv.val = createVBO(f, data.data(), data.size(), GL_ARRAY_BUFFER, GL_STATIC_DRAW);
+
+    const GLsizei stride = format.stride;
+    auto attribute = [f, stride](GLuint location, int offset, GLint components, GLenum type, GLboolean normalized) {
+        if (offset < 0) return;
+        f->glVertexAttribPointer(location, components, type, normalized, stride, reinterpret_cast<const void*>(static_cast<size_t>(offset)));
+        f->glEnableVertexAttribArray(location);
+    };
+    f->glBindBuffer(GL_ARRAY_BUFFER, VBOv.val);
+    if (format.quantized) {
+        // normalized integers are converted to floats by the vertex fetch, so the shaders need no changes.
+        // the packed formats always have 4 components, the shaders only read xyz.
+        attribute(POSITION_LOCATION, 0, 3, GL_UNSIGNED_SHORT, GL_TRUE);
+        attribute(NORMAL_LOCATION, format.normal, 4, GL_INT_2_10_10_10_REV, GL_TRUE);
+        attribute(TEXCOORD_LOCATION, format.texCoord, 2, GL_HALF_FLOAT, GL_FALSE);
+        attribute(TANGENT_LOCATION, format.tangent, 4, GL_INT_2_10_10_10_REV, GL_TRUE);
+        attribute(COLOR_LOCATION, format.color, 4, GL_UNSIGNED_BYTE, GL_TRUE);
+    } else {
+        attribute(POSITION_LOCATION, 0, 3, GL_FLOAT, GL_FALSE);
+        attribute(NORMAL_LOCATION, format.normal, 3, GL_FLOAT, GL_FALSE);
+        attribute(TEXCOORD_LOCATION, format.texCoord, 2, GL_FLOAT, GL_FALSE);
+        attribute(TANGENT_LOCATION, format.tangent, 3, GL_FLOAT, GL_FALSE);
+        attribute(COLOR_LOCATION, format.color, 3, GL_FLOAT, GL_FALSE);
+    }
+    hasColorAttribute = format.color >= 0;
 }
 
 void TriangleMesh::cleanupVBO() {
@@ -409,11 +1442,19 @@ void TriangleMesh::cleanupVBO(QOpenGLFunctions_3_3_Core* f) {
     VBOvbb.val = 0;
     VAOn.val = 0;
     VBOvn.val = 0;
+    hasColorAttribute = false;
+    indexRanges.clear();
+    lodRangeOffsets.clear();
 }
 
-unsigned int TriangleMesh::draw(RenderState& state) {
-    if (!boundingBoxIsVisible(state)) return 0;
-    if (VAO.val == 0) return 0;
+unsigned int TriangleMesh::draw(RenderState& state, bool testBoundingBox) {
+    return draw(state, currentLod, testBoundingBox);
+}
+
+unsigned int TriangleMesh::draw(RenderState& state, unsigned int& lod, bool testBoundingBox) {
+    // meshes that are still loading or not uploaded are skipped
+    if (!isResident()) return 0;
+    if (testBoundingBox && !boundingBoxIsVisible(state)) return 0;
     if (withBB || withNormals) {
         GLuint formerProgram = state.getCurrentProgram();
         state.switchToStandardProgram();
@@ -421,12 +1462,50 @@ unsigned int TriangleMesh::draw(RenderState& state) {
         if (withNormals) drawNormals(state);
         state.setCurrentProgram(formerProgram);
     }
-    drawVBO(state);
+    return drawVBO(state, selectLod(state, lod));
+}
 
-    return triangles.size();
+unsigned int TriangleMesh::drawFullResolution(RenderState& state) {
+    if (!isResident()) return 0;
+    return drawVBO(state, 0, false);
 }
 
-void TriangleMesh::drawVBO(RenderState& state) {
+float TriangleMesh::lodPixelThreshold = 1.0f;
+
+float TriangleMesh::lodPixelError(unsigned int lod, float distance, float pixelsPerUnit) const {
+    if (lod == 0) return 0.0f;
+    return lods[lod - 1].error * pixelsPerUnit / distance;
+}
+
+unsigned int TriangleMesh::selectLod(const RenderState& state, unsigned int& lod) const {
+    lod = std::min<unsigned int>(lod, lods.size());
+    if (lods.empty()) return 0;
+    const QMatrix4x4& modelView = state.getCurrentModelViewMatrix();
+    const QMatrix4x4& projection = state.getCurrentProjectionMatrix();
+    // bounding sphere in camera coordinates, the modelView matrix may scale
+    float scale = 0.0f;
+    for (int column = 0; column < 3; ++column) {
+        float squaredLength = 0.0f;
+        for (int row = 0; row < 3; ++row) squaredLength += modelView(row, column) * modelView(row, column);
+        scale = std::max(scale, squaredLength);
+    }
+    scale = std::sqrt(scale);
+    const float radius = 0.5f * boundingBoxSize.length() * scale;
+    const QVector3D center = modelView.map(QVector3D(boundingBoxMid.x(), boundingBoxMid.y(), boundingBoxMid.z()));
+    // the closest point of the mesh can be this near, inside the sphere everything is drawn at full resolution
+    const float distance = -center.z() - radius;
+    if (distance <= 0.0f) {
+        lod = 0;
+        return 0;
+    }
+    // projection(1, 1) = cot(fov / 2) maps a length at distance 1 to normalized device coordinates, which span 2 in height
+    const float pixelsPerUnit = scale * projection(1, 1) * 0.5f * state.getViewportHeight();
+    while (lod > 0 && lodPixelError(lod, distance, pixelsPerUnit) > lodPixelThreshold) --lod;
+    while (lod < lods.size() && lodPixelError(lod + 1, distance, pixelsPerUnit) <= LodHysteresis * lodPixelThreshold) ++lod;
+    return lod;
+}
+
+unsigned int TriangleMesh::drawVBO(RenderState& state, unsigned int lod, bool cullChunks) {
     auto* f = state.getOpenGLFunctions();
 
     //Bug in Qt: They flagged glVertexAttrib3f as deprecated in modern OpenGL, which is not true.
@@ -435,8 +1514,16 @@ void TriangleMesh::drawVBO(RenderState& state) {
     
     // The VAO keeps track of all the buffers and the element buffer, so we do not need to bind else except for the VAO
     f->glBindVertexArray(VAO.val);
-    f->glUniformMatrix4fv(state.getModelViewUniform(), 1, GL_FALSE, state.getCurrentModelViewMatrix().data());
+    // the normal matrix belongs to the object coordinates, it must not contain the dequantization of the positions
     f->glUniformMatrix3fv(state.getNormalMatrixUniform(), 1, GL_FALSE, state.calculateNormalMatrix().data());
+    if (vertexLayout == VertexLayout::QUANTIZED) {
+        QMatrix4x4 modelView = state.getCurrentModelViewMatrix();
+        modelView.translate(quantizationOffset.x(), quantizationOffset.y(), quantizationOffset.z());
+        modelView.scale(quantizationScale.x(), quantizationScale.y(), quantizationScale.z());
+        f->glUniformMatrix4fv(state.getModelViewUniform(), 1, GL_FALSE, modelView.data());
+    } else {
+        f->glUniformMatrix4fv(state.getModelViewUniform(), 1, GL_FALSE, state.getCurrentModelViewMatrix().data());
+    }
     switch (coloringType) {
         case ColoringType::TEXTURE:
             if (textureID.val != 0) {
@@ -449,7 +1536,7 @@ void TriangleMesh::drawVBO(RenderState& state) {
             //[[fallthrough]];
 
         case ColoringType::COLOR_ARRAY:
-            if (VBOc.val != 0) {
+            if (hasColorAttribute) {
                 f->glUniform1ui(state.getUseTextureUniform(), GL_FALSE);
                 f->glEnableVertexAttribArray(COLOR_LOCATION);
                 break;
@@ -495,7 +1582,24 @@ void TriangleMesh::drawVBO(RenderState& state) {
             f->glBindTexture(GL_TEXTURE_2D, displacementMapID.val);
             break;
     }
-    f->glDrawElements(GL_TRIANGLES, 3*triangles.size(), GL_UNSIGNED_INT, nullptr);
+    auto drawRanges = [&](size_t begin, size_t end) -> unsigned int {
+        GLsizei indices = 0;
+        for (size_t i = begin; i < end; ++i) {
+            const IndexRange& range = indexRanges[i];
+            f->glDrawElementsBaseVertex(GL_TRIANGLES, range.count, range.type, reinterpret_cast<const void*>(range.offset), range.baseVertex);
+            indices += range.count;
+        }
+        return static_cast<unsigned int>(indices / 3);
+    };
+    if (lod > 0 || chunks.empty() || !cullChunks) return drawRanges(lodRangeOffsets[lod], lodRangeOffsets[lod + 1]);
+    // all chunk boxes are tested in one batch
+    static const CullingKernel kernel = bestCullingKernel();
+    cullBoxes(kernel, state.getFrustumCullingPlanes(), chunkBoxes, chunkVisible.data());
+    unsigned int trianglesDrawn = 0;
+    for (size_t c = 0; c < chunks.size(); ++c) {
+        if (chunkVisible[c]) trianglesDrawn += drawRanges(chunks[c].firstRange, chunks[c].endRange);
+    }
+    return trianglesDrawn;
 }
 
 // ===========
@@ -503,7 +1607,15 @@ void TriangleMesh::drawVBO(RenderState& state) {
 // ===========
 
 bool TriangleMesh::boundingBoxIsVisible(const RenderState& state) {
-    // TODO(3.3): Implement view frustum culling.
+    return boxIsVisible(state.getFrustumPlanes(), boundingBoxMin, boundingBoxMax);
+}
+
+bool TriangleMesh::boxIsVisible(const std::vector<ClipPlane>& planes, const Vec3f& boxMin, const Vec3f& boxMax) {
+    // center and half extents like BoxArray, so the result matches cullBoxes
+    const Vec3f center = 0.5f * (boxMin + boxMax), extent = 0.5f * (boxMax - boxMin);
+    for (const ClipPlane& plane : planes) {
+        if (plane.evaluateBox(center, extent) < 0.0f) return false;
+    }
     return true;
 }
 
@@ -543,7 +1655,7 @@ void TriangleMesh::drawNormals(RenderState &state) {
     f->glDrawArrays(GL_LINES, 0, vertices.size() * 2);
 }
 
-void TriangleMesh::generateSphere() {
+void TriangleMesh::generateSphere(bool createVBOs) {
     // The sphere consists of latdiv rings of longdiv faces.
     int longdiv = 200; // minimum 4
     int latdiv  = 100; // minimum 2
@@ -584,29 +1696,287 @@ void TriangleMesh::generateSphere() {
             triangles.emplace_back(topNext, topCurrent, bottomCurrent);
         }
     }
+    trianglesChanged();
 
     boundingBoxMid = Vec3f(0, 0, 0);
     boundingBoxSize = Vec3f(2, 2, 2);
     boundingBoxMin = Vec3f(-1, -1, -1);
     boundingBoxMax = Vec3f(1, 1, 1);
 
-    createAllVBOs();
+    optimizeVertexOrder();
+    if (createVBOs) createAllVBOs();
+}
+
+void TriangleMesh::generateTerrain(bool createVBOs) {
+    generateTerrain(TerrainSettings(), NoiseSettings(), createVBOs);
 }
 
-void TriangleMesh::generateTerrain() {
-    // TODO(3.1): Implement terrain generation.
+void TriangleMesh::generateTerrain(const TerrainSettings& settings, const NoiseSettings& noise, bool createVBOs) {
+    static const NoiseKernel kernel = bestNoiseKernel();
+    const unsigned int n = std::max(2u, settings.resolution);
+    const float d = 1.0f / float(n - 1);
+    const float origin = -0.5f * settings.size;
+    generateTerrainRows(settings, origin, origin, [&](unsigned int j, float* heights) {
+        fbmRow(kernel, noise, -d, d, (float(j) - 1.0f) * d, n + 2, heights);
+    }, createVBOs);
+}
 
-    vertices.reserve(4);
-    vertices.emplace_back(0, 0, 0);
-    vertices.emplace_back(0, 0, 10);
-    vertices.emplace_back(10, 0, 10);
-    vertices.emplace_back(10, 0, 0);
+void TriangleMesh::generateTerrainTile(const TerrainSettings& settings, const NoiseSettings& noise, int tileX, int tileZ, bool createVBOs) {
+    static const NoiseKernel kernel = bestNoiseKernel();
+    const unsigned int n = std::max(2u, settings.resolution);
+    const float d = 1.0f / float(n - 1);
+    // the noise of the tile starts at tileX, tileZ. the border row and column of two neighbouring tiles get the same
+    // noise coordinates (and heights) as long as tileX + i * d is exact, e.g. for power of two resolutions - 1.
+    generateTerrainRows(settings, tileX * settings.size, tileZ * settings.size, [&](unsigned int j, float* heights) {
+        fbmRow(kernel, noise, float(tileX) - d, d, float(tileZ) + (float(j) - 1.0f) * d, n + 2, heights);
+    }, createVBOs);
+}
 
-    triangles.reserve(2);
-    triangles.emplace_back(0, 1, 2);
-    triangles.emplace_back(0, 2, 3);
+void TriangleMesh::generateTerrain(const TerrainSettings& settings, const std::function<float(float, float)>& heightAt, bool createVBOs) {
+    const unsigned int n = std::max(2u, settings.resolution);
+    auto at = [&](int i, int j) { return heightAt(float(i) / float(n - 1), float(j) / float(n - 1)); };
+    // heightAt is only defined on [0, 1]^2, the border is extrapolated linearly. the central differences at the
+    // edges are one sided then.
+    auto extrapolated = [&](int i, int j) -> float {
+        const int ci = std::max(0, std::min(int(n) - 1, i)), cj = std::max(0, std::min(int(n) - 1, j));
+        if (ci == i && cj == j) return at(i, j);
+        return 2.0f * at(ci, cj) - at(2 * ci - i, 2 * cj - j);
+    };
+    const float origin = -0.5f * settings.size;
+    generateTerrainRows(settings, origin, origin, [&](unsigned int j, float* heights) {
+        for (unsigned int i = 0; i < n + 2; ++i) heights[i] = extrapolated(int(i) - 1, int(j) - 1);
+    }, createVBOs);
+}
 
-    calculateNormalsByArea();
+void TriangleMesh::generateTerrainRows(const TerrainSettings& settings, float originX, float originZ, const std::function<void(unsigned int, float*)>& fillRow, bool createVBOs) {
+    clear();
+    const unsigned int n = std::max(2u, settings.resolution);
+    const size_t numVertices = size_t(n) * n;
+    const float spacing = settings.size / float(n - 1);
+    // heights of the grid with a border of one vertex on every side, for the normals at the edges
+    const unsigned int m = n + 2;
+    std::vector<float> heights(size_t(m) * m);
+    auto heightAt = [&heights, m](int i, int j) -> float { return heights[size_t(j + 1) * m + size_t(i + 1)]; };
+    vertices.resize(numVertices);
+    normals.resize(numVertices);
+    texCoords.resize(numVertices);
+    if (settings.colors) colors.resize(numVertices);
+    triangles.resize(2 * size_t(n - 1) * (n - 1));
+
+    // every block of rows only writes its own vertices and triangles
+    ThreadPool& pool = ThreadPool::global();
+    const unsigned int numBlocks = std::min(n, 8 * pool.getNumThreads());
+    auto forRows = [&](unsigned int rows, const std::function<void(unsigned int)>& row) {
+        pool.parallelFor(numBlocks, [&](unsigned int block) {
+            for (unsigned int j = rows * size_t(block) / numBlocks; j < rows * size_t(block + 1) / numBlocks; ++j) row(j);
+        });
+    };
+    forRows(m, [&](unsigned int j) {
+        float* row = &heights[size_t(j) * m];
+        fillRow(j, row);
+        for (unsigned int i = 0; i < m; ++i) row[i] *= settings.heightScale;
+    });
+    forRows(n, [&](unsigned int j) {
+        const float v = float(j) / float(n - 1);
+        for (unsigned int i = 0; i < n; ++i) {
+            const size_t index = size_t(j) * n + i;
+            const float h = heightAt(i, j);
+            vertices[index] = Vertex(originX + i * spacing, h, originZ + j * spacing);
+            texCoords[index] = { float(i) / float(n - 1), v };
+            // central differences, the border vertices use the heights outside the grid
+            const float dx = (heightAt(i + 1, j) - heightAt(int(i) - 1, j)) / (2.0f * spacing);
+            const float dz = (heightAt(i, j + 1) - heightAt(i, int(j) - 1)) / (2.0f * spacing);
+            normals[index] = Normal(-dx, 1.0f, -dz).normalized();
+            if (settings.colors) {
+                // green valleys, brown slopes, white peaks
+                const float t = settings.heightScale > 0.0f ? std::max(0.0f, std::min(1.0f, h / settings.heightScale)) : 0.0f;
+                if (t < 0.5f) colors[index] = (1.0f - 2.0f * t) * Color(0.2f, 0.5f, 0.15f) + 2.0f * t * Color(0.45f, 0.35f, 0.2f);
+                else colors[index] = (2.0f - 2.0f * t) * Color(0.45f, 0.35f, 0.2f) + (2.0f * t - 1.0f) * Color(0.95f, 0.95f, 0.95f);
+            }
+        }
+    });
+    // chunks are numbered row by row, the chunks of the last row and column may be smaller
+    const unsigned int quads = n - 1;
+    const unsigned int chunkSize = settings.chunkSize > 0 ? std::min(settings.chunkSize, quads) : quads;
+    const unsigned int chunksPerSide = (quads + chunkSize - 1) / chunkSize;
+    chunks.resize(size_t(chunksPerSide) * chunksPerSide);
+    size_t firstTriangle = 0;
+    for (unsigned int c = 0; c < chunks.size(); ++c) {
+        const unsigned int width = std::min(chunkSize, quads - (c % chunksPerSide) * chunkSize);
+        const unsigned int depth = std::min(chunkSize, quads - (c / chunksPerSide) * chunkSize);
+        chunks[c].firstTriangle = firstTriangle;
+        chunks[c].triangleCount = 2 * size_t(width) * depth;
+        firstTriangle += chunks[c].triangleCount;
+    }
+    pool.parallelFor(static_cast<unsigned int>(chunks.size()), [&](unsigned int c) {
+        Chunk& chunk = chunks[c];
+        const unsigned int i0 = (c % chunksPerSide) * chunkSize, j0 = (c / chunksPerSide) * chunkSize;
+        const unsigned int i1 = std::min(i0 + chunkSize, quads), j1 = std::min(j0 + chunkSize, quads);
+        // the two triangles of every quad are emitted along the row like a triangle strip, so neighbouring triangles
+        // share two vertices and the rows of a chunk are already in a cache friendly order
+        Triangle* out = &triangles[chunk.firstTriangle];
+        for (unsigned int j = j0; j < j1; ++j) {
+            for (unsigned int i = i0; i < i1; ++i) {
+                const unsigned int v00 = j * n + i, v10 = v00 + 1, v01 = v00 + n, v11 = v01 + 1;
+                *out++ = Triangle(v00, v01, v10);
+                *out++ = Triangle(v10, v01, v11);
+            }
+        }
+        // the strips are then sorted against overdraw in clusters like the bump sphere, hills before the valleys behind
+        // them. about 3% less overdraw for about 5% more vertex cache misses, the vertices stay in grid order.
+        std::vector<Triangle> chunkTriangles(&triangles[chunk.firstTriangle], out);
+        ::optimizeOverdraw(chunkTriangles, vertices);
+        std::copy(chunkTriangles.begin(), chunkTriangles.end(), &triangles[chunk.firstTriangle]);
+        // tight box: the grid extent and the height range of the chunk vertices
+        float low = FLT_MAX, high = -FLT_MAX;
+        for (unsigned int j = j0; j <= j1; ++j) {
+            const auto row = heights.begin() + size_t(j + 1) * m + 1;
+            const auto range = std::minmax_element(row + i0, row + i1 + 1);
+            low = std::min(low, *range.first);
+            high = std::max(high, *range.second);
+        }
+        chunk.boundingBoxMin = Vec3f(originX + i0 * spacing, low, originZ + j0 * spacing);
+        chunk.boundingBoxMax = Vec3f(originX + i1 * spacing, high, originZ + j1 * spacing);
+    });
+    if (chunks.size() == 1) chunks.clear();
+    OcclusionCuller::buildHeightfieldOccluder(&heights[m + 1], m, n, originX, originZ, spacing, settings.occluderCells, occluder);
     calculateBB();
-    createAllVBOs();
-}
\ No newline at end of file
+    if (createVBOs) createAllVBOs();
+}
+
+bool TriangleMesh::generateTerrainFromHeightmap(const char* filename, TerrainSettings settings, bool createVBOs) {
+    int width, height, channels;
+    stbi_us* pixels = stbi_load_16(filename, &width, &height, &channels, 1);
+    if (!pixels) {
+        std::cout << "generateTerrain: can not load heightmap " << filename << std::endl;
+        return false;
+    }
+    if (settings.resolution == 0) settings.resolution = static_cast<unsigned int>(std::max(width, height));
+    generateTerrain(settings, [pixels, width, height](float u, float v) {
+        // bilinear interpolation of the 16 bit heights
+        const float x = u * (width - 1), y = v * (height - 1);
+        const int x0 = std::min(static_cast<int>(x), width - 1), y0 = std::min(static_cast<int>(y), height - 1);
+        const int x1 = std::min(x0 + 1, width - 1), y1 = std::min(y0 + 1, height - 1);
+        const float fx = x - x0, fy = y - y0;
+        const stbi_us* row0 = pixels + size_t(y0) * width;
+        const stbi_us* row1 = pixels + size_t(y1) * width;
+        return ((1.0f - fy) * ((1.0f - fx) * row0[x0] + fx * row0[x1]) + fy * ((1.0f - fx) * row1[x0] + fx * row1[x1])) / 65535.0f;
+    }, createVBOs);
+    stbi_image_free(pixels);
+    return true;
+}
+
+void TriangleMesh::benchmarkNoise(unsigned int resolution, int runs) {
+    typedef std::chrono::steady_clock Clock;
+    const NoiseSettings noise;
+    const size_t n = std::max(1u, resolution);
+    std::vector<float> heights(n * n), reference;
+    std::cout << "benchmarkNoise: " << n << "^2 samples, " << noise.octaves << " octaves" << std::endl;
+    double scalarSeconds = 0.0;
+    // times one variant and compares its heights to the scalar kernel
+    auto measure = [&](const std::string& name, const std::function<void()>& fill) {
+        double seconds = 0.0;
+        for (int run = 0; run < runs; ++run) {
+            std::fill(heights.begin(), heights.end(), 0.0f);
+            const auto begin = Clock::now();
+            fill();
+            seconds += std::chrono::duration<double>(Clock::now() - begin).count();
+        }
+        if (reference.empty()) {
+            scalarSeconds = seconds;
+            reference = heights;
+        }
+        const bool identical = std::memcmp(reference.data(), heights.data(), reference.size() * sizeof(float)) == 0;
+        std::cout << "  " << std::setw(20) << std::left << name << std::right << 1000.0 * seconds / runs << " ms, "
+                  << double(n * n) * runs / seconds / 1e6 << " Msamples/s (" << scalarSeconds / seconds << "x)"
+                  << (identical ? "" : ", WARNING: differs from scalar") << std::endl;
+    };
+    auto fillRow = [&](NoiseKernel kernel, unsigned int j) {
+        fbmRow(kernel, noise, 0.0f, 1.0f / float(n), float(j) / float(n), n, &heights[j * n]);
+    };
+    for (NoiseKernel kernel : { NoiseKernel::SCALAR, NoiseKernel::SSE, NoiseKernel::AVX2 }) {
+        if (!noiseKernelSupported(kernel)) {
+            std::cout << "  " << noiseKernelName(kernel) << ": not supported" << std::endl;
+            continue;
+        }
+        measure(std::string(noiseKernelName(kernel)) + ":", [&] { for (unsigned int j = 0; j < n; ++j) fillRow(kernel, j); });
+    }
+    const unsigned int threads = ThreadPool::global().getNumThreads();
+    if (threads > 1) {
+        const NoiseKernel kernel = bestNoiseKernel();
+        measure(std::string(noiseKernelName(kernel)) + ", " + std::to_string(threads) + " threads:", [&] {
+            ThreadPool::global().parallelFor(static_cast<unsigned int>(n), [&](unsigned int j) { fillRow(kernel, j); });
+        });
+    }
+}
+
+void TriangleMesh::benchmarkCulling(unsigned int count, int runs) {
+    typedef std::chrono::steady_clock Clock;
+    // camera at the origin looking along -z, boxes of up to 2 units scattered in a cube of 200 units around it
+    QMatrix4x4 projection, view;
+    projection.perspective(60.0f, 1.5f, 0.1f, 100.0f);
+    view.lookAt(QVector3D(0.0f, 0.0f, 0.0f), QVector3D(0.0f, 0.0f, -1.0f), QVector3D(0.0f, 1.0f, 0.0f));
+    const std::vector<ClipPlane> planes = RenderState::extractFrustumPlanes(projection * view);
+    const std::vector<CullingPlane> prepared = cullingPlanes(planes);
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f), size(0.0f, 2.0f);
+    std::vector<Vec3f> boxMin(count), boxMax(count);
+    BoxArray boxes;
+    boxes.reserve(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        boxMin[i] = Vec3f(position(random), position(random), position(random));
+        boxMax[i] = boxMin[i] + Vec3f(size(random), size(random), size(random));
+        boxes.push_back(boxMin[i], boxMax[i]);
+    }
+    std::cout << "benchmarkCulling: " << count << " boxes, " << planes.size() << " planes" << std::endl;
+    std::vector<uint8_t> visible(count), reference;
+    double firstSeconds = 0.0;
+    // times one variant and compares its results to the first one
+    auto measure = [&](const std::string& name, const std::function<size_t()>& cull) {
+        double seconds = 0.0;
+        size_t visibleCount = 0;
+        for (int run = 0; run < runs; ++run) {
+            std::fill(visible.begin(), visible.end(), 2);
+            const auto begin = Clock::now();
+            visibleCount = cull();
+            seconds += std::chrono::duration<double>(Clock::now() - begin).count();
+        }
+        if (reference.empty()) {
+            firstSeconds = seconds;
+            reference = visible;
+        }
+        const bool identical = reference == visible;
+        std::cout << "  " << std::setw(20) << std::left << name << std::right << 1e9 * seconds / runs / std::max(1u, count) << " ns/box, "
+                  << visibleCount << " visible (" << firstSeconds / seconds << "x)" << (identical ? "" : ", WARNING: differs") << std::endl;
+    };
+    measure("boxIsVisible:", [&]() -> size_t {
+        size_t visibleCount = 0;
+        for (unsigned int i = 0; i < count; ++i) {
+            visible[i] = boxIsVisible(planes, boxMin[i], boxMax[i]);
+            visibleCount += visible[i];
+        }
+        return visibleCount;
+    });
+    for (CullingKernel kernel : { CullingKernel::SCALAR, CullingKernel::SSE, CullingKernel::AVX }) {
+        if (!cullingKernelSupported(kernel)) {
+            std::cout << "  " << cullingKernelName(kernel) << ": not supported" << std::endl;
+            continue;
+        }
+        measure(std::string("cullBoxes ") + cullingKernelName(kernel) + ":", [&] { return cullBoxes(kernel, prepared, boxes, visible.data()); });
+    }
+}
+
+void TriangleMesh::benchmarkTerrain(unsigned int resolution, const char* heightmap) {
+    TerrainSettings settings;
+    settings.resolution = resolution;
+    TriangleMesh mesh;
+    const auto begin = std::chrono::steady_clock::now();
+    if (heightmap) {
+        if (!mesh.generateTerrainFromHeightmap(heightmap, settings, false)) return;
+    } else {
+        mesh.generateTerrain(settings, NoiseSettings(), false);
+    }
+    const double milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+    std::cout << "benchmarkTerrain: " << mesh.getNumVertices() << " vertices, " << mesh.getNumTriangles() << " triangles in "
+              << milliseconds << " ms with " << ThreadPool::global().getNumThreads() << " threads" << std::endl;
+}
@@ -7,14 +7,21 @@
 
 #include <QOpenGLContext>
 
+#include <algorithm>
+#include <functional>
 #include <vector>
 
 #include "Vec3.h"
 #include "Utilities.h"
+#include "NormalKernels.h"
+#include "NoiseKernels.h"
+#include "CullingKernels.h"
+#include "OcclusionCuller.h"
 
 //Forward declaration, avoids being forced to include header
 class QOpenGLFunctions_3_3_Core;
 class RenderState;
+class ClipPlane;
 
 class TriangleMesh {
 public:
@@ -24,7 +31,25 @@ public:
         TEXTURE,
         BUMP_MAPPING,
     };
+    // parameters of generateTerrain
+    struct TerrainSettings {
+        unsigned int resolution{512};  // vertices per side
+        float size{200.0f};            // side length of the square grid in x and z
+        float heightScale{20.0f};      // height of a height value of 1
+        bool colors{true};             // height dependent colors for ColoringType::COLOR_ARRAY
+        unsigned int chunkSize{64};    // quads per side of a chunk, see Chunk. 0 puts the whole grid into one chunk.
+        unsigned int occluderCells{32};  // quads per side of the occluder, see getOccluder. 0 builds none.
+    };
+    // how the vertex attributes are stored on the GPU
+    enum class VertexLayout {
+        SEPARATE,     // one VBO per attribute
+        INTERLEAVED,  // all attributes of a vertex next to each other in one VBO
+        QUANTIZED,    // interleaved, with 16 bit positions relative to the bounding box, packed normals and tangents,
+                      // half float texCoords and 8 bit colors. 24 instead of 56 bytes for a fully attributed vertex.
+    };
 private:
+    // tests/tests.cpp tests the readers and the index buffer directly
+    friend struct TriangleMeshTests;
     // typedefs for data
     typedef Vec3ui Triangle;
     typedef Vec3f Vertex;
@@ -48,10 +73,62 @@ private:
     Colors colors;        // r,g,b in [0,1]
     TexCoords texCoords;  // u,v in [0,1]
     Tangents tangents;    // tangent per vertex
+    // vertex -> face adjacency (CSR): the faces of vertex v are vertexFaces[vertexFaceOffsets[v] .. vertexFaceOffsets[v + 1])
+    // in ascending order. built on demand by calculateNormalsByArea and kept for later recomputations.
+    std::vector<unsigned int> vertexFaceOffsets;
+    std::vector<unsigned int> vertexFaces;
+    // incremented whenever the triangles change (see trianglesChanged), the adjacency is only reused if it was
+    // built for the current generation
+    unsigned int triangleGeneration{0};
+    unsigned int adjacencyGeneration{0};
     Vec3f staticColor;
     ColoringType coloringType{ColoringType::STATIC_COLOR};
-
-    // VAO and VBO ids for vertices, normals, faces, colors, texCoords, tangents
+    VertexLayout vertexLayout{VertexLayout::SEPARATE};
+    // colors were uploaded as vertex attribute
+    bool hasColorAttribute{false};
+    // maps the quantized positions in [0,1] back to object coordinates, applied to the modelView matrix in drawVBO
+    Vec3f quantizationOffset{0.0f, 0.0f, 0.0f};
+    Vec3f quantizationScale{1.0f, 1.0f, 1.0f};
+
+    // consecutive triangles drawn with one index type. indices are stored relative to baseVertex, so
+    // uint16 works for every range whose vertex indices span at most 65536 vertices.
+    struct IndexRange {
+        GLenum type;         // GL_UNSIGNED_SHORT or GL_UNSIGNED_INT
+        GLsizei count;       // number of indices
+        size_t offset;       // in bytes within VBOf
+        GLint baseVertex;
+    };
+    // draw calls of VBOf, created with the VBOs
+    std::vector<IndexRange> indexRanges;
+    // coarser versions of the mesh that index the same vertices, lods[i] has about triangles.size() >> (i + 1) triangles
+    struct LodLevel {
+        Triangles triangles;
+        float error;  // geometric error in object units, see simplifyMesh
+    };
+    std::vector<LodLevel> lods;
+    // the indexRanges of level l (0 = full resolution) are [lodRangeOffsets[l], lodRangeOffsets[l + 1])
+    std::vector<size_t> lodRangeOffsets;
+    // square piece of a terrain grid: a consecutive run of triangles with its own bounding box and index ranges,
+    // all chunks share the vertex buffer. draw only draws the chunks intersecting the view frustum.
+    struct Chunk {
+        Vec3f boundingBoxMin, boundingBoxMax;
+        size_t firstTriangle, triangleCount;
+        size_t firstRange{0}, endRange{0};  // indexRanges of the chunk, set by buildIndexBuffer
+    };
+    // empty unless the mesh is a terrain with more than one chunk. dropped by operations that reorder the triangles.
+    std::vector<Chunk> chunks;
+    // bounding boxes of the chunks for cullBoxes, set by buildIndexBuffer
+    BoxArray chunkBoxes;
+    // result of cullBoxes for every chunk, sized with chunkBoxes so drawing allocates nothing
+    std::vector<uint8_t> chunkVisible;
+    // coarse version of a terrain below its surface for OcclusionCuller, empty for other meshes
+    Occluder occluder;
+    // level drawn last by draw without a level of its own, see selectLod
+    unsigned int currentLod{0};
+    static float lodPixelThreshold;
+
+    // VAO and VBO ids for vertices, normals, faces, colors, texCoords, tangents.
+    // with VertexLayout::INTERLEAVED and QUANTIZED all attributes are in VBOv.
     autoMoved<GLuint> VAO{}, VBOv{}, VBOn{}, VBOf{}, VBOc{}, VBOt{}, VBOtan{};
     // VBO for bounding box
     autoMoved<GLuint> VAObb{}, VBOvbb{}, VBOfbb{};
@@ -94,7 +171,8 @@ public:
 
     // get raw data references
     std::vector<Vec3f>& getVertices() { return vertices; }
-    std::vector<Vec3ui>& getTriangles() { return triangles; }
+    // the caller may change the triangles, so the adjacency is rebuilt on the next recalculateNormals
+    std::vector<Vec3ui>& getTriangles() { trianglesChanged(); return triangles; }
     std::vector<Vec3f>& getNormals() { return normals; }
     std::vector<Vec3f>& getColors() { return colors; }
     std::vector<TexCoord>& getTexCoords() { return texCoords; }
@@ -114,6 +192,11 @@ public:
 
     // flip all normals
     void flipNormals(bool createVBOs = true);
+    // recalculate normals after the vertices have been moved, reusing the vertex -> face adjacency as long as
+    // the triangles have not been changed since it was built.
+    void recalculateNormals(bool createVBOs = true);
+    // frees the adjacency
+    void invalidateAdjacency();
 
     //set texture ID
     void setTexture(GLuint texID) { textureID.val = texID; };
@@ -132,34 +215,161 @@ public:
 
     // scales vertices so that the largest bounding box size has length newLength
     void scaleToLength(float newLength, bool createVBOs = true);
+    // merges vertices whose positions differ by at most epsilon per coordinate (and whose normals match, if
+    // given) using a hash grid, in O(n). keepTexCoordSeams keeps vertices with different texCoords apart.
+    // the first vertex of a group keeps its attributes, triangles that become degenerate are removed.
+    // done by loadOFF before the normals are calculated.
+    void weldVertices(float epsilon = EPS, bool keepTexCoordSeams = false);
+    // builds up to maxLevels coarser index buffers, halving the triangles from level to level (see simplifyMesh).
+    // done by loadOFF. operations that renumber the vertices drop the levels.
+    void generateLods(unsigned int maxLevels = 3);
+    unsigned int getNumLods() const { return static_cast<unsigned int>(lods.size()) + 1; }
+    unsigned int getNumChunks() const { return static_cast<unsigned int>(chunks.size()); }
+    // occluder built by generateTerrain from settings.occluderCells, empty for meshes that were loaded
+    const Occluder& getOccluder() const { return occluder; }
+    // largest screen space error in pixels of a level selected by draw
+    static void setLodPixelThreshold(float pixels) { lodPixelThreshold = std::max(0.0f, pixels); }
+    static float getLodPixelThreshold() { return lodPixelThreshold; }
+    // reorders the triangles for the post-transform vertex cache and the vertices in first use order
+    // (see MeshOptimizer.h). done by all loaders, benchmarkMeshOptimizer prints the cache statistics.
+    void optimizeVertexOrder();
+    // reorders clusters of triangles to reduce overdraw without losing much vertex cache efficiency (see
+    // MeshOptimizer.h). call after optimizeVertexOrder, benchmarkMeshOptimizer prints the estimated overdraw.
+    // the terrain generators sort every chunk on its own the same way.
+    void optimizeOverdraw(float threshold = 1.05f);
+
+    // takes over the mesh data (geometry, attributes, bounding box) of other, keeps the draw settings of this mesh
+    void takeGeometry(TriangleMesh&& other);
+    // mesh data is available, but no VBOs have been created yet
+    bool isCPUReady() const { return !vertices.empty() && VAO.val == 0; }
+    // VBOs have been created. only resident meshes are drawn.
+    bool isResident() const { return VAO.val != 0; }
+    // create the VBOs of a CPU ready mesh. needs a current OpenGL context.
+    void uploadToGPU();
 
     // =================
     // === LOAD MESH ===
     // =================
 
     // read from an OFF file. also calculates normals if not given in the file.
+    // the processed mesh is cached in a binary file next to the OFF file (see MeshCacheHeader), later
+    // calls load this cache as long as the OFF file has not been modified.
     void loadOFF(const char* filename, bool createVBOs = true);
 
     // read from an OFF file. also calculates normals if not given in the file.
     // translates and scales vertices with bounding box center at BBmid and largest side BBlength
     void loadOFF(const char* filename, const Vec3f& BBmid, float BBlength);
 
-    void generateSphere();
-
-    void generateTerrain();
+    // compares the memory mapped OFF reader against the std::ifstream based one and prints the timings
+    static void benchmarkLoadOFF(const char* filename, int runs = 5);
+    // reads the OFF file and prints the statistics and timings of the mesh optimization passes
+    static void benchmarkMeshOptimizer(const char* filename);
+
+    // implementation used by calculateNormalsByArea. defaults to the fastest one supported by the CPU,
+    // unsupported kernels fall back to SCALAR.
+    static void setNormalKernel(NormalKernel kernel);
+    static NormalKernel getNormalKernel() { return normalKernel; }
+    // times calculateNormalsByArea with every supported kernel on the OFF file and checks the results against SCALAR
+    static void benchmarkNormals(const char* filename, int runs = 20);
+
+    void generateSphere(bool createVBOs = true);
+
+    // fBm terrain with the default TerrainSettings and NoiseSettings
+    void generateTerrain(bool createVBOs = true);
+    // fBm terrain, the noise covers the unit square [0, 1]^2 of the grid. rows are evaluated with the fastest noise kernel.
+    void generateTerrain(const TerrainSettings& settings, const NoiseSettings& noise, bool createVBOs = true);
+    // tile (tileX, tileZ) of an endless fBm terrain: the grid covers [tileX, tileX + 1] * settings.size in x (z alike)
+    // and the noise square [tileX, tileX + 1] x [tileZ, tileZ + 1]. neighbouring tiles share their border vertices.
+    void generateTerrainTile(const TerrainSettings& settings, const NoiseSettings& noise, int tileX, int tileZ, bool createVBOs = true);
+    // regular grid in the xz plane centered at the origin, heightAt(u, v) gives the height in [0, 1] at u, v in [0, 1].
+    // the grid is split into chunks of settings.chunkSize^2 quads, within a chunk the triangles are emitted row by
+    // row like a triangle strip. normals are central differences of the heights.
+    // rows are generated in parallel, heightAt is called from several threads.
+    void generateTerrain(const TerrainSettings& settings, const std::function<float(float, float)>& heightAt, bool createVBOs = true);
+    // heights from a grayscale image (8 or 16 bit) loaded with stb_image, bilinearly resampled to settings.resolution
+    // (0 uses the image resolution). returns false if the image can not be loaded.
+    bool generateTerrainFromHeightmap(const char* filename, TerrainSettings settings, bool createVBOs = true);
+    // times generateTerrain with resolution^2 vertices, from the heightmap if one is given
+    static void benchmarkTerrain(unsigned int resolution, const char* heightmap = nullptr);
+    // times resolution^2 fBm samples with every supported noise kernel and with all threads
+    static void benchmarkNoise(unsigned int resolution = 2048, int runs = 5);
+    // times the frustum test of count random boxes, one by one with boxIsVisible and batched with every supported
+    // cullBoxes kernel, and checks that all give the same results
+    static void benchmarkCulling(unsigned int count = 1000000, int runs = 10);
 
 private:
-    // calculate normals, weighted by area
+    // parse an OFF/NOFF file into vertices, triangles (and normals for NOFF) including the bounding box.
+    // the file is memory mapped and tokenized in place. large files are split into chunks at line
+    // boundaries that are parsed by up to maxThreads threads. returns false if the file could not be read.
+    bool readOFFMapped(const char* filename, unsigned int maxThreads);
+    // sequential tokenizer for the vertex and face block starting at p
+    bool readOFFBody(const char* p, const char* end, bool noff);
+    // parallel parser for the vertex and face block, expects one vertex / face per line
+    bool readOFFBodyParallel(const char* body, const char* end, bool noff, unsigned int maxThreads);
+
+    // same as readOFFMapped, but using std::ifstream. only kept as reference for benchmarkLoadOFF.
+    bool readOFFStream(const char* filename);
+
+    // load vertices, triangles, normals and texture coordinates from the OFF file or its binary cache
+    bool loadOFFData(const char* filename, bool useCache);
+    // read the binary cache of the OFF file sourceFilename. fails if the cache is missing, outdated or of another version.
+    bool readMeshCache(const char* sourceFilename, const char* cacheFilename);
+    // write all mesh data to a binary cache of the OFF file sourceFilename
+    bool writeMeshCache(const char* sourceFilename, const char* cacheFilename) const;
+
+    // calculate normals, weighted by area. large meshes are computed by calculateNormalsParallel.
     void calculateNormalsByArea();
+    // sequential scatter loop, uses the kernel set by setNormalKernel. all kernels give identical results.
+    void accumulateNormals();
+    static NormalKernel normalKernel;
+    // area weighted normals without scattered writes: face normals are computed in parallel, then every
+    // vertex gathers the normals of its adjacent faces in a fixed order. the result is bit-identical to
+    // calculateNormalsByArea for any maxThreads.
+    void calculateNormalsParallel(unsigned int maxThreads);
+    void buildVertexFaceAdjacency();
+    // true if the adjacency was built for the current triangles
+    bool hasVertexFaceAdjacency() const;
+    // every path that changes the triangles calls this, it makes the adjacency stale
+    void trianglesChanged() { ++triangleGeneration; }
+    // moves vertex order[i] to position i in all per vertex attributes, the triangles have to be renumbered already
+    void remapVertices(const std::vector<unsigned int>& order);
 
     // calculate texture coordinates by central projection
     void calculateTexCoordsSphereMapping();
 
+    // grid of generateTerrain with its first vertex at originX, originZ. the heights are extended by one vertex on
+    // every side for the normals at the edges: fillRow(j, heights) writes the heights in [0, 1] of row j - 1 from
+    // column -1 to column settings.resolution (settings.resolution + 2 values), for j in [0, settings.resolution + 2).
+    // it is called from several threads.
+    void generateTerrainRows(const TerrainSettings& settings, float originX, float originZ,
+                             const std::function<void(unsigned int, float*)>& fillRow, bool createVBOs);
+
     // calculates axis aligned bounding box data
     void calculateBB();
 
     // create VBOs for vertices, faces, normals, colors, textureCoords
     void createAllVBOs();
+    // one VBO per attribute, bound to the current VAO
+    void createSeparateVBOs(QOpenGLFunctions_3_3_Core* f);
+    // all attributes in VBOv with strided attribute pointers, bound to the current VAO
+    void createInterleavedVBO(QOpenGLFunctions_3_3_Core* f);
+    // offsets (in bytes) of the attributes within an interleaved vertex, -1 for missing attributes
+    struct InterleavedFormat {
+        bool quantized{false};
+        int stride{0};
+        int normal{-1}, texCoord{-1}, tangent{-1}, color{-1};
+    };
+    InterleavedFormat interleavedFormat(bool quantized) const;
+    // quantized positions are stored relative to the current bounding box, see quantizationOffset/Scale
+    std::vector<unsigned char> interleaveVertices(const InterleavedFormat& format);
+    // bytes of vertex data on the GPU with the given layout
+    size_t vertexMemory(VertexLayout layout) const;
+    // index buffer of all levels of detail, see appendIndexRanges
+    std::vector<unsigned char> buildIndexBuffer();
+    // split count triangles into index ranges and encode them with the smallest index type that fits
+    void appendIndexRanges(const Triangle* levelTriangles, size_t count, std::vector<unsigned char>& data);
+    // copy the normals into the existing normal VBO
+    void uploadNormals();
     // create VBOs for normals
     void createNormalVAO(QOpenGLFunctions_3_3_Core* f);
     void createBBVAO(QOpenGLFunctions_3_3_Core* f);
@@ -186,14 +396,37 @@ public:
 
     // set coloring type
     void setColoringMode(ColoringType type) { coloringType = type; };
+    // switch the GPU vertex layout. recreates the VBOs of a resident mesh.
+    void setVertexLayout(VertexLayout layout);
+    VertexLayout getVertexLayout() const { return vertexLayout; }
+    // bytes of vertex data on the GPU with the current layout
+    size_t getVertexMemory() const { return vertexMemory(vertexLayout); }
+    // bytes of the index buffer on the GPU, 0 if not resident
+    size_t getIndexMemory() const;
 
     // draw mesh with current drawing mode settings. returns the number of triangles drawn.
-    unsigned int draw(RenderState& state);
+    // testBoundingBox = false skips the frustum test of the whole mesh, e.g. if a SceneBvh has already done it.
+    unsigned int draw(RenderState& state, bool testBoundingBox = true);
+    // same for one of several instances of the mesh: lod is the level the instance was drawn with last, it is
+    // updated with the level drawn now. every instance needs its own, the hysteresis of selectLod starts from it.
+    unsigned int draw(RenderState& state, unsigned int& lod, bool testBoundingBox = true);
+    // draws all triangles of the full resolution, no culling and no level of detail, so every call draws the same
+    // indices whatever the camera (used by benchmarkVertexLayouts). returns the number of triangles drawn.
+    unsigned int drawFullResolution(RenderState& state);
 
 private:
 
-    // draw VBO
-    void drawVBO(RenderState& state);
+    // coarsest level of detail whose geometric error, projected at the point of the bounding sphere closest to
+    // the camera, stays below lodPixelThreshold. a coarser level is only taken with LodHysteresis margin, so
+    // meshes close to the threshold do not switch between two levels every frame. lod is the level drawn last,
+    // it is set to the selected one.
+    unsigned int selectLod(const RenderState& state, unsigned int& lod) const;
+    // geometric error of level lod in pixels at the given distance from the camera
+    float lodPixelError(unsigned int lod, float distance, float pixelsPerUnit) const;
+
+    // draw VBO, only the visible chunks of a chunked mesh unless cullChunks is false. returns the number of
+    // triangles drawn.
+    unsigned int drawVBO(RenderState& state, unsigned int lod, bool cullChunks = true);
 
     // draw the bounding box (wired, immediate mode) (withBB)
     void drawBB(RenderState& state);
@@ -207,6 +440,11 @@ private:
 
     // check if bounding box is visible in view frustum
     bool boundingBoxIsVisible(const RenderState& state);
+
+public:
+    // conservative: false only if the box is completely outside one of the planes (see RenderState::getFrustumPlanes).
+    // cullBoxes gives the same results for many boxes at once.
+    static bool boxIsVisible(const std::vector<ClipPlane>& planes, const Vec3f& boxMin, const Vec3f& boxMax);
 };
 
 
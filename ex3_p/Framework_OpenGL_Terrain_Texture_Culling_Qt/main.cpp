@@ -8,6 +8,9 @@
 //                                                                           //
 // Content: Initialisation: Set basic parameters and create OpenGL window    //
 // ========================================================================= //
+#include <cstdlib>
+#include <cstring>
+
 #include <QGuiApplication>
 #include <QSurfaceFormat>
 
@@ -17,6 +20,47 @@
 
 int main(int argc, char *argv[])
 {
+    //Benchmark mode: uebung_03 --benchmark-off file1.off file2.off ...
+    if (argc > 2 && std::strcmp(argv[1], "--benchmark-off") == 0) {
+        for (int i = 2; i < argc; ++i) TriangleMesh::benchmarkLoadOFF(argv[i]);
+        return 0;
+    }
+    //Benchmark mode: uebung_03 --benchmark-optimize file1.off file2.off ...
+    if (argc > 2 && std::strcmp(argv[1], "--benchmark-optimize") == 0) {
+        for (int i = 2; i < argc; ++i) TriangleMesh::benchmarkMeshOptimizer(argv[i]);
+        return 0;
+    }
+    //Benchmark mode: uebung_03 --benchmark-normals file1.off file2.off ...
+    if (argc > 2 && std::strcmp(argv[1], "--benchmark-normals") == 0) {
+        for (int i = 2; i < argc; ++i) TriangleMesh::benchmarkNormals(argv[i]);
+        return 0;
+    }
+    //Benchmark mode: uebung_03 --benchmark-noise [resolution]
+    if (argc > 1 && std::strcmp(argv[1], "--benchmark-noise") == 0) {
+        TriangleMesh::benchmarkNoise(argc > 2 ? static_cast<unsigned int>(std::atoi(argv[2])) : 2048);
+        return 0;
+    }
+    //Benchmark mode: uebung_03 --benchmark-culling [boxes]
+    if (argc > 1 && std::strcmp(argv[1], "--benchmark-culling") == 0) {
+        TriangleMesh::benchmarkCulling(argc > 2 ? static_cast<unsigned int>(std::atoi(argv[2])) : 1000000);
+        return 0;
+    }
+    //Benchmark mode: uebung_03 --benchmark-bvh [camera_path.txt]
+    if (argc > 1 && std::strcmp(argv[1], "--benchmark-bvh") == 0) {
+        SceneBvh::benchmark(argc > 2 ? argv[2] : nullptr);
+        return 0;
+    }
+    //Benchmark mode: uebung_03 --benchmark-occlusion [boxes]
+    if (argc > 1 && std::strcmp(argv[1], "--benchmark-occlusion") == 0) {
+        OcclusionCuller::benchmark(argc > 2 ? static_cast<unsigned int>(std::atoi(argv[2])) : 100000);
+        return 0;
+    }
+    //Benchmark mode: uebung_03 --benchmark-terrain resolution [heightmap.png]
+    if (argc > 2 && std::strcmp(argv[1], "--benchmark-terrain") == 0) {
+        TriangleMesh::benchmarkTerrain(static_cast<unsigned int>(std::atoi(argv[2])), argc > 3 ? argv[3] : nullptr);
+        return 0;
+    }
+
     QGuiApplication a(argc, argv);
 
     //A surface format specifies several parameters about the OpenGL context we want to create
@@ -0,0 +1,528 @@
+// Tests of the parts that need no OpenGL context. Every failed check is printed, the exit code is 1 if there is
+// any. Run by ctest in the build directory, the files it writes there are removed again.
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+#include "TriangleMesh.h"
+#include "MeshOptimizer.h"
+#include "OcclusionCuller.h"
+#include "RenderState.h"
+#include "SceneBvh.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool condition, const char* text, int line) {
+    if (condition) return;
+    std::cout << "tests.cpp:" << line << ": failed: " << text << std::endl;
+    ++failures;
+}
+
+#define CHECK(condition) check(condition, #condition, __LINE__)
+
+bool same(const Vec3f& a, const Vec3f& b) {
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+bool same(const Vec3ui& a, const Vec3ui& b) {
+    return a[0] == b[0] && a[1] == b[1] && a[2] == b[2];
+}
+
+void writeFile(const char* filename, const std::string& content) {
+    std::ofstream file(filename, std::ios::binary);
+    file << content;
+}
+
+// boxes of up to 20 units scattered above a 2000 x 2000 ground, like SceneBvh::benchmark
+void randomBoxes(unsigned int count, unsigned int seed, std::vector<Vec3f>& boxMin, std::vector<Vec3f>& boxMax) {
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> position(-1000.0f, 1000.0f), height(0.0f, 50.0f), size(1.0f, 20.0f);
+    boxMin.resize(count);
+    boxMax.resize(count);
+    for (unsigned int i = 0; i < count; ++i) {
+        boxMin[i] = Vec3f(position(random), height(random), position(random));
+        boxMax[i] = boxMin[i] + Vec3f(size(random), size(random), size(random));
+    }
+}
+
+QMatrix4x4 cameraMatrix(const QVector3D& eye, const QVector3D& center, float aspect) {
+    QMatrix4x4 matrix;
+    matrix.perspective(65.0f, aspect, 0.5f, 10000.0f);
+    matrix.lookAt(eye, center, QVector3D(0.0f, 1.0f, 0.0f));
+    return matrix;
+}
+
+// Moeller-Trumbore, with a little slack at the edges so rays through shared edges do not slip through
+bool rayHitsTriangle(const Vec3f& origin, const Vec3f& direction, const Vec3f& a, const Vec3f& b, const Vec3f& c, float& t) {
+    const Vec3f edge1 = b - a, edge2 = c - a, p = cross(direction, edge2);
+    const float determinant = edge1 * p;
+    if (std::fabs(determinant) < 1e-12f) return false;
+    const float invDeterminant = 1.0f / determinant;
+    const Vec3f s = origin - a;
+    const float u = (s * p) * invDeterminant;
+    if (u < -1e-5f || u > 1.0f + 1e-5f) return false;
+    const Vec3f q = cross(s, edge1);
+    const float v = (direction * q) * invDeterminant;
+    if (v < -1e-5f || u + v > 1.0f + 1e-5f) return false;
+    t = (edge2 * q) * invDeterminant;
+    return true;
+}
+
+}
+
+// ====================
+// === TRIANGLEMESH ===
+// ====================
+
+struct TriangleMeshTests {
+    static void offReaders();
+    static void indexRanges();
+    static void weldVertices();
+    static void levelsOfDetail();
+
+    // triangles of the index ranges from firstRange on, decoded from the index buffer
+    static std::vector<Vec3ui> decodeIndexRanges(const TriangleMesh& mesh, const std::vector<unsigned char>& data, size_t firstRange);
+};
+
+void TriangleMeshTests::offReaders() {
+    // a small file with every reader: face colors behind the indices are skipped, the bounding box is set
+    const char* small = "tests_small.off";
+    writeFile(small, "OFF\n4 2 0\n0 0 0\n1.5 0 0\n0 -2 0\n0 0 1e1\n3 0 1 2\n3 0 2 3 255 0 0\n");
+    for (int reader = 0; reader < 3; ++reader) {
+        TriangleMesh mesh;
+        CHECK(reader == 0 ? mesh.readOFFStream(small) : mesh.readOFFMapped(small, reader == 1 ? 1 : 4));
+        CHECK(mesh.vertices.size() == 4 && mesh.triangles.size() == 2 && mesh.normals.empty());
+        if (mesh.vertices.size() != 4 || mesh.triangles.size() != 2) continue;
+        CHECK(same(mesh.vertices[1], Vec3f(1.5f, 0.0f, 0.0f)) && same(mesh.vertices[2], Vec3f(0.0f, -2.0f, 0.0f)) && same(mesh.vertices[3], Vec3f(0.0f, 0.0f, 10.0f)));
+        CHECK(same(mesh.triangles[0], Vec3ui(0, 1, 2)) && same(mesh.triangles[1], Vec3ui(0, 2, 3)));
+        CHECK(same(mesh.boundingBoxMin, Vec3f(0.0f, -2.0f, 0.0f)) && same(mesh.boundingBoxMax, Vec3f(1.5f, 0.0f, 10.0f)));
+    }
+    // NOFF has a normal behind every position
+    writeFile(small, "NOFF\n3 1 0\n0 0 0 0 0 1\n1 0 0 0 0 1\n0 1 0 0 0 -1\n3 0 1 2\n");
+    for (int reader = 0; reader < 2; ++reader) {
+        TriangleMesh mesh;
+        CHECK(reader == 0 ? mesh.readOFFStream(small) : mesh.readOFFMapped(small, 1));
+        CHECK(mesh.normals.size() == 3 && same(mesh.normals[0], Vec3f(0.0f, 0.0f, 1.0f)) && same(mesh.normals[2], Vec3f(0.0f, 0.0f, -1.0f)));
+    }
+    // an index out of range is malformed
+    writeFile(small, "OFF\n3 1 0\n0 0 0\n1 0 0\n0 1 0\n3 0 1 3\n");
+    TriangleMesh malformed;
+    CHECK(!malformed.readOFFMapped(small, 1));
+    CHECK(malformed.vertices.empty() && malformed.triangles.empty());
+    std::remove(small);
+
+    // a grid of more than ParallelLoadMinBytes, so the mapped reader splits it into chunks. the coordinates are
+    // exact in binary, every reader has to return exactly them.
+    const unsigned int side = 300;
+    std::vector<Vec3f> positions;
+    std::vector<Vec3ui> faces;
+    std::string content = "OFF\n" + std::to_string(side * side) + " " + std::to_string(2 * (side - 1) * (side - 1)) + " 0\n";
+    char line[128];
+    for (unsigned int j = 0; j < side; ++j) {
+        for (unsigned int i = 0; i < side; ++i) {
+            positions.emplace_back(i * 0.125f - 10.0f, (i * j % 97) * 0.5f - 3.0f, j * 0.25f);
+            std::snprintf(line, sizeof(line), "%g %g %g\n", positions.back()[0], positions.back()[1], positions.back()[2]);
+            content += line;
+        }
+    }
+    for (unsigned int j = 0; j + 1 < side; ++j) {
+        for (unsigned int i = 0; i + 1 < side; ++i) {
+            const unsigned int v00 = j * side + i, v10 = v00 + 1, v01 = v00 + side, v11 = v01 + 1;
+            faces.emplace_back(v00, v01, v10);
+            faces.emplace_back(v10, v01, v11);
+        }
+    }
+    for (const Vec3ui& face : faces) {
+        std::snprintf(line, sizeof(line), "3 %u %u %u\n", face[0], face[1], face[2]);
+        content += line;
+    }
+    const char* grid = "tests_grid.off";
+    const std::string cache = std::string(grid) + ".meshcache";
+    writeFile(grid, content);
+    std::remove(cache.c_str());
+    for (int reader = 0; reader < 3; ++reader) {
+        TriangleMesh mesh;
+        CHECK(reader == 0 ? mesh.readOFFStream(grid) : mesh.readOFFMapped(grid, reader == 1 ? 1 : 4));
+        CHECK(mesh.vertices.size() == positions.size() && mesh.triangles.size() == faces.size());
+        if (mesh.vertices.size() != positions.size() || mesh.triangles.size() != faces.size()) continue;
+        bool identical = true;
+        for (size_t v = 0; v < positions.size(); ++v) identical = identical && same(mesh.vertices[v], positions[v]);
+        for (size_t f = 0; f < faces.size(); ++f) identical = identical && same(mesh.triangles[f], faces[f]);
+        CHECK(identical);
+    }
+    // the second loadOFF reads the cache the first one wrote, with the same result
+    TriangleMesh parsed, cached;
+    parsed.loadOFF(grid, false);
+    cached.loadOFF(grid, false);
+    CHECK(parsed.vertices.size() == cached.vertices.size() && parsed.triangles.size() == cached.triangles.size() && parsed.lods.size() == cached.lods.size());
+    if (parsed.vertices.size() == cached.vertices.size() && parsed.triangles.size() == cached.triangles.size()) {
+        bool identical = parsed.normals.size() == cached.normals.size();
+        for (size_t v = 0; v < parsed.vertices.size() && identical; ++v) identical = same(parsed.vertices[v], cached.vertices[v]) && same(parsed.normals[v], cached.normals[v]);
+        for (size_t f = 0; f < parsed.triangles.size() && identical; ++f) identical = same(parsed.triangles[f], cached.triangles[f]);
+        CHECK(identical);
+    }
+    std::remove(grid);
+    std::remove(cache.c_str());
+}
+
+std::vector<Vec3ui> TriangleMeshTests::decodeIndexRanges(const TriangleMesh& mesh, const std::vector<unsigned char>& data, size_t firstRange) {
+    std::vector<unsigned int> indices;
+    for (size_t r = firstRange; r < mesh.indexRanges.size(); ++r) {
+        const TriangleMesh::IndexRange& range = mesh.indexRanges[r];
+        for (GLsizei i = 0; i < range.count; ++i) {
+            if (range.type == GL_UNSIGNED_SHORT) {
+                uint16_t index;
+                std::memcpy(&index, &data[range.offset + i * sizeof(uint16_t)], sizeof(index));
+                indices.push_back(index + range.baseVertex);
+            } else {
+                uint32_t index;
+                std::memcpy(&index, &data[range.offset + i * sizeof(uint32_t)], sizeof(index));
+                indices.push_back(index + range.baseVertex);
+            }
+        }
+    }
+    std::vector<Vec3ui> triangles;
+    for (size_t i = 0; i + 2 < indices.size(); i += 3) triangles.emplace_back(indices[i], indices[i + 1], indices[i + 2]);
+    return triangles;
+}
+
+void TriangleMeshTests::indexRanges() {
+    auto allShort = [](const TriangleMesh& mesh) {
+        return std::all_of(mesh.indexRanges.begin(), mesh.indexRanges.end(), [](const TriangleMesh::IndexRange& range) { return range.type == GL_UNSIGNED_SHORT; });
+    };
+    auto sameTriangles = [](const std::vector<Vec3ui>& a, const std::vector<Vec3ui>& b) {
+        return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(), [](const Vec3ui& x, const Vec3ui& y) { return same(x, y); });
+    };
+    // a strip over 200000 vertices is split into several 16 bit ranges
+    TriangleMesh mesh;
+    std::vector<Vec3ui> strip;
+    for (unsigned int i = 0; i + 2 < 200000; ++i) strip.emplace_back(i, i + 1, i + 2);
+    std::vector<unsigned char> data;
+    mesh.appendIndexRanges(strip.data(), strip.size(), data);
+    CHECK(mesh.indexRanges.size() > 1 && allShort(mesh));
+    CHECK(sameTriangles(decodeIndexRanges(mesh, data, 0), strip));
+
+    // a single triangle spanning more than 65536 vertices needs 32 bit indices
+    std::vector<Vec3ui> wide = { Vec3ui(0, 1, 2), Vec3ui(2, 1, 100000) };
+    mesh.indexRanges.clear();
+    data.clear();
+    mesh.appendIndexRanges(wide.data(), wide.size(), data);
+    CHECK(mesh.indexRanges.size() == 1 && mesh.indexRanges[0].type == GL_UNSIGNED_INT);
+    CHECK(sameTriangles(decodeIndexRanges(mesh, data, 0), wide));
+
+    // shuffled triangles jump all over the vertices and would need too many ranges, they fall back to a single
+    // 32 bit range. ranges appended behind existing ones start at their own offset.
+    const unsigned int side = 400;
+    std::vector<Vec3ui> grid;
+    for (unsigned int j = 0; j + 1 < side; ++j) {
+        for (unsigned int i = 0; i + 1 < side; ++i) {
+            const unsigned int v00 = j * side + i;
+            grid.emplace_back(v00, v00 + side, v00 + 1);
+            grid.emplace_back(v00 + 1, v00 + side, v00 + side + 1);
+        }
+    }
+    std::shuffle(grid.begin(), grid.end(), std::mt19937(1));
+    const size_t firstRange = mesh.indexRanges.size();
+    mesh.appendIndexRanges(grid.data(), grid.size(), data);
+    CHECK(mesh.indexRanges.size() == firstRange + 1 && mesh.indexRanges.back().type == GL_UNSIGNED_INT);
+    CHECK(sameTriangles(decodeIndexRanges(mesh, data, firstRange), grid));
+}
+
+void TriangleMeshTests::weldVertices() {
+    // a cube with three copies of every corner per triangle, each moved by less than half the epsilon
+    const Vec3f corners[8] = { Vec3f(0, 0, 0), Vec3f(1, 0, 0), Vec3f(0, 1, 0), Vec3f(1, 1, 0),
+                               Vec3f(0, 0, 1), Vec3f(1, 0, 1), Vec3f(0, 1, 1), Vec3f(1, 1, 1) };
+    const unsigned int faces[12][3] = { { 0, 2, 1 }, { 1, 2, 3 }, { 4, 5, 6 }, { 5, 7, 6 }, { 0, 1, 4 }, { 1, 5, 4 },
+                                        { 2, 6, 3 }, { 3, 6, 7 }, { 0, 4, 2 }, { 2, 4, 6 }, { 1, 3, 5 }, { 3, 7, 5 } };
+    std::mt19937 random(1);
+    std::uniform_real_distribution<float> jitter(-0.4f * EPS, 0.4f * EPS);
+    TriangleMesh cube;
+    for (const auto& face : faces) {
+        const unsigned int first = static_cast<unsigned int>(cube.vertices.size());
+        for (unsigned int k = 0; k < 3; ++k) cube.vertices.push_back(corners[face[k]] + Vec3f(jitter(random), jitter(random), jitter(random)));
+        cube.triangles.emplace_back(first, first + 1, first + 2);
+    }
+    // collapses to a line once its first two vertices are welded
+    cube.vertices.push_back(corners[0]);
+    cube.vertices.push_back(Vec3f(0.5f, 0.5f, 0.5f));
+    cube.triangles.emplace_back(0, 36, 37);
+    cube.weldVertices();
+    CHECK(cube.vertices.size() == 9 && cube.triangles.size() == 12);
+    bool cornersKept = cube.triangles.size() == 12;
+    for (size_t i = 0; i < cube.triangles.size() && cornersKept; ++i) {
+        for (unsigned int k = 0; k < 3; ++k) {
+            const Vec3f difference = cube.vertices[cube.triangles[i][k]] - corners[faces[i][k]];
+            cornersKept = cornersKept && std::fabs(difference[0]) <= EPS && std::fabs(difference[1]) <= EPS && std::fabs(difference[2]) <= EPS;
+        }
+    }
+    CHECK(cornersKept);
+
+    // vertices further apart than the epsilon and vertices with different normals stay apart
+    TriangleMesh seams;
+    seams.vertices = { Vec3f(0, 0, 0), Vec3f(1, 0, 0), Vec3f(0, 1, 0), Vec3f(0, 1 + 3 * EPS, 0), Vec3f(0, 0, 0) };
+    seams.normals = { Vec3f(0, 0, 1), Vec3f(0, 0, 1), Vec3f(0, 0, 1), Vec3f(0, 0, 1), Vec3f(0, 1, 0) };
+    seams.triangles = { Vec3ui(0, 1, 2), Vec3ui(4, 1, 3) };
+    seams.weldVertices();
+    CHECK(seams.vertices.size() == 5 && seams.triangles.size() == 2);
+}
+
+void TriangleMeshTests::levelsOfDetail() {
+    // welding closes the seam and the poles of the sphere, the simplification never moves border vertices
+    TriangleMesh sphere;
+    sphere.generateSphere(false);
+    sphere.weldVertices();
+    sphere.generateLods(3);
+    CHECK(sphere.lods.size() == 3);
+    size_t previousTriangles = sphere.triangles.size();
+    float previousError = 0.0f;
+    for (const TriangleMesh::LodLevel& lod : sphere.lods) {
+        CHECK(4 * lod.triangles.size() <= 3 * previousTriangles);
+        // the levels continue from each other, so the error only grows. it stays far below the radius of 1.
+        CHECK(lod.error >= previousError && lod.error > 0.0f && lod.error < 0.25f);
+        bool valid = true;
+        for (const Vec3ui& t : lod.triangles) {
+            valid = valid && t[0] < sphere.vertices.size() && t[1] < sphere.vertices.size() && t[2] < sphere.vertices.size();
+            valid = valid && t[0] != t[1] && t[1] != t[2] && t[2] != t[0];
+        }
+        CHECK(valid);
+        previousTriangles = lod.triangles.size();
+        previousError = lod.error;
+    }
+    // the errors are in object units and scale with the mesh
+    std::vector<float> errors;
+    for (const TriangleMesh::LodLevel& lod : sphere.lods) errors.push_back(lod.error);
+    sphere.scaleToLength(2.0f * std::max(sphere.boundingBoxSize[0], std::max(sphere.boundingBoxSize[1], sphere.boundingBoxSize[2])), false);
+    for (size_t i = 0; i < errors.size() && i < sphere.lods.size(); ++i) CHECK(std::fabs(sphere.lods[i].error - 2.0f * errors[i]) <= 1e-6f * errors[i]);
+
+    // collapses within a plane cost nothing
+    const unsigned int side = 40;
+    std::vector<Vec3f> vertices;
+    std::vector<Vec3ui> triangles;
+    for (unsigned int j = 0; j < side; ++j) {
+        for (unsigned int i = 0; i < side; ++i) vertices.emplace_back(float(i), 0.0f, float(j));
+    }
+    for (unsigned int j = 0; j + 1 < side; ++j) {
+        for (unsigned int i = 0; i + 1 < side; ++i) {
+            const unsigned int v00 = j * side + i;
+            triangles.emplace_back(v00, v00 + side, v00 + 1);
+            triangles.emplace_back(v00 + 1, v00 + side, v00 + side + 1);
+        }
+    }
+    const std::vector<SimplifiedLevel> levels = simplifyMesh(triangles, vertices, { triangles.size() / 2, triangles.size() / 4 });
+    CHECK(levels.size() == 2);
+    for (const SimplifiedLevel& level : levels) CHECK(level.triangles.size() < triangles.size() && level.error < 1e-3f);
+}
+
+// ===============
+// === KERNELS ===
+// ===============
+
+static void noiseKernels() {
+    // rows that are not a multiple of the SIMD width, across negative lattice coordinates
+    NoiseSettings settings;
+    const size_t count = 1001;
+    std::vector<float> reference(count), result(count);
+    for (NoiseKernel kernel : { NoiseKernel::SSE, NoiseKernel::AVX2 }) {
+        if (!noiseKernelSupported(kernel)) continue;
+        bool identical = true;
+        for (int row = 0; row < 16; ++row) {
+            const float y = -3.7f + 0.61f * row;
+            fbmRow(NoiseKernel::SCALAR, settings, -5.3f, 0.0123f, y, count, reference.data());
+            fbmRow(kernel, settings, -5.3f, 0.0123f, y, count, result.data());
+            identical = identical && std::memcmp(reference.data(), result.data(), count * sizeof(float)) == 0;
+        }
+        CHECK(identical);
+    }
+}
+
+static void cullingKernels() {
+    std::vector<Vec3f> boxMin, boxMax;
+    randomBoxes(10001, 2, boxMin, boxMax);
+    BoxArray boxes;
+    for (size_t i = 0; i < boxMin.size(); ++i) boxes.push_back(boxMin[i], boxMax[i]);
+    const std::vector<ClipPlane> planes = RenderState::extractFrustumPlanes(cameraMatrix(QVector3D(0.0f, 20.0f, 0.0f), QVector3D(300.0f, 0.0f, -500.0f), 1.5f));
+    const std::vector<CullingPlane> prepared = cullingPlanes(planes);
+    std::vector<uint8_t> reference(boxMin.size());
+    size_t referenceCount = 0;
+    for (size_t i = 0; i < boxMin.size(); ++i) {
+        reference[i] = TriangleMesh::boxIsVisible(planes, boxMin[i], boxMax[i]);
+        referenceCount += reference[i];
+    }
+    CHECK(referenceCount > 0 && referenceCount < boxMin.size());
+    for (CullingKernel kernel : { CullingKernel::SCALAR, CullingKernel::SSE, CullingKernel::AVX }) {
+        if (!cullingKernelSupported(kernel)) continue;
+        std::vector<uint8_t> visible(boxMin.size());
+        CHECK(cullBoxes(kernel, prepared, boxes, visible.data()) == referenceCount);
+        CHECK(visible == reference);
+    }
+}
+
+// ===============
+// === CULLING ===
+// ===============
+
+static void sceneBvh() {
+    std::vector<Vec3f> boxMin, boxMax;
+    randomBoxes(20000, 3, boxMin, boxMax);
+    // empty boxes are never visible
+    for (size_t i = 0; i < boxMin.size(); i += 997) std::swap(boxMin[i], boxMax[i]);
+    SceneBvh bvh;
+    bvh.build(boxMin, boxMax);
+    std::vector<unsigned int> visible, expected;
+    auto compare = [&](bool masking, bool coherence) {
+        bvh.setPlaneMasking(masking);
+        bvh.setTemporalCoherence(coherence);
+        // the camera turns around, so the remembered planes go stale
+        for (int frame = 0; frame < 60; ++frame) {
+            const float angle = 6.0f * frame * 3.14159265f / 180.0f;
+            const QVector3D eye(0.0f, 20.0f, -2.0f * frame);
+            const std::vector<ClipPlane> planes = RenderState::extractFrustumPlanes(cameraMatrix(eye, eye + QVector3D(std::sin(angle), -0.1f, -std::cos(angle)), 1.5f));
+            visible.clear();
+            bvh.cull(cullingPlanes(planes), visible);
+            std::sort(visible.begin(), visible.end());
+            expected.clear();
+            for (unsigned int i = 0; i < boxMin.size(); ++i) {
+                const bool empty = boxMin[i][0] > boxMax[i][0] || boxMin[i][1] > boxMax[i][1] || boxMin[i][2] > boxMax[i][2];
+                if (!empty && TriangleMesh::boxIsVisible(planes, boxMin[i], boxMax[i])) expected.push_back(i);
+            }
+            CHECK(visible == expected);
+        }
+    };
+    for (int variant = 0; variant < 4; ++variant) compare(variant & 1, variant & 2);
+    // moved objects refit the tree (or rebuild it), the result stays the same as brute force
+    std::mt19937 random(4);
+    std::uniform_real_distribution<float> offset(-100.0f, 100.0f);
+    for (size_t i = 0; i < boxMin.size(); i += 3) {
+        const Vec3f move(offset(random), 0.0f, offset(random));
+        boxMin[i] += move;
+        boxMax[i] += move;
+    }
+    bvh.refit(boxMin, boxMax);
+    compare(true, true);
+}
+
+static void occlusionCuller() {
+    // boxes behind and above the terrain of generateTerrain. a box counts as wrongly occluded if the ray from the
+    // camera to any of its corners or of some random points inside it does not hit the occluder. the buffer sizes
+    // that are not powers of two have hi-Z levels with an odd number of rows or columns.
+    TriangleMesh terrain;
+    terrain.generateTerrain(TriangleMesh::TerrainSettings(), NoiseSettings(), false);
+    const Occluder& occluder = terrain.getOccluder();
+    CHECK(!occluder.empty() && occluder.neighbours.size() == occluder.indices.size());
+    std::mt19937 random(5);
+    std::uniform_real_distribution<float> position(-100.0f, 100.0f), height(0.0f, 25.0f), extent(0.5f, 5.0f), unit(0.0f, 1.0f);
+    std::vector<Vec3f> boxMin(5000), boxMax(5000);
+    for (size_t i = 0; i < boxMin.size(); ++i) {
+        boxMin[i] = Vec3f(position(random), height(random), position(random));
+        boxMax[i] = boxMin[i] + Vec3f(extent(random), extent(random), extent(random));
+    }
+    const QVector3D eyes[] = { QVector3D(0.0f, 15.0f, 110.0f), QVector3D(40.0f, 6.0f, 90.0f), QVector3D(-80.0f, 30.0f, 60.0f) };
+    const unsigned int bufferSizes[][2] = { { 256, 128 }, { 192, 96 }, { 320, 160 } };
+    unsigned int occludedTotal = 0, wrong = 0;
+    for (const QVector3D& eye : eyes) {
+        for (const auto& bufferSize : bufferSizes) {
+            const QMatrix4x4 viewProjection = cameraMatrix(eye, QVector3D(0.0f, 8.0f, 0.0f), 2.0f);
+            OcclusionCuller culler(bufferSize[0], bufferSize[1]);
+            CHECK(culler.getWidth() == bufferSize[0] && culler.getHeight() == bufferSize[1]);
+            std::vector<float> reference;
+            std::vector<unsigned int> referenceVisible;
+            for (CullingKernel kernel : { CullingKernel::SCALAR, CullingKernel::SSE, CullingKernel::AVX }) {
+                if (!cullingKernelSupported(kernel)) continue;
+                culler.setKernel(kernel);
+                culler.beginFrame(viewProjection);
+                culler.addOccluder(occluder, QMatrix4x4());
+                culler.rasterize();
+                std::vector<unsigned int> visible(boxMin.size());
+                for (unsigned int i = 0; i < visible.size(); ++i) visible[i] = i;
+                culler.cull(visible, boxMin, boxMax);
+                if (reference.empty()) {
+                    reference = culler.getDepthBuffer();
+                    referenceVisible = visible;
+                }
+                CHECK(culler.getDepthBuffer() == reference && visible == referenceVisible);
+            }
+            const Vec3f origin(eye.x(), eye.y(), eye.z());
+            for (unsigned int i = 0; i < boxMin.size(); ++i) {
+                if (!culler.isOccluded(boxMin[i], boxMax[i])) continue;
+                ++occludedTotal;
+                bool hidden = true;
+                for (int sample = 0; sample < 64 && hidden; ++sample) {
+                    Vec3f point;
+                    for (unsigned int k = 0; k < 3; ++k) {
+                        const float s = sample < 8 ? float((sample >> k) & 1) : unit(random);
+                        point[k] = boxMin[i][k] + s * (boxMax[i][k] - boxMin[i][k]);
+                    }
+                    const Vec3f direction = point - origin;
+                    bool hit = false;
+                    for (size_t t = 0; t + 2 < occluder.indices.size() && !hit; t += 3) {
+                        float distance;
+                        hit = rayHitsTriangle(origin, direction, occluder.vertices[occluder.indices[t]], occluder.vertices[occluder.indices[t + 1]],
+                                              occluder.vertices[occluder.indices[t + 2]], distance) && distance > 0.0f && distance < 1.0f;
+                    }
+                    hidden = hit;
+                }
+                wrong += !hidden;
+            }
+        }
+    }
+    // the test only means something if boxes are occluded at all
+    CHECK(occludedTotal > 0);
+    CHECK(wrong == 0);
+}
+
+static void occlusionOddLevels() {
+    // a wall in front of the lower part (the left part) of the screen, with clip coordinates = world coordinates.
+    // the upper rows (right columns) of the coarse hi-Z levels come from an odd number of finer ones. the big box
+    // reaches into them, where the wall does not cover it, and must stay visible.
+    const struct Case {
+        unsigned int width, height;
+        Vec3f wallMax, visibleMax, hiddenMax;
+    } cases[] = { { 192, 96, Vec3f(2.0f, 0.45f, 0.0f), Vec3f(1.0f, 1.0f, 0.8f), Vec3f(1.0f, 0.0f, 0.8f) },
+                  { 320, 160, Vec3f(0.7f, 2.0f, 0.0f), Vec3f(1.0f, 0.5f, 0.8f), Vec3f(0.5f, 0.5f, 0.8f) } };
+    const Vec3f boxMin(-1.0f, -1.0f, 0.6f);
+    for (const Case& c : cases) {
+        Occluder wall;
+        wall.vertices = { Vec3f(-2.0f, -2.0f, 0.0f), Vec3f(c.wallMax[0], -2.0f, 0.0f), Vec3f(c.wallMax[0], c.wallMax[1], 0.0f), Vec3f(-2.0f, c.wallMax[1], 0.0f) };
+        wall.indices = { 0, 1, 2, 0, 2, 3 };
+        wall.buildNeighbours();
+        OcclusionCuller culler(c.width, c.height);
+        culler.beginFrame(QMatrix4x4());
+        culler.addOccluder(wall, QMatrix4x4());
+        culler.rasterize();
+        CHECK(!culler.isOccluded(boxMin, c.visibleMax));
+        CHECK(culler.isOccluded(boxMin, c.hiddenMax));
+    }
+}
+
+int main() {
+    const struct Test {
+        const char* name;
+        void (*run)();
+    } tests[] = {
+        { "OFF readers", TriangleMeshTests::offReaders },
+        { "index ranges", TriangleMeshTests::indexRanges },
+        { "weldVertices", TriangleMeshTests::weldVertices },
+        { "levels of detail", TriangleMeshTests::levelsOfDetail },
+        { "noise kernels", noiseKernels },
+        { "culling kernels", cullingKernels },
+        { "SceneBvh", sceneBvh },
+        { "OcclusionCuller", occlusionCuller },
+        { "hi-Z of odd sizes", occlusionOddLevels },
+    };
+    for (const Test& test : tests) {
+        const int before = failures;
+        test.run();
+        std::cout << test.name << ": " << (failures == before ? "ok" : "FAILED") << std::endl;
+    }
+    return failures == 0 ? 0 : 1;
+}